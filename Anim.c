@@ -0,0 +1,565 @@
+#include <Uefi.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+
+#include "Anim.h"
+
+#define NEKO_ANIM_VIAS 64
+#define NEKO_ANIM_WORDS 5
+#define NEKO_ANIM_ANY 0xFF       // * in a via
+#define NEKO_ANIM_NONE 0xFF      // no sequence started yet
+
+// the names of NekoAnimationType, in order
+static CONST CHAR8 *mAnimKinds[NEKO_ANIM_KINDS] = {
+   "idle", "startled",
+   "run-up", "run-up-right", "run-right", "run-down-right",
+   "run-down", "run-down-left", "run-left", "run-up-left",
+   "scratch-up", "scratch-right", "scratch-down", "scratch-left",
+};
+
+// what the cat did before there were manifests
+static CONST CHAR8 mAnimBuiltin[] =
+   "sequence idle\n"
+   "frame 0 0 12\n"
+   "frame 1 0 4\n"
+   "loop\n"
+   "frame 2 0 4\n"
+   "frame 3 0 4\n"
+   "repeat 2\n"
+   "frame 4 0 12\n"
+   "loop\n"
+   "frame 5 0 8\n"
+   "frame 6 0 8\n"
+   "repeat 0\n"
+   "sequence startled hold still\n"
+   "frame 7 0 8\n"
+   "sequence run-up\n"
+   "frame 0 2 5\n"
+   "frame 1 2 5\n"
+   "sequence run-up-right\n"
+   "frame 6 1 5\n"
+   "frame 7 1 5\n"
+   "sequence run-right\n"
+   "frame 4 1 5\n"
+   "frame 5 1 5\n"
+   "sequence run-down-right\n"
+   "frame 2 1 5\n"
+   "frame 3 1 5\n"
+   "sequence run-down\n"
+   "frame 0 1 5\n"
+   "frame 1 1 5\n"
+   "sequence run-down-left\n"
+   "frame 6 2 5\n"
+   "frame 7 2 5\n"
+   "sequence run-left\n"
+   "frame 4 2 5\n"
+   "frame 5 2 5\n"
+   "sequence run-up-left\n"
+   "frame 2 2 5\n"
+   "frame 3 2 5\n"
+   "sequence scratch-up\n"
+   "frame 4 3 5\n"
+   "frame 5 3 5\n"
+   "sequence scratch-right\n"
+   "frame 2 3 5\n"
+   "frame 3 3 5\n"
+   "sequence scratch-down\n"
+   "frame 6 3 5\n"
+   "frame 7 3 5\n"
+   "sequence scratch-left\n"
+   "frame 0 3 5\n"
+   "frame 1 3 5\n"
+   "via idle * startled\n";
+
+static NEKO_ANIMS mAnimBuiltinSet;
+static BOOLEAN mAnimBuiltinReady;
+
+typedef struct {
+   UINT8 From;
+   UINT8 To;
+   UINT8 Through;
+} NEKO_ANIM_VIA;
+
+// a compile in progress
+typedef struct {
+   NEKO_ANIMS *Anims;
+   UINT8 Current;          // the sequence frames go to
+   BOOLEAN Loop;           // the next frame begins a loop
+   UINTN GridWidth;
+   UINTN GridHeight;
+   UINTN GridGap;
+   NEKO_ANIM_VIA Via[NEKO_ANIM_VIAS];
+   UINTN ViaCount;
+   UINTN Named[NEKO_ANIM_SEQUENCES]; // the line a sequence first came up on
+} NEKO_ANIM_PARSE;
+
+// a decimal up to Max, and nothing else
+static BOOLEAN EFIAPI
+AnimNumber(CONST CHAR8 *Word, UINTN Max, UINTN *Value) {
+   UINTN N = 0;
+
+   if (*Word == '\0') {
+      return FALSE;
+   }
+   for (; *Word != '\0'; Word++) {
+      if (*Word < '0' || *Word > '9') {
+         return FALSE;
+      }
+      N = N * 10 + (*Word - '0');
+      if (N > Max) {
+         return FALSE;
+      }
+   }
+   *Value = N;
+   return TRUE;
+}
+
+// the same, with a sign if it likes
+static BOOLEAN EFIAPI
+AnimSigned(CONST CHAR8 *Word, UINTN Max, INT16 *Value) {
+   UINTN N;
+
+   if (!AnimNumber(Word + (*Word == '-'), Max, &N)) {
+      return FALSE;
+   }
+   *Value = (INT16)(*Word == '-' ? -(INTN)N : (INTN)N);
+   return TRUE;
+}
+
+// the sequence called Word, added if there is none yet. * is any.
+static BOOLEAN EFIAPI
+AnimName(NEKO_ANIM_PARSE *Parse, CONST CHAR8 *Word, BOOLEAN Any,
+         UINTN Line, UINT8 *Id) {
+   NEKO_ANIMS *Anims = Parse->Anims;
+
+   if (Any && AsciiStrCmp(Word, "*") == 0) {
+      *Id = NEKO_ANIM_ANY;
+      return TRUE;
+   }
+   for (UINTN i = 0; i < Anims->SequenceCount; i++) {
+      if (AsciiStrCmp(Word, Anims->Names[i]) == 0) {
+         *Id = (UINT8)i;
+         return TRUE;
+      }
+   }
+
+   UINTN Length = AsciiStrLen(Word);
+   if (Length >= NEKO_ANIM_NAME ||
+       Anims->SequenceCount == NEKO_ANIM_SEQUENCES) {
+      return FALSE;
+   }
+   CopyMem(Anims->Names[Anims->SequenceCount], Word, Length + 1);
+   Parse->Named[Anims->SequenceCount] = Line;
+   *Id = (UINT8)Anims->SequenceCount++;
+   return TRUE;
+}
+
+// a sequence defined again loses its old frames, and starts over at the
+// end of the table
+static VOID EFIAPI
+AnimDrop(NEKO_ANIMS *Anims, UINT8 Id) {
+   NEKO_ANIM_SEQUENCE *Sequence = &Anims->Sequences[Id];
+   UINTN End = Sequence->First + Sequence->Count;
+
+   CopyMem(&Anims->Frames[Sequence->First], &Anims->Frames[End],
+           (Anims->FrameCount - End) * sizeof(NEKO_ANIM_FRAME));
+   Anims->FrameCount -= Sequence->Count;
+   for (UINTN i = 0; i < Anims->SequenceCount; i++) {
+      if (Anims->Sequences[i].First >= End) {
+         Anims->Sequences[i].First -= Sequence->Count;
+      }
+   }
+   Sequence->First = (UINT16)Anims->FrameCount;
+   Sequence->Count = 0;
+}
+
+// one line, cut into words. FALSE if it makes no sense.
+static BOOLEAN EFIAPI
+AnimLine(NEKO_ANIM_PARSE *Parse, CHAR8 **Words, UINTN Count, UINTN Line) {
+   NEKO_ANIMS *Anims = Parse->Anims;
+   NEKO_ANIM_SEQUENCE *Sequence = Parse->Current == NEKO_ANIM_NONE
+                                ? NULL : &Anims->Sequences[Parse->Current];
+   NEKO_ANIM_FRAME *Last = Sequence == NULL || Sequence->Count == 0
+                         ? NULL : &Anims->Frames[Anims->FrameCount - 1];
+   UINTN N[4];
+   UINT8 Id;
+
+   if (AsciiStrCmp(Words[0], "grid") == 0) {
+      N[2] = 0;
+      if (Count < 3 || Count > 4 ||
+          !AnimNumber(Words[1], NEKO_ANIM_MAX_SIZE, &N[0]) ||
+          !AnimNumber(Words[2], NEKO_ANIM_MAX_SIZE, &N[1]) ||
+          (Count == 4 && !AnimNumber(Words[3], NEKO_ANIM_MAX_SIZE, &N[2])) ||
+          N[0] == 0 || N[1] == 0) {
+         return FALSE;
+      }
+      Parse->GridWidth = N[0];
+      Parse->GridHeight = N[1];
+      Parse->GridGap = N[2];
+      return TRUE;
+   }
+
+   if (AsciiStrCmp(Words[0], "sequence") == 0) {
+      if (Count < 2 || !AnimName(Parse, Words[1], FALSE, Line, &Id)) {
+         return FALSE;
+      }
+      Sequence = &Anims->Sequences[Id];
+      AnimDrop(Anims, Id);
+      Sequence->Flags = 0;
+      for (UINTN i = 2; i < Count; i++) {
+         if (AsciiStrCmp(Words[i], "hold") == 0) {
+            Sequence->Flags |= NEKO_ANIM_FLAG_NO_INTERRUPT;
+         } else if (AsciiStrCmp(Words[i], "still") == 0) {
+            Sequence->Flags |= NEKO_ANIM_FLAG_STILL;
+         } else {
+            return FALSE;
+         }
+      }
+      Parse->Current = Id;
+      Parse->Loop = FALSE;
+      return TRUE;
+   }
+
+   if (AsciiStrCmp(Words[0], "frame") == 0) {
+      NEKO_ANIM_FRAME Frame;
+
+      ZeroMem(&Frame, sizeof(Frame));
+      if (Sequence == NULL || Count != 4 ||
+          !AnimNumber(Words[1], MAX_UINT8, &N[0]) ||
+          !AnimNumber(Words[2], MAX_UINT8, &N[1]) ||
+          !AnimNumber(Words[3], MAX_UINT8, &N[2]) || N[2] == 0 ||
+          N[0] * (Parse->GridWidth + Parse->GridGap) > MAX_UINT16 ||
+          N[1] * (Parse->GridHeight + Parse->GridGap) > MAX_UINT16 ||
+          Anims->FrameCount == NEKO_ANIM_FRAMES ||
+          Sequence->Count == MAX_UINT8) {
+         return FALSE;
+      }
+      Frame.SrcX = (UINT16)(N[0] * (Parse->GridWidth + Parse->GridGap));
+      Frame.SrcY = (UINT16)(N[1] * (Parse->GridHeight + Parse->GridGap));
+      Frame.Width = (UINT16)Parse->GridWidth;
+      Frame.Height = (UINT16)Parse->GridHeight;
+      Frame.Duration = (UINT8)N[2];
+      if (Parse->Loop) {
+         Frame.Flags |= NEKO_FRAME_FLAG_LOOP_BEGIN;
+         Parse->Loop = FALSE;
+      }
+      Anims->Frames[Anims->FrameCount++] = Frame;
+      Sequence->Count++;
+      return TRUE;
+   }
+
+   if (AsciiStrCmp(Words[0], "rect") == 0) {
+      if (Last == NULL || Count != 5 ||
+          !AnimNumber(Words[1], MAX_UINT16, &N[0]) ||
+          !AnimNumber(Words[2], MAX_UINT16, &N[1]) ||
+          !AnimNumber(Words[3], NEKO_ANIM_MAX_SIZE, &N[2]) ||
+          !AnimNumber(Words[4], NEKO_ANIM_MAX_SIZE, &N[3]) ||
+          N[2] == 0 || N[3] == 0) {
+         return FALSE;
+      }
+      Last->SrcX = (UINT16)N[0];
+      Last->SrcY = (UINT16)N[1];
+      Last->Width = (UINT16)N[2];
+      Last->Height = (UINT16)N[3];
+      return TRUE;
+   }
+
+   if (AsciiStrCmp(Words[0], "anchor") == 0) {
+      return Last != NULL && Count == 3 &&
+             AnimSigned(Words[1], NEKO_ANIM_MAX_SIZE, &Last->AnchorX) &&
+             AnimSigned(Words[2], NEKO_ANIM_MAX_SIZE, &Last->AnchorY);
+   }
+
+   if (AsciiStrCmp(Words[0], "loop") == 0) {
+      if (Sequence == NULL || Count != 1) {
+         return FALSE;
+      }
+      Parse->Loop = TRUE;
+      return TRUE;
+   }
+
+   if (AsciiStrCmp(Words[0], "repeat") == 0) {
+      if (Last == NULL || Count != 2 ||
+          !AnimNumber(Words[1], MAX_UINT8, &N[0])) {
+         return FALSE;
+      }
+      Last->Flags |= NEKO_FRAME_FLAG_LOOP_END;
+      Last->Repeat = (UINT8)N[0];
+      return TRUE;
+   }
+
+   if (AsciiStrCmp(Words[0], "via") == 0) {
+      NEKO_ANIM_VIA *Via = &Parse->Via[Parse->ViaCount];
+
+      if (Count != 4 || Parse->ViaCount == NEKO_ANIM_VIAS ||
+          !AnimName(Parse, Words[1], TRUE, Line, &Via->From) ||
+          !AnimName(Parse, Words[2], TRUE, Line, &Via->To) ||
+          !AnimName(Parse, Words[3], TRUE, Line, &Via->Through)) {
+         return FALSE;
+      }
+      Parse->ViaCount++;
+      return TRUE;
+   }
+
+   return FALSE;
+}
+
+// runs every line of Text through AnimLine. on an error *Line is the
+// line at fault, counted from 1.
+static EFI_STATUS EFIAPI
+AnimParse(NEKO_ANIM_PARSE *Parse, CONST CHAR8 *Text, UINTN Size,
+          UINTN *Line) {
+   CHAR8 Buffer[NEKO_ANIM_LINE + 1];
+   CHAR8 *Words[NEKO_ANIM_WORDS];
+   UINTN Pos = 0;
+
+   for (*Line = 1; Pos < Size; (*Line)++) {
+      UINTN Length = 0;
+
+      for (; Pos < Size && Text[Pos] != '\n'; Pos++) {
+         if (Length == NEKO_ANIM_LINE) {
+            return EFI_INVALID_PARAMETER;
+         }
+         Buffer[Length++] = Text[Pos];
+      }
+      Pos++;
+      Buffer[Length] = '\0';
+
+      UINTN Count = 0;
+      CHAR8 *Char = Buffer;
+      while (*Char != '\0' && *Char != '#') {
+         if (*Char == ' ' || *Char == '\t' || *Char == '\r') {
+            *Char++ = '\0';
+            continue;
+         }
+         if (Count == NEKO_ANIM_WORDS) {
+            return EFI_INVALID_PARAMETER;
+         }
+         Words[Count++] = Char;
+         while (*Char != '\0' && *Char != '#' && *Char != ' ' &&
+                *Char != '\t' && *Char != '\r') {
+            Char++;
+         }
+      }
+      *Char = '\0';
+
+      if (Count > 0 && !AnimLine(Parse, Words, Count, *Line)) {
+         return EFI_INVALID_PARAMETER;
+      }
+   }
+
+   return EFI_SUCCESS;
+}
+
+// the box all frames cover once lined up by their anchors, and a sprite
+// for every frame, shared by those alike
+static EFI_STATUS EFIAPI
+AnimSprites(NEKO_ANIMS *Anims) {
+   INTN X0 = MAX_INTN;
+   INTN Y0 = MAX_INTN;
+   INTN X1 = MIN_INTN;
+   INTN Y1 = MIN_INTN;
+
+   for (UINTN i = 0; i < Anims->FrameCount; i++) {
+      NEKO_ANIM_FRAME *Frame = &Anims->Frames[i];
+
+      X0 = MIN(X0, -Frame->AnchorX);
+      Y0 = MIN(Y0, -Frame->AnchorY);
+      X1 = MAX(X1, Frame->Width - Frame->AnchorX);
+      Y1 = MAX(Y1, Frame->Height - Frame->AnchorY);
+   }
+   Anims->BoxWidth = X1 - X0;
+   Anims->BoxHeight = Y1 - Y0;
+
+   for (UINTN i = 0; i < Anims->FrameCount; i++) {
+      NEKO_ANIM_FRAME *Frame = &Anims->Frames[i];
+      NEKO_ANIM_SPRITE Sprite = {
+         .SrcX = Frame->SrcX,
+         .SrcY = Frame->SrcY,
+         .Width = Frame->Width,
+         .Height = Frame->Height,
+         .OffX = (UINT16)(-Frame->AnchorX - X0),
+         .OffY = (UINT16)(-Frame->AnchorY - Y0),
+      };
+      UINTN Cell = 0;
+
+      while (Cell < Anims->SpriteCount &&
+             CompareMem(&Anims->Sprites[Cell], &Sprite, sizeof(Sprite))) {
+         Cell++;
+      }
+      if (Cell == Anims->SpriteCount) {
+         if (Cell == NEKO_ANIM_NO_CELL) {
+            return EFI_OUT_OF_RESOURCES;
+         }
+         Anims->Sprites[Anims->SpriteCount++] = Sprite;
+      }
+      Frame->Cell = (UINT8)Cell;
+   }
+
+   return EFI_SUCCESS;
+}
+
+// works out each frame's successor and loop start, the switch table and
+// the sprites
+static EFI_STATUS EFIAPI
+AnimLink(NEKO_ANIM_PARSE *Parse, UINTN *Line) {
+   NEKO_ANIMS *Anims = Parse->Anims;
+
+   for (UINTN s = 0; s < Anims->SequenceCount; s++) {
+      NEKO_ANIM_SEQUENCE *Sequence = &Anims->Sequences[s];
+      NEKO_ANIM_FRAME *Frames = &Anims->Frames[Sequence->First];
+      UINT8 Back = 0;
+
+      if (Sequence->Count == 0) {
+         *Line = Parse->Named[s];
+         return EFI_INVALID_PARAMETER;
+      }
+      for (UINT8 k = 0; k < Sequence->Count; k++) {
+         if (Frames[k].Flags & NEKO_FRAME_FLAG_LOOP_BEGIN) {
+            Back = k;
+         }
+         Frames[k].Back = Back;
+         Frames[k].Next = (UINT8)((k + 1) % Sequence->Count);
+      }
+
+      for (UINTN t = 0; t < NEKO_ANIM_SEQUENCES; t++) {
+         Anims->Switch[s][t] = (UINT8)t;
+      }
+   }
+
+   // in order, so a later via wins. a sequence never switches to itself.
+   for (UINTN v = 0; v < Parse->ViaCount; v++) {
+      NEKO_ANIM_VIA *Via = &Parse->Via[v];
+
+      for (UINTN f = 0; f < Anims->SequenceCount; f++) {
+         for (UINTN t = 0; t < Anims->SequenceCount; t++) {
+            if (f == t ||
+                (Via->From != NEKO_ANIM_ANY && Via->From != f) ||
+                (Via->To != NEKO_ANIM_ANY && Via->To != t)) {
+               continue;
+            }
+            Anims->Switch[f][t] = Via->Through == NEKO_ANIM_ANY
+                                ? (UINT8)t : Via->Through;
+         }
+      }
+   }
+
+   *Line = 0;
+   return AnimSprites(Anims);
+}
+
+// the built-in animations with a manifest's on top, Text NULL for none.
+// on an error *Line is the manifest's line at fault.
+EFI_STATUS EFIAPI
+AnimCompile(NEKO_ANIMS *Anims, CONST CHAR8 *Text, UINTN Size, UINTN *Line) {
+   NEKO_ANIM_PARSE Parse;
+   EFI_STATUS Status;
+   UINT8 Id;
+
+   ZeroMem(Anims, sizeof(NEKO_ANIMS));
+   ZeroMem(&Parse, sizeof(Parse));
+   Parse.Anims = Anims;
+   Parse.Current = NEKO_ANIM_NONE;
+   Parse.GridWidth = NEKO_ANIM_GRID;
+   Parse.GridHeight = NEKO_ANIM_GRID;
+   Parse.GridGap = NEKO_ANIM_GAP;
+
+   for (UINTN i = 0; i < NEKO_ANIM_KINDS; i++) {
+      AnimName(&Parse, mAnimKinds[i], FALSE, 0, &Id);
+   }
+
+   Status = AnimParse(&Parse, mAnimBuiltin, sizeof(mAnimBuiltin) - 1, Line);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   *Line = 0;
+   if (Text != NULL) {
+      Parse.Current = NEKO_ANIM_NONE;
+      Parse.Loop = FALSE;
+      Status = AnimParse(&Parse, Text, Size, Line);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+   }
+
+   return AnimLink(&Parse, Line);
+}
+
+// what a sheet without a manifest plays
+CONST NEKO_ANIMS* EFIAPI
+AnimBuiltin(VOID) {
+   UINTN Line;
+
+   if (!mAnimBuiltinReady) {
+      AnimCompile(&mAnimBuiltinSet, NULL, 0, &Line);
+      mAnimBuiltinReady = TRUE;
+   }
+   return &mAnimBuiltinSet;
+}
+
+CONST NEKO_ANIM_FRAME* EFIAPI
+AnimFrame(CONST NEKO_ANIMS *Anims, CONST NEKO_ANIM_STATE *State) {
+   return &Anims->Frames[Anims->Sequences[State->Sequence].First +
+                         State->Frame];
+}
+
+VOID EFIAPI
+AnimStart(CONST NEKO_ANIMS *Anims, NEKO_ANIM_STATE *State, UINT8 Sequence,
+          UINT8 Frame) {
+   State->Sequence = Sequence;
+   State->Frame = MIN(Frame, Anims->Sequences[Sequence].Count - 1);
+   State->Elapsed = 0;
+   State->Loop = 0;
+}
+
+// one tick of a cat that wants Wanted: a held sequence switches only as
+// its last frame runs out, any other at once, by way of what the vias
+// say. then the frame it is on is shown a tick longer.
+VOID EFIAPI
+AnimTick(CONST NEKO_ANIMS *Anims, NEKO_ANIM_STATE *State, UINT8 Wanted) {
+   CONST NEKO_ANIM_SEQUENCE *Sequence = &Anims->Sequences[State->Sequence];
+   CONST NEKO_ANIM_FRAME *Frame = AnimFrame(Anims, State);
+   UINT8 Next = Anims->Switch[State->Sequence][Wanted];
+
+   if (Next != State->Sequence &&
+       (!(Sequence->Flags & NEKO_ANIM_FLAG_NO_INTERRUPT) ||
+        (State->Frame == Sequence->Count - 1 &&
+         State->Elapsed == Frame->Duration - 1))) {
+      AnimStart(Anims, State, Next, 0);
+      Frame = AnimFrame(Anims, State);
+   }
+
+   if (++State->Elapsed < Frame->Duration) {
+      return;
+   }
+   State->Elapsed = 0;
+   if (Frame->Flags & NEKO_FRAME_FLAG_LOOP_END) {
+      if (Frame->Repeat == 0 || State->Loop < Frame->Repeat - 1) {
+         State->Frame = Frame->Back;
+         State->Loop++;
+         return;
+      }
+      State->Loop = 0;
+   }
+   State->Frame = Frame->Next;
+}
+
+// TRUE if, wanting Wanted, a cat would only count its frame out: it
+// already plays it, or plays a held sequence, or has no way to it.
+BOOLEAN EFIAPI
+AnimSettled(CONST NEKO_ANIMS *Anims, CONST NEKO_ANIM_STATE *State,
+            UINT8 Wanted) {
+   return Anims->Switch[State->Sequence][Wanted] == State->Sequence ||
+          (Anims->Sequences[State->Sequence].Flags &
+           NEKO_ANIM_FLAG_NO_INTERRUPT);
+}
+
+// TRUE if a cat's NEKO_ANIM_STATE in one means the same in the other,
+// whatever the frames look like
+BOOLEAN EFIAPI
+AnimSameShape(CONST NEKO_ANIMS *A, CONST NEKO_ANIMS *B) {
+   return A->SequenceCount == B->SequenceCount &&
+          CompareMem(A->Sequences, B->Sequences,
+                     A->SequenceCount * sizeof(NEKO_ANIM_SEQUENCE)) == 0;
+}
@@ -1,29 +1,56 @@
 #ifndef __EFI_NEKO_ANIM_H__
 #define __EFI_NEKO_ANIM_H__
 
-#define FRAME_COUNT(anim) (sizeof(anim) / sizeof((anim)[0]))
+// animations come as a manifest, a text file next to the sprite sheet:
+// foo.anim for foo.png. the built-in one is in Anim.c, and a sheet's own
+// is read on top of it, so it only has to say what it changes.
+//
+//    # a comment
+//    grid W H [GAP]
+//    sequence NAME [hold] [still]
+//    frame X Y TICKS
+//    rect X Y W H
+//    anchor X Y
+//    loop
+//    repeat N
+//    via FROM TO THROUGH
+//
+// a sequence is its frames in order. a frame's X and Y count cells of the
+// sheet's grid, W by H px with GAP px in between, NEKO_ANIM_GRID square
+// and NEKO_ANIM_GAP apart unless a grid line says otherwise. "rect" after
+// a frame takes it from anywhere on the sheet instead, in px, and
+// "anchor" gives the point of it, from its corner, that stays put from
+// one frame to the next, 0 0 unless said. the cat takes up the box all
+// its frames cover, lined up by their anchors. "loop" starts a loop at
+// the frame after it, and "repeat N" after a frame ends that loop there,
+// N passes in all and 0 for ever. a held sequence plays out before
+// anything else may start, and a still one keeps the cat where it is.
+// "via" puts THROUGH in between when the cat wants TO while playing FROM;
+// * for FROM or TO means any, and for THROUGH straight to TO. THROUGH had
+// better be held, or it only lasts a tick. a NAME other than the ones the
+// cat wants below is a sequence of its own, for use with "via".
+//
+// the manifest is compiled into flat tables: where each frame goes next
+// and where its loop starts are worked out once, so a tick looks nothing
+// up. frames that show the same rect at the same place in the box share
+// a sprite, their Cell.
+#define NEKO_ANIM_SEQUENCES 32
+#define NEKO_ANIM_FRAMES 256
+#define NEKO_ANIM_NAME 16
+#define NEKO_ANIM_LINE 80
+#define NEKO_ANIM_CELLS 256
+#define NEKO_ANIM_NO_CELL 0xFF   // never a frame's, so the herd's for none
+#define NEKO_ANIM_GRID 32        // the original sheet's
+#define NEKO_ANIM_GAP 1
+#define NEKO_ANIM_MAX_SIZE 256   // px, of a frame's side and its anchor
 
 #define NEKO_FRAME_FLAG_LOOP_BEGIN  0x01
 #define NEKO_FRAME_FLAG_LOOP_END    0x02
 
 #define NEKO_ANIM_FLAG_NO_INTERRUPT 0x01
+#define NEKO_ANIM_FLAG_STILL        0x02
 
-// a frame marked with NEKO_FRAME_FLAG_LOOP_BEGIN must specify a number of
-// loop iterations. 0 loop iterations translates to an infinite loop.
-typedef struct {
-   UINT8 SpriteSheetX;     // horizontal position in the spritesheet
-   UINT8 SpriteSheetY;     // vertical position in the spritesheet
-   UINT8 Duration;         // number of ticks for this frame
-   UINT8 Flags;            // frame flags
-   UINT8 LoopIterations;   // number of loop iterations if loop is specified
-} AnimationFrame;
-
-typedef struct {
-   AnimationFrame *Frames;
-   UINT8 FrameCount;
-   UINT8 Flags;
-} AnimationSequence;
-
+// what the cat wants to do, the first sequences of every set
 typedef enum {
    NEKO_ANIM_IDLE,
    NEKO_ANIM_STARTLED,
@@ -39,153 +66,86 @@ typedef enum {
    NEKO_ANIM_SCRATCH_RIGHT,
    NEKO_ANIM_SCRATCH_DOWN,
    NEKO_ANIM_SCRATCH_LEFT,
+   NEKO_ANIM_KINDS
 } NekoAnimationType;
 
-static AnimationFrame IdleFrames[] = {
-   { 0, 0, 12, 0, 0 },                          // Idle
-   { 1, 0, 4, 0, 0 },                           // Scratch 1
-   { 2, 0, 4, NEKO_FRAME_FLAG_LOOP_BEGIN, 2 },  // Scratch 2
-   { 3, 0, 4, NEKO_FRAME_FLAG_LOOP_END, 2 },    // Scratch 3
-   { 4, 0, 12, 0, 0 },                          // Yawn
-   { 5, 0, 8, NEKO_FRAME_FLAG_LOOP_BEGIN, 0 },  // Sleep 1
-   { 6, 0, 8, NEKO_FRAME_FLAG_LOOP_END, 0 }     // Sleep 2
-};
-
-static AnimationFrame StartledFrames[] = {
-   { 7, 0, 8, 0, 0 }                            // Startled
-};
-
-static AnimationFrame RunUpFrames[] = {
-   { 0, 2, 5, 0, 0 },                           // RunUp 1
-   { 1, 2, 5, 0, 0 }                            // RunUp 2
-};
-
-static AnimationFrame RunUpRightFrames[] = {
-   { 6, 1, 5, 0, 0 },                           // RunUpRight 1
-   { 7, 1, 5, 0, 0 }                            // RunUpRight 2
-};
-
-static AnimationFrame RunRightFrames[] = {
-   { 4, 1, 5, 0, 0 },                           // RunRight 1
-   { 5, 1, 5, 0, 0 }                            // RunRight 2
-};
-
-static AnimationFrame RunDownRightFrames[] = {
-   { 2, 1, 5, 0, 0 },                           // RunDownRight 1
-   { 3, 1, 5, 0, 0 }                            // RunDownRight 2
-};
-
-static AnimationFrame RunDownFrames[] = {
-   { 0, 1, 5, 0, 0 },                           // RunDown 1
-   { 1, 1, 5, 0, 0 }                            // RunDown 2
-};
-
-static AnimationFrame RunDownLeftFrames[] = {
-   { 6, 2, 5, 0, 0 },                           // RunDownLeft 1
-   { 7, 2, 5, 0, 0 }                            // RunDownLeft 2
-};
-
-static AnimationFrame RunLeftFrames[] = {
-   { 4, 2, 5, 0, 0 },                           // RunLeft 1
-   { 5, 2, 5, 0, 0 }                            // RunLeft 2
-};
-
-static AnimationFrame RunUpLeftFrames[] = {
-   { 2, 2, 5, 0, 0 },                           // RunUpLeft 1
-   { 3, 2, 5, 0, 0 }                            // RunUpLeft 2
-};
-
-static AnimationFrame ScratchLeftFrames[] = {
-   { 0, 3, 5, 0, 0 },                           // ScratchLeft 1
-   { 1, 3, 5, 0, 0 }                            // ScratchLeft 2
-};
-
-static AnimationFrame ScratchUpFrames[] = {
-   { 4, 3, 5, 0, 0 },                           // ScratchUp 1
-   { 5, 3, 5, 0, 0 }                            // ScratchUp 2
-};
-
-static AnimationFrame ScratchRightFrames[] = {
-   { 2, 3, 5, 0, 0 },                           // ScratchRight 1
-   { 3, 3, 5, 0, 0 }                            // ScratchRight 2
-};
-
-static AnimationFrame ScratchDownFrames[] = {
-   { 6, 3, 5, 0, 0 },                           // ScratchDown 1
-   { 7, 3, 5, 0, 0 }                            // ScratchDown 2
-};
-
-static const AnimationSequence AnimationSequences[] = {
-   [NEKO_ANIM_IDLE] = {
-      .Frames = IdleFrames,
-      .FrameCount = FRAME_COUNT(IdleFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_STARTLED] = {
-      .Frames = StartledFrames,
-      .FrameCount = FRAME_COUNT(StartledFrames),
-      .Flags = NEKO_ANIM_FLAG_NO_INTERRUPT
-   },
-   [NEKO_ANIM_RUN_UP] = {
-      .Frames = RunUpFrames,
-      .FrameCount = FRAME_COUNT(RunUpFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_RUN_UP_RIGHT] = {
-      .Frames = RunUpRightFrames,
-      .FrameCount = FRAME_COUNT(RunUpRightFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_RUN_RIGHT] = {
-      .Frames = RunRightFrames,
-      .FrameCount = FRAME_COUNT(RunRightFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_RUN_DOWN_RIGHT] = {
-      .Frames = RunDownRightFrames,
-      .FrameCount = FRAME_COUNT(RunDownRightFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_RUN_DOWN] = {
-      .Frames = RunDownFrames,
-      .FrameCount = FRAME_COUNT(RunDownFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_RUN_DOWN_LEFT] = {
-      .Frames = RunDownLeftFrames,
-      .FrameCount = FRAME_COUNT(RunDownLeftFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_RUN_LEFT] = {
-      .Frames = RunLeftFrames,
-      .FrameCount = FRAME_COUNT(RunLeftFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_RUN_UP_LEFT] = {
-      .Frames = RunUpLeftFrames,
-      .FrameCount = FRAME_COUNT(RunUpLeftFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_SCRATCH_UP] = {
-      .Frames = ScratchUpFrames,
-      .FrameCount = FRAME_COUNT(ScratchUpFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_SCRATCH_RIGHT] = {
-      .Frames = ScratchRightFrames,
-      .FrameCount = FRAME_COUNT(ScratchRightFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_SCRATCH_DOWN] = {
-      .Frames = ScratchDownFrames,
-      .FrameCount = FRAME_COUNT(ScratchDownFrames),
-      .Flags = 0
-   },
-   [NEKO_ANIM_SCRATCH_LEFT] = {
-      .Frames = ScratchLeftFrames,
-      .FrameCount = FRAME_COUNT(ScratchLeftFrames),
-      .Flags = 0
-   }
-};
+// a frame's rect and anchor are as the manifest gave them; what is drawn
+// is its Cell's sprite
+typedef struct {
+   UINT16 SrcX;            // px, on the sheet
+   UINT16 SrcY;
+   UINT16 Width;
+   UINT16 Height;
+   INT16 AnchorX;
+   INT16 AnchorY;
+   UINT8 Cell;
+   UINT8 Duration;         // in ticks
+   UINT8 Flags;
+   UINT8 Repeat;           // passes of the loop a LOOP_END frame closes
+   UINT8 Next;             // the frame after this one, in its sequence
+   UINT8 Back;             // where the loop a LOOP_END frame closes starts
+} NEKO_ANIM_FRAME;
+
+// a rect of the skin's image, the sheet until an atlas takes its place,
+// and where in the box it goes
+typedef struct {
+   UINT16 SrcX;
+   UINT16 SrcY;
+   UINT16 Width;
+   UINT16 Height;
+   UINT16 OffX;
+   UINT16 OffY;
+} NEKO_ANIM_SPRITE;
+
+typedef struct {
+   UINT16 First;           // in Frames
+   UINT8 Count;
+   UINT8 Flags;
+} NEKO_ANIM_SEQUENCE;
+
+typedef struct {
+   NEKO_ANIM_FRAME Frames[NEKO_ANIM_FRAMES];
+   UINTN FrameCount;
+   NEKO_ANIM_SEQUENCE Sequences[NEKO_ANIM_SEQUENCES];
+   CHAR8 Names[NEKO_ANIM_SEQUENCES][NEKO_ANIM_NAME];
+   UINTN SequenceCount;
+   // the sequence to start on wanting the second while playing the first
+   UINT8 Switch[NEKO_ANIM_SEQUENCES][NEKO_ANIM_SEQUENCES];
+   NEKO_ANIM_SPRITE Sprites[NEKO_ANIM_CELLS - 1];
+   UINTN SpriteCount;
+   UINTN BoxWidth;
+   UINTN BoxHeight;
+} NEKO_ANIMS;
+
+// where a cat is in its animation. all zeroes is the first idle frame.
+typedef struct {
+   UINT8 Sequence;
+   UINT8 Frame;            // within the sequence
+   UINT8 Elapsed;          // ticks of it shown so far
+   UINT8 Loop;             // passes of the current loop so far
+} NEKO_ANIM_STATE;
+
+EFI_STATUS EFIAPI
+AnimCompile(NEKO_ANIMS *Anims, CONST CHAR8 *Text, UINTN Size, UINTN *Line);
+
+CONST NEKO_ANIMS* EFIAPI
+AnimBuiltin(VOID);
+
+VOID EFIAPI
+AnimStart(CONST NEKO_ANIMS *Anims, NEKO_ANIM_STATE *State, UINT8 Sequence,
+          UINT8 Frame);
+
+VOID EFIAPI
+AnimTick(CONST NEKO_ANIMS *Anims, NEKO_ANIM_STATE *State, UINT8 Wanted);
+
+BOOLEAN EFIAPI
+AnimSettled(CONST NEKO_ANIMS *Anims, CONST NEKO_ANIM_STATE *State,
+            UINT8 Wanted);
+
+CONST NEKO_ANIM_FRAME* EFIAPI
+AnimFrame(CONST NEKO_ANIMS *Anims, CONST NEKO_ANIM_STATE *State);
+
+BOOLEAN EFIAPI
+AnimSameShape(CONST NEKO_ANIMS *A, CONST NEKO_ANIMS *B);
 
 #endif // __EFI_NEKO_ANIM_H__
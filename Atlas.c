@@ -0,0 +1,193 @@
+#include <Uefi.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+
+#include "Atlas.h"
+#include "Util.h"
+
+// the sheet is RGBA, 4 bytes a pixel
+#define ATLAS_PX 4
+
+// FNV-1a over a sprite's pixels
+static UINT32 EFIAPI
+AtlasHash(CONST UINT8 *Sheet, UINTN Width, CONST NEKO_ANIM_SPRITE *Sprite) {
+   UINT32 Hash = 2166136261u;
+
+   for (UINTN y = 0; y < Sprite->Height; y++) {
+      CONST UINT8 *Row = &Sheet[((Sprite->SrcY + y) * Width + Sprite->SrcX)
+                                * ATLAS_PX];
+
+      for (UINTN x = 0; x < Sprite->Width * ATLAS_PX; x++) {
+         Hash = (Hash ^ Row[x]) * 16777619u;
+      }
+   }
+   return Hash;
+}
+
+static BOOLEAN EFIAPI
+AtlasSame(CONST UINT8 *Sheet, UINTN Width, CONST NEKO_ANIM_SPRITE *A,
+          CONST NEKO_ANIM_SPRITE *B) {
+   if (A->Width != B->Width || A->Height != B->Height) {
+      return FALSE;
+   }
+   for (UINTN y = 0; y < A->Height; y++) {
+      if (CompareMem(&Sheet[((A->SrcY + y) * Width + A->SrcX) * ATLAS_PX],
+                     &Sheet[((B->SrcY + y) * Width + B->SrcX) * ATLAS_PX],
+                     A->Width * ATLAS_PX) != 0) {
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+// lays out the pixels of Anims' sprites, as found on Sheet, in a new
+// image and points the sprites at it. they go in rows, tallest first,
+// each row as wide as the square root of their area allows. the image is
+// left blank for AtlasFill, which reads Sheet until it is done.
+EFI_STATUS EFIAPI
+AtlasBuild(NEKO_ATLAS *Atlas, NEKO_ANIMS *Anims, CONST UINT8 *Sheet,
+           UINTN Width, UINTN Height, EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter) {
+   UINT32 Hash[NEKO_ANIM_CELLS];
+   UINT8 Order[NEKO_ANIM_CELLS];   // those with pixels of their own
+   UINT16 X[NEKO_ANIM_CELLS];      // where those go in the atlas
+   UINT16 Y[NEKO_ANIM_CELLS];
+   UINTN Area = 0;
+   UINTN Widest = 0;
+
+   ZeroMem(Atlas, sizeof(NEKO_ATLAS));
+   NEKO_ATLAS_FILL *Fill = AllocateZeroPool(sizeof(NEKO_ATLAS_FILL));
+   if (Fill == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   Fill->Sheet = Sheet;
+   Fill->SheetWidth = Width;
+   Fill->Filter = Filter;
+
+   for (UINTN s = 0; s < Anims->SpriteCount; s++) {
+      NEKO_ANIM_SPRITE *Sprite = &Anims->Sprites[s];
+
+      if (Sprite->SrcX + Sprite->Width > Width ||
+          Sprite->SrcY + Sprite->Height > Height) {
+         FreePool(Fill);
+         return EFI_INVALID_PARAMETER;
+      }
+
+      Hash[s] = AtlasHash(Sheet, Width, Sprite);
+      Fill->Copy[s] = (UINT8)s;
+      for (UINTN k = 0; k < Atlas->Kept; k++) {
+         UINT8 Kept = Order[k];
+
+         if (Hash[Kept] == Hash[s] &&
+             AtlasSame(Sheet, Width, &Anims->Sprites[Kept], Sprite)) {
+            Fill->Copy[s] = Kept;
+            Atlas->Merged++;
+            break;
+         }
+      }
+      if (Fill->Copy[s] != s) {
+         continue;
+      }
+
+      // by height, tallest first, in the order they came otherwise
+      UINTN k = Atlas->Kept++;
+      while (k > 0 && Anims->Sprites[Order[k - 1]].Height < Sprite->Height) {
+         Order[k] = Order[k - 1];
+         k--;
+      }
+      Order[k] = (UINT8)s;
+      Area += Sprite->Width * Sprite->Height;
+      Widest = MAX(Widest, Sprite->Width);
+   }
+
+   UINTN Limit = MAX(Widest, UtIntSqrt((UINT32)MIN(Area, MAX_UINT32)));
+   UINTN RowX = 0;
+   UINTN RowY = 0;
+   UINTN RowHeight = 0;
+   for (UINTN k = 0; k < Atlas->Kept; k++) {
+      NEKO_ANIM_SPRITE *Sprite = &Anims->Sprites[Order[k]];
+
+      if (RowX + Sprite->Width > Limit) {
+         RowY += RowHeight;
+         RowX = 0;
+         RowHeight = 0;
+      }
+      X[Order[k]] = (UINT16)RowX;
+      Y[Order[k]] = (UINT16)RowY;
+      RowX += Sprite->Width;
+      RowHeight = MAX(RowHeight, Sprite->Height);
+      Atlas->Width = MAX(Atlas->Width, RowX);
+   }
+   Atlas->Height = RowY + RowHeight;
+   if (Atlas->Width > MAX_UINT16 || Atlas->Height > MAX_UINT16) {
+      FreePool(Fill);
+      return EFI_UNSUPPORTED;
+   }
+
+   // what no sprite covers stays transparent, and so does a blank sprite
+   Atlas->Image = AllocateZeroPool(Atlas->Width * Atlas->Height *
+                                   sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   if (Atlas->Image == NULL) {
+      FreePool(Fill);
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   for (UINTN k = 0; k < Atlas->Kept; k++) {
+      UINT8 s = Order[k];
+
+      Fill->SheetX[s] = Anims->Sprites[s].SrcX;
+      Fill->SheetY[s] = Anims->Sprites[s].SrcY;
+   }
+   for (UINTN s = 0; s < Anims->SpriteCount; s++) {
+      Anims->Sprites[s].SrcX = X[Fill->Copy[s]];
+      Anims->Sprites[s].SrcY = Y[Fill->Copy[s]];
+   }
+   Atlas->Pending = Atlas->Kept;
+   Atlas->Fill = Fill;
+   if (Atlas->Pending == 0) {
+      FreePool(Fill);
+      Atlas->Fill = NULL;
+   }
+
+   return EFI_SUCCESS;
+}
+
+// converts the pixels Sprite shows from the sheet into the atlas, unless
+// they already are. FALSE if there was nothing to do. the last one lets go
+// of the sheet.
+BOOLEAN EFIAPI
+AtlasFill(NEKO_ATLAS *Atlas, CONST NEKO_ANIMS *Anims, UINTN Sprite) {
+   NEKO_ATLAS_FILL *Fill = Atlas->Fill;
+
+   if (Fill == NULL || Sprite >= Anims->SpriteCount ||
+       Fill->Filled[Fill->Copy[Sprite]]) {
+      return FALSE;
+   }
+
+   UINT8 s = Fill->Copy[Sprite];
+   CONST NEKO_ANIM_SPRITE *Kept = &Anims->Sprites[s];
+   for (UINTN y = 0; y < Kept->Height; y++) {
+      UtRgbaToBlt(&Atlas->Image[(Kept->SrcY + y) * Atlas->Width + Kept->SrcX],
+                  &Fill->Sheet[((Fill->SheetY[s] + y) * Fill->SheetWidth +
+                                Fill->SheetX[s]) * ATLAS_PX],
+                  Kept->Width, Fill->Filter);
+   }
+   Fill->Filled[s] = TRUE;
+
+   if (--Atlas->Pending == 0) {
+      FreePool(Fill);
+      Atlas->Fill = NULL;
+   }
+   return TRUE;
+}
+
+VOID EFIAPI
+AtlasFree(NEKO_ATLAS *Atlas) {
+   if (Atlas->Image != NULL) {
+      FreePool(Atlas->Image);
+   }
+   if (Atlas->Fill != NULL) {
+      FreePool(Atlas->Fill);
+   }
+   ZeroMem(Atlas, sizeof(NEKO_ATLAS));
+}
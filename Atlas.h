@@ -0,0 +1,46 @@
+#ifndef __NEKO_ATLAS_H__
+#define __NEKO_ATLAS_H__
+
+#include <Protocol/GraphicsOutput.h>
+
+#include "Anim.h"
+
+// what is left of packing an atlas while some of it is still blank: where
+// the pixels of each kept sprite are on the sheet, and which are in
+typedef struct {
+   CONST UINT8 *Sheet;     // RGBA, the caller's until the atlas is filled
+   UINTN SheetWidth;
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter; // sheet colour that is transparent
+   UINT8 Copy[NEKO_ANIM_CELLS];     // by sprite, the one whose pixels it shows
+   UINT16 SheetX[NEKO_ANIM_CELLS];  // by kept sprite
+   UINT16 SheetY[NEKO_ANIM_CELLS];
+   BOOLEAN Filled[NEKO_ANIM_CELLS];
+} NEKO_ATLAS_FILL;
+
+// a skin's sprites packed tight into an image of their own, to be drawn
+// from in place of the sheet they came from, which can then go. sprites
+// showing the same pixels keep a single copy of them, found by a hash.
+// what a skin takes then grows with the frames it has, not its canvas.
+// the atlas starts out blank and is filled in a sprite at a time, so the
+// one on screen can go first.
+typedef struct {
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Image;
+   UINTN Width;
+   UINTN Height;
+   UINTN Kept;             // sprites with pixels of their own
+   UINTN Merged;           // sprites sharing another's
+   UINTN Pending;          // of Kept, those still blank
+   NEKO_ATLAS_FILL *Fill;  // while any are
+} NEKO_ATLAS;
+
+EFI_STATUS EFIAPI
+AtlasBuild(NEKO_ATLAS *Atlas, NEKO_ANIMS *Anims, CONST UINT8 *Sheet,
+           UINTN Width, UINTN Height, EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter);
+
+BOOLEAN EFIAPI
+AtlasFill(NEKO_ATLAS *Atlas, CONST NEKO_ANIMS *Anims, UINTN Sprite);
+
+VOID EFIAPI
+AtlasFree(NEKO_ATLAS *Atlas);
+
+#endif // __NEKO_ATLAS_H__
@@ -0,0 +1,359 @@
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/UefiRuntimeServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+
+#include "Blit.h"
+#include "Clock.h"
+
+#define BLIT_PROBE_ROUNDS 32
+#define BLIT_PROFILE_NAME L"NekoBlitProfile"
+
+static EFI_GUID mNekoVariableGuid = {
+   0x88e95e84, 0xddae, 0x42d2,
+   { 0xad, 0x20, 0x4b, 0xfe, 0x84, 0xb3, 0x2e, 0x54 }
+};
+
+// stored in a non-volatile variable so later boots can skip the probe. the
+// mode fields invalidate the profile once the resolution or format changes.
+typedef struct {
+   UINT32 Mode;
+   UINT32 Width;
+   UINT32 Height;
+   UINT32 PixelFormat;
+   UINT32 BlitPath;
+   UINT32 FillPath;
+   UINT64 BlitRate;
+   UINT64 FillRate;
+} NEKO_BLIT_PROFILE;
+
+VOID EFIAPI
+BlitInit(NEKO_BLITTER *Blitter, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
+   EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = Gop->Mode->Info;
+
+   ZeroMem(Blitter, sizeof(NEKO_BLITTER));
+   Blitter->Gop = Gop;
+   Blitter->ScrX = Info->HorizontalResolution;
+   Blitter->ScrY = Info->VerticalResolution;
+   Blitter->BlitPath = NEKO_BLIT_ROWS;
+   Blitter->FillPath = NEKO_FILL_BLT;
+
+   if (Gop->Mode->FrameBufferBase != 0 &&
+       (Info->PixelFormat == PixelBlueGreenRedReserved8BitPerColor ||
+        Info->PixelFormat == PixelRedGreenBlueReserved8BitPerColor)) {
+      Blitter->FrameBuffer = (UINT32*)(UINTN)Gop->Mode->FrameBufferBase;
+      Blitter->PixelsPerScanLine = Info->PixelsPerScanLine;
+      Blitter->SwapRedBlue = 
+         Info->PixelFormat == PixelRedGreenBlueReserved8BitPerColor;
+   }
+}
+
+// clips a destination rectangle to the screen, adjusting the source origin
+// by the same amount. returns FALSE if nothing is left to draw.
+static BOOLEAN EFIAPI
+BlitClip(NEKO_BLITTER *Blitter,
+         INTN *DstX,
+         INTN *DstY,
+         UINTN *SrcX,
+         UINTN *SrcY,
+         UINTN *Width,
+         UINTN *Height) {
+   if (*DstX < 0) {
+      if ((UINTN)-*DstX >= *Width) {
+         return FALSE;
+      }
+      *SrcX += -*DstX;
+      *Width -= -*DstX;
+      *DstX = 0;
+   }
+   if (*DstY < 0) {
+      if ((UINTN)-*DstY >= *Height) {
+         return FALSE;
+      }
+      *SrcY += -*DstY;
+      *Height -= -*DstY;
+      *DstY = 0;
+   }
+   if ((UINTN)*DstX >= Blitter->ScrX || (UINTN)*DstY >= Blitter->ScrY) {
+      return FALSE;
+   }
+
+   *Width = MIN(*Width, Blitter->ScrX - *DstX);
+   *Height = MIN(*Height, Blitter->ScrY - *DstY);
+
+   return *Width > 0 && *Height > 0;
+}
+
+static UINT32 EFIAPI
+BlitToFramebuffer(NEKO_BLITTER *Blitter, EFI_GRAPHICS_OUTPUT_BLT_PIXEL Pixel) {
+   if (Blitter->SwapRedBlue) {
+      UINT8 Tmp = Pixel.Red;
+      Pixel.Red = Pixel.Blue;
+      Pixel.Blue = Tmp;
+   }
+   return *(UINT32*)&Pixel;
+}
+
+VOID EFIAPI
+BlitDraw(NEKO_BLITTER *Blitter,
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+         UINTN SrcWidth,
+         UINTN SrcX,
+         UINTN SrcY,
+         INTN DstX,
+         INTN DstY,
+         UINTN Width,
+         UINTN Height) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Blitter->Gop;
+
+   if (!BlitClip(Blitter, &DstX, &DstY, &SrcX, &SrcY, &Width, &Height)) {
+      return;
+   }
+
+   switch (Blitter->BlitPath) {
+   case NEKO_BLIT_ROWS:
+      for (UINTN y = 0; y < Height; y++) {
+         Gop->Blt(Gop, &Src[(SrcY + y) * SrcWidth + SrcX],
+                  EfiBltBufferToVideo, 0, 0, DstX, DstY + y, Width, 1, 0);
+      }
+      break;
+   case NEKO_BLIT_RECT:
+      Gop->Blt(Gop, Src, EfiBltBufferToVideo, SrcX, SrcY, DstX, DstY,
+               Width, Height,
+               SrcWidth * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+      break;
+   case NEKO_BLIT_FRAMEBUFFER:
+      for (UINTN y = 0; y < Height; y++) {
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = 
+            &Src[(SrcY + y) * SrcWidth + SrcX];
+         UINT32 *Dst = &Blitter->FrameBuffer[
+            (DstY + y) * Blitter->PixelsPerScanLine + DstX];
+
+         if (!Blitter->SwapRedBlue) {
+            CopyMem(Dst, Row, Width * sizeof(UINT32));
+            continue;
+         }
+         for (UINTN x = 0; x < Width; x++) {
+            Dst[x] = BlitToFramebuffer(Blitter, Row[x]);
+         }
+      }
+      break;
+   default:
+      break;
+   }
+}
+
+VOID EFIAPI
+BlitFill(NEKO_BLITTER *Blitter,
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL Color,
+         INTN DstX,
+         INTN DstY,
+         UINTN Width,
+         UINTN Height) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Blitter->Gop;
+   UINTN SrcX = 0;
+   UINTN SrcY = 0;
+
+   if (!BlitClip(Blitter, &DstX, &DstY, &SrcX, &SrcY, &Width, &Height)) {
+      return;
+   }
+
+   switch (Blitter->FillPath) {
+   case NEKO_FILL_BLT:
+      Gop->Blt(Gop, &Color, EfiBltVideoFill, 0, 0, DstX, DstY,
+               Width, Height, 0);
+      break;
+   case NEKO_FILL_FRAMEBUFFER: {
+      UINT32 Value = BlitToFramebuffer(Blitter, Color);
+      for (UINTN y = 0; y < Height; y++) {
+         SetMem32(&Blitter->FrameBuffer[
+                     (DstY + y) * Blitter->PixelsPerScanLine + DstX],
+                  Width * sizeof(UINT32), Value);
+      }
+      break;
+   }
+   default:
+      break;
+   }
+}
+
+static UINT64 EFIAPI
+BlitRate(UINTN Pixels, UINT64 Start) {
+   UINT64 Us = ClkTicksToUs(ClkTicks() - Start);
+   return DivU64x64Remainder(MultU64x32(Pixels, 1000), MAX(Us, 1), NULL);
+}
+
+static BOOLEAN EFIAPI
+BlitLoadProfile(NEKO_BLITTER *Blitter) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL_MODE *Mode = Blitter->Gop->Mode;
+   NEKO_BLIT_PROFILE Profile;
+   UINTN Size = sizeof(Profile);
+
+   if (EFI_ERROR(gRT->GetVariable(BLIT_PROFILE_NAME, &mNekoVariableGuid,
+                                  NULL, &Size, &Profile)) ||
+       Size != sizeof(Profile)) {
+      return FALSE;
+   }
+
+   if (Profile.Mode != Mode->Mode ||
+       Profile.Width != Mode->Info->HorizontalResolution ||
+       Profile.Height != Mode->Info->VerticalResolution ||
+       Profile.PixelFormat != (UINT32)Mode->Info->PixelFormat ||
+       Profile.BlitPath >= NEKO_BLIT_PATH_COUNT ||
+       Profile.FillPath >= NEKO_FILL_PATH_COUNT) {
+      return FALSE;
+   }
+
+   if (Blitter->FrameBuffer == NULL &&
+       (Profile.BlitPath == NEKO_BLIT_FRAMEBUFFER ||
+        Profile.FillPath == NEKO_FILL_FRAMEBUFFER)) {
+      return FALSE;
+   }
+
+   Blitter->BlitPath = (NEKO_BLIT_PATH)Profile.BlitPath;
+   Blitter->FillPath = (NEKO_FILL_PATH)Profile.FillPath;
+   Blitter->BlitRate = Profile.BlitRate;
+   Blitter->FillRate = Profile.FillRate;
+   Blitter->Probed = FALSE;
+
+   return TRUE;
+}
+
+static VOID EFIAPI
+BlitSaveProfile(NEKO_BLITTER *Blitter) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL_MODE *Mode = Blitter->Gop->Mode;
+   NEKO_BLIT_PROFILE Profile;
+
+   Profile.Mode = Mode->Mode;
+   Profile.Width = Mode->Info->HorizontalResolution;
+   Profile.Height = Mode->Info->VerticalResolution;
+   Profile.PixelFormat = (UINT32)Mode->Info->PixelFormat;
+   Profile.BlitPath = Blitter->BlitPath;
+   Profile.FillPath = Blitter->FillPath;
+   Profile.BlitRate = Blitter->BlitRate;
+   Profile.FillRate = Blitter->FillRate;
+
+   gRT->SetVariable(BLIT_PROFILE_NAME, &mNekoVariableGuid,
+                    EFI_VARIABLE_NON_VOLATILE | 
+                    EFI_VARIABLE_BOOTSERVICE_ACCESS,
+                    sizeof(Profile), &Profile);
+}
+
+// times every available draw and fill path on the bottom right corner of
+// the screen and keeps the fastest of each. the corner is read back first
+// and restored afterwards. unless Force is set, a profile cached by an
+// earlier boot for the same mode is used instead.
+EFI_STATUS EFIAPI
+BlitTune(NEKO_BLITTER *Blitter,
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Sample,
+         UINTN SampleWidth,
+         UINTN Width,
+         UINTN Height,
+         BOOLEAN Force) {
+   EFI_STATUS Status;
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Blitter->Gop;
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Black = { 0, 0, 0, 0 };
+
+   if (!Force && BlitLoadProfile(Blitter)) {
+      return EFI_SUCCESS;
+   }
+
+   Status = ClkInit();
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   if (Width > Blitter->ScrX || Height > Blitter->ScrY) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   INTN X = Blitter->ScrX - Width;
+   INTN Y = Blitter->ScrY - Height;
+   UINTN Pixels = Width * Height * BLIT_PROBE_ROUNDS;
+
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Saved = 
+      AllocatePool(Width * Height * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   if (Saved == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   Status = Gop->Blt(Gop, Saved, EfiBltVideoToBltBuffer, X, Y, 0, 0,
+                     Width, Height, 0);
+   if (EFI_ERROR(Status)) {
+      FreePool(Saved);
+      return Status;
+   }
+
+   Blitter->BlitRate = 0;
+   for (UINTN Path = 0; Path < NEKO_BLIT_PATH_COUNT; Path++) {
+      NEKO_BLIT_PATH Previous = Blitter->BlitPath;
+
+      if (Path == NEKO_BLIT_FRAMEBUFFER && Blitter->FrameBuffer == NULL) {
+         continue;
+      }
+
+      Blitter->BlitPath = (NEKO_BLIT_PATH)Path;
+      UINT64 Start = ClkTicks();
+      for (UINTN i = 0; i < BLIT_PROBE_ROUNDS; i++) {
+         BlitDraw(Blitter, Sample, SampleWidth, 0, 0, X, Y, Width, Height);
+      }
+      UINT64 Rate = BlitRate(Pixels, Start);
+
+      if (Rate <= Blitter->BlitRate) {
+         Blitter->BlitPath = Previous;
+      } else {
+         Blitter->BlitRate = Rate;
+      }
+   }
+
+   Blitter->FillRate = 0;
+   for (UINTN Path = 0; Path < NEKO_FILL_PATH_COUNT; Path++) {
+      NEKO_FILL_PATH Previous = Blitter->FillPath;
+
+      if (Path == NEKO_FILL_FRAMEBUFFER && Blitter->FrameBuffer == NULL) {
+         continue;
+      }
+
+      Blitter->FillPath = (NEKO_FILL_PATH)Path;
+      UINT64 Start = ClkTicks();
+      for (UINTN i = 0; i < BLIT_PROBE_ROUNDS; i++) {
+         BlitFill(Blitter, Black, X, Y, Width, Height);
+      }
+      UINT64 Rate = BlitRate(Pixels, Start);
+
+      if (Rate <= Blitter->FillRate) {
+         Blitter->FillPath = Previous;
+      } else {
+         Blitter->FillRate = Rate;
+      }
+   }
+
+   Gop->Blt(Gop, Saved, EfiBltBufferToVideo, 0, 0, X, Y, Width, Height, 0);
+   FreePool(Saved);
+
+   Blitter->Probed = TRUE;
+   BlitSaveProfile(Blitter);
+
+   return EFI_SUCCESS;
+}
+
+CONST CHAR16* EFIAPI
+BlitPathName(NEKO_BLIT_PATH Path) {
+   switch (Path) {
+   case NEKO_BLIT_ROWS:        return L"per-row Blt";
+   case NEKO_BLIT_RECT:        return L"rect Blt";
+   case NEKO_BLIT_FRAMEBUFFER: return L"framebuffer";
+   default:                    return L"unknown";
+   }
+}
+
+CONST CHAR16* EFIAPI
+BlitFillPathName(NEKO_FILL_PATH Path) {
+   switch (Path) {
+   case NEKO_FILL_BLT:         return L"VideoFill Blt";
+   case NEKO_FILL_FRAMEBUFFER: return L"framebuffer";
+   default:                    return L"unknown";
+   }
+}
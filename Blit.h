@@ -0,0 +1,72 @@
+#ifndef __NEKO_BLIT_H__
+#define __NEKO_BLIT_H__
+
+#include <Protocol/GraphicsOutput.h>
+
+typedef enum {
+   NEKO_BLIT_ROWS,         // one Blt call per sprite row
+   NEKO_BLIT_RECT,         // one Blt call per sprite, using Delta
+   NEKO_BLIT_FRAMEBUFFER,  // direct writes to FrameBufferBase
+   NEKO_BLIT_PATH_COUNT
+} NEKO_BLIT_PATH;
+
+typedef enum {
+   NEKO_FILL_BLT,          // EfiBltVideoFill
+   NEKO_FILL_FRAMEBUFFER,  // direct writes to FrameBufferBase
+   NEKO_FILL_PATH_COUNT
+} NEKO_FILL_PATH;
+
+typedef struct {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+   UINTN ScrX;
+   UINTN ScrY;
+
+   // only set when the mode exposes a linear 32bpp framebuffer
+   UINT32 *FrameBuffer;
+   UINTN PixelsPerScanLine;
+   BOOLEAN SwapRedBlue;
+
+   NEKO_BLIT_PATH BlitPath;
+   NEKO_FILL_PATH FillPath;
+   UINT64 BlitRate;        // measured pixels per millisecond, 0 if unknown
+   UINT64 FillRate;
+   BOOLEAN Probed;         // FALSE if the paths came from the cached profile
+} NEKO_BLITTER;
+
+VOID EFIAPI
+BlitInit(NEKO_BLITTER *Blitter, EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop);
+
+VOID EFIAPI
+BlitDraw(NEKO_BLITTER *Blitter,
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+         UINTN SrcWidth,
+         UINTN SrcX,
+         UINTN SrcY,
+         INTN DstX,
+         INTN DstY,
+         UINTN Width,
+         UINTN Height);
+
+VOID EFIAPI
+BlitFill(NEKO_BLITTER *Blitter,
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL Color,
+         INTN DstX,
+         INTN DstY,
+         UINTN Width,
+         UINTN Height);
+
+EFI_STATUS EFIAPI
+BlitTune(NEKO_BLITTER *Blitter,
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Sample,
+         UINTN SampleWidth,
+         UINTN Width,
+         UINTN Height,
+         BOOLEAN Force);
+
+CONST CHAR16* EFIAPI
+BlitPathName(NEKO_BLIT_PATH Path);
+
+CONST CHAR16* EFIAPI
+BlitFillPathName(NEKO_FILL_PATH Path);
+
+#endif // __NEKO_BLIT_H__
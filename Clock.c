@@ -0,0 +1,138 @@
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseLib.h>
+
+#include <Protocol/Timestamp.h>
+
+#include "Clock.h"
+
+#define CLK_CALIBRATE_US 10000
+#define CLK_SOFT_PERIOD 10000
+
+static UINT64 mClkFrequency = 0;
+static UINT64 mClkStart = 0;
+
+// where there is no TSC, the timestamp protocol if the firmware has one,
+// and failing that a 1 ms timer counting in software
+static EFI_TIMESTAMP_PROTOCOL *mClkTimestamp = NULL;
+static EFI_EVENT mClkSoftEvent = NULL;
+static volatile UINT64 mClkSoftTicks = 0;
+
+static VOID EFIAPI
+ClkSoftTick(EFI_EVENT Event, VOID *Context) {
+   mClkSoftTicks++;
+}
+
+static EFI_STATUS EFIAPI
+ClkInitFallback(VOID) {
+   EFI_STATUS Status;
+   EFI_TIMESTAMP_PROPERTIES Properties;
+
+   Status = gBS->LocateProtocol(&gEfiTimestampProtocolGuid, NULL,
+                                (VOID**)&mClkTimestamp);
+   if (!EFI_ERROR(Status) &&
+       !EFI_ERROR(mClkTimestamp->GetProperties(&Properties)) &&
+       Properties.Frequency != 0) {
+      mClkFrequency = Properties.Frequency;
+      return EFI_SUCCESS;
+   }
+   mClkTimestamp = NULL;
+
+   Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, TPL_NOTIFY,
+                             ClkSoftTick, NULL, &mClkSoftEvent);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+   Status = gBS->SetTimer(mClkSoftEvent, TimerPeriodic, CLK_SOFT_PERIOD);
+   if (EFI_ERROR(Status)) {
+      gBS->CloseEvent(mClkSoftEvent);
+      mClkSoftEvent = NULL;
+      return Status;
+   }
+   mClkFrequency = 10000000 / CLK_SOFT_PERIOD;
+   return EFI_SUCCESS;
+}
+
+// calibrates the time stamp counter against gBS->Stall. the result is only
+// as good as the firmware's stall, which is plenty for frame timing.
+EFI_STATUS EFIAPI
+ClkInit(VOID) {
+   EFI_STATUS Status = EFI_SUCCESS;
+
+   if (mClkFrequency != 0) {
+      return EFI_SUCCESS;
+   }
+
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+   UINT64 Start = AsmReadTsc();
+   gBS->Stall(CLK_CALIBRATE_US);
+   UINT64 End = AsmReadTsc();
+
+   mClkFrequency = DivU64x32(MultU64x32(End - Start, 1000000),
+                             CLK_CALIBRATE_US);
+   if (mClkFrequency == 0) {
+      return EFI_DEVICE_ERROR;
+   }
+#else
+   Status = ClkInitFallback();
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+#endif
+
+   mClkStart = ClkTicks();
+   return Status;
+}
+
+UINT64 EFIAPI
+ClkTicks(VOID) {
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+   return AsmReadTsc();
+#else
+   if (mClkTimestamp != NULL) {
+      return mClkTimestamp->GetTimestamp();
+   }
+   return mClkSoftTicks;
+#endif
+}
+
+// TRUE if an AP may call ClkTicks, that is unless it is the timestamp
+// protocol's
+BOOLEAN EFIAPI
+ClkApSafe(VOID) {
+#if defined(MDE_CPU_IA32) || defined(MDE_CPU_X64)
+   return TRUE;
+#else
+   return mClkTimestamp == NULL;
+#endif
+}
+
+UINT64 EFIAPI
+ClkTicksToUs(UINT64 Ticks) {
+   if (mClkFrequency == 0) {
+      return 0;
+   }
+   // split into whole seconds first so long intervals cannot overflow
+   UINT64 Remainder;
+   UINT64 Seconds = DivU64x64Remainder(Ticks, mClkFrequency, &Remainder);
+
+   return MultU64x32(Seconds, 1000000) +
+          DivU64x64Remainder(MultU64x32(Remainder, 1000000),
+                             mClkFrequency, NULL);
+}
+
+// monotonic milliseconds since ClkInit
+UINT64 EFIAPI
+ClkNowMs(VOID) {
+   return DivU64x32(ClkTicksToUs(ClkTicks() - mClkStart), 1000);
+}
+
+VOID EFIAPI
+ClkFree(VOID) {
+   if (mClkSoftEvent != NULL) {
+      gBS->SetTimer(mClkSoftEvent, TimerCancel, 0);
+      gBS->CloseEvent(mClkSoftEvent);
+      mClkSoftEvent = NULL;
+      mClkFrequency = 0;
+   }
+}
@@ -0,0 +1,22 @@
+#ifndef __NEKO_CLOCK_H__
+#define __NEKO_CLOCK_H__
+
+EFI_STATUS EFIAPI
+ClkInit(VOID);
+
+UINT64 EFIAPI
+ClkTicks(VOID);
+
+BOOLEAN EFIAPI
+ClkApSafe(VOID);
+
+UINT64 EFIAPI
+ClkTicksToUs(UINT64 Ticks);
+
+UINT64 EFIAPI
+ClkNowMs(VOID);
+
+VOID EFIAPI
+ClkFree(VOID);
+
+#endif // __NEKO_CLOCK_H__
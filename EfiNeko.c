@@ -13,6 +13,79 @@
 #include "EfiNeko.h"
 #include "Util.h"
 #include "Anim.h"
+#include "Atlas.h"
+#include "Blit.h"
+#include "Clock.h"
+#include "Pointer.h"
+#include "Input.h"
+#include "Overlay.h"
+#include "Mp.h"
+#include "Pipe.h"
+#include "Herd.h"
+
+// lodepng allocates through the boot services pool, or from the arena an
+// MP task entered. this lives here rather than in EfiNeko.h so a host can
+// include the header.
+typedef unsigned long size_t;
+
+#define LODEPNG_NO_COMPILE_ALLOCATORS
+
+// a pool block starts with its size, for lodepng_realloc to copy no more
+// than the old block holds
+#define NEKO_PNG_HEADER 16
+
+void* lodepng_malloc(size_t Size) {
+   NEKO_ARENA *Arena = MpArenaCurrent();
+   if (Arena != NULL) {
+      return MpArenaAlloc(Arena, Size);
+   }
+
+   UINT8 *Block = AllocatePool(NEKO_PNG_HEADER + Size);
+   if (Block == NULL) {
+      return NULL;
+   }
+   *(UINTN*)Block = Size;
+
+   return Block + NEKO_PNG_HEADER;
+}
+
+void lodepng_free(void *Addr) {
+   NEKO_ARENA *Arena = MpArenaCurrent();
+   if (Addr == NULL || (Arena != NULL && MpArenaFree(Arena, Addr))) {
+      return;
+   }
+
+   FreePool((UINT8*)Addr - NEKO_PNG_HEADER);
+}
+
+void* lodepng_realloc(void *Addr, size_t Size) {
+   if (Size == 0) {
+      lodepng_free(Addr);
+      return NULL;
+   }
+
+   NEKO_ARENA *Arena = MpArenaCurrent();
+   if (Arena != NULL) {
+      return MpArenaRealloc(Arena, Addr, Size);
+   }
+
+   if (Addr == NULL) {
+      return lodepng_malloc(Size);
+   }
+
+   VOID *NewAddr = lodepng_malloc(Size);
+   if (NewAddr == NULL) {
+      return NULL;
+   }
+
+   UINTN OldSize = *(UINTN*)((UINT8*)Addr - NEKO_PNG_HEADER);
+   CopyMem(NewAddr, Addr, MIN(OldSize, Size));
+
+   lodepng_free(Addr);
+   return NewAddr;
+}
+
+#include "lodepng.h"
 
 #include "Cursor.h"
 #include "Sprite.h"
@@ -25,12 +98,55 @@
 #define EC(expr) do { EFI_STATUS Status = (expr); if (EFI_ERROR(Status)) return Status; } while (0)
 
 #define NEKO_ANIM_INTERVAL 700000
+
+// the simulation steps in ms; a frame's Duration still counts ticks of
+// NEKO_ANIM_INTERVAL, or of a host's NekoTickSpeed. drawing follows at up
+// to 1000 / NEKO_RENDER_MS Hz while the cat runs, and a stall longer than
+// NEKO_SIM_MAX_LAG_MS is not caught up on.
+#define NEKO_TICK_MS (NEKO_ANIM_INTERVAL / 10000)
+#define NEKO_SIM_STEP_MS 10
+#define NEKO_TICK_STEPS (NEKO_TICK_MS / NEKO_SIM_STEP_MS)
+#define NEKO_RENDER_MS 16
+#define NEKO_SIM_MAX_LAG_MS 1000
+#define NEKO_SPEED 5
+#define NEKO_SIM_PX(v) ((INT32)((v) >> NEKO_FP_SHIFT))
 #define NEKO_INPUT_INTERVAL 50000
 
+// quit, pause/resume, reset and next skin, see NekoHandleKeyEvent. over
+// a host image they need left ctrl and alt, or the host's own typing would
+// set them off.
+#define NEKO_HOTKEYS L"qQpPrRnN"
+#define NEKO_HOTKEY_SHIFT (EFI_SHIFT_STATE_VALID | EFI_LEFT_CONTROL_PRESSED | \
+                           EFI_LEFT_ALT_PRESSED)
+
 #define CURSOR_WIDTH 16
 #define CURSOR_HEIGHT 16
 
-#define SPRITE_DIRECTORY   "sprites"
+// pointer acceleration kicks in past NEKO_ACCEL_THRESHOLD px per update
+#define NEKO_ACCEL_THRESHOLD 4
+#define NEKO_ACCEL_MAX 4
+
+// the cat is a box of its animations' size at NekoX, NekoY, and each frame
+// is drawn at its own place in it
+#define NEKO_BOX_WIDTH(State) ((INT32)(State)->Anims->BoxWidth)
+#define NEKO_BOX_HEIGHT(State) ((INT32)(State)->Anims->BoxHeight)
+
+#define NEKO_SKIN_MAX 16
+#define NEKO_SKIN_BUDGET (4 * 1024 * 1024)
+#define NEKO_SKIN_POLL_TICKS 8
+
+// startup decodes are spread over the processors, one image per task, then
+// NEKO_CONVERT_ROWS rows of conversion per task. an arena is sized from the
+// PNG header, plus NEKO_ARENA_SLACK for lodepng's own bookkeeping.
+#define NEKO_CONVERT_ROWS 32
+#define NEKO_ARENA_SLACK (256 * 1024)
+#define NEKO_PNG_OUT_OF_MEMORY 83
+
+// --herd-bench runs herds of 64 cats and up, 4 times as many each time
+#define NEKO_HERD_BENCH_MAX 16384
+#define NEKO_HERD_BENCH_TICKS 64
+
+#define SPRITE_DIRECTORY   L"sprites"
 #define IMAGE_DIRECTORY    "img"
 #define CONFIG_FILE        "EfiNeko.ini"
 
@@ -40,9 +156,133 @@ typedef struct {
    UINTN Height;
 } NEKO_SPRITE;
 
+// a decoded sprite sheet. only the atlas of the sprites its animations
+// show is kept. that is filled in from the raw decode a sprite at a time,
+// the current frame's first, so it can be drawn before the rest is ready;
+// Rgba is released once every sprite is in.
 typedef struct {
-   EFI_SIMPLE_POINTER_PROTOCOL *Spp;
+   CHAR16 *Path;           // NULL for the built-in sheet
+   EFI_TIME ModTime;
+   NEKO_ATLAS Atlas;
+   UINT8 *Rgba;
+   UINTN RgbaBytes;        // of Bytes, what goes with Rgba
+   UINTN Bytes;            // decoded bytes charged against the budget
+   UINT64 LastUsed;
+   NEKO_ANIMS *Anims;      // its manifest's, or a copy of AnimBuiltin()
+} NEKO_SKIN;
+
+typedef struct {
+   NEKO_SKIN Skins[NEKO_SKIN_MAX];
+   UINTN Count;
+   UINTN Active;
+   UINTN Budget;
+   UINTN Used;
+   UINT64 Clock;
+   UINTN PollTicks;
+   BOOLEAN AheadWanted;    // by a switch, for NekoSkinAhead
+
+   UINTN Hits;
+   UINTN Misses;
+   UINTN Evictions;
+   UINTN Reloads;
+   UINTN Ahead;            // of Misses, those decoded ahead of the switch
+   UINTN Manifests;        // compiled, for skins that had one
+   UINTN BadManifests;     // left for the built-in animations
+   UINTN BadLine;          // where the last of those went wrong
+} NEKO_SKIN_CACHE;
+
+// one image for whichever processor picks it up. reading the file and every
+// pool allocation happen on the BSP, before and after.
+typedef struct {
+   CHAR16 *Path;           // NULL for a built-in image
+   EFI_TIME ModTime;
+   UINT8 *Png;
+   UINTN PngSize;
+   BOOLEAN PngPool;        // read from a file, so ours to free
+   NEKO_ARENA Arena;       // without one only the BSP may decode it
+   UINT32 Error;
+   UINT8 *Rgba;
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Image; // the cursor, converted whole
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter;
+   UINTN Width;
+   UINTN Height;
+   UINTN Skin;             // where the image goes in the skin cache
+   UINTN FirstChunk;       // of the conversion run
+} NEKO_DECODE_JOB;
+
+typedef struct {
+   NEKO_DECODE_JOB Jobs[NEKO_SKIN_MAX + 1];
+   UINTN Count;
+   UINTN Chunks;
+} NEKO_DECODE_BATCH;
+
+typedef enum {
+   NEKO_GOP_KEEP,          // stay in whatever mode the firmware set up
+   NEKO_GOP_PREFERRED,     // exact WxH match, current mode otherwise
+   NEKO_GOP_BUDGET,        // largest mode with at most PixelBudget pixels
+} NEKO_GOP_POLICY;
+
+typedef struct {
+   UINT32 Mode;
+   UINT32 Width;
+   UINT32 Height;
+} NEKO_GOP_MODE;
+
+typedef struct {
+   NEKO_GOP_POLICY Policy;
+   UINT32 PreferredWidth;
+   UINT32 PreferredHeight;
+   UINTN PixelBudget;
+
+   NEKO_GOP_MODE *Modes;   // enumerated once by NekoCacheGopModes
+   UINTN ModeCount;
+} NEKO_GOP_CONFIG;
+
+typedef struct {
+   INT64 RemX;             // sub-pixel remainder carried between reports
+   INT64 RemY;
+   UINTN Accel;            // extra gain in percent per pixel over threshold
+} NEKO_POINTER_SCALE;
+
+// a render pass that takes longer than LimitUs on average
+// holds input up for too long. after NEKO_DEGRADE_AFTER such passes the
+// renderer steps down one level, and after NEKO_RECOVER_AFTER passes under
+// half the budget it steps back up.
+#define NEKO_FRAME_BUDGET_US 2000
+#define NEKO_DEGRADE_AFTER 8
+#define NEKO_RECOVER_AFTER 64
+#define NEKO_SLOW_TICKS 2
+
+typedef enum {
+   NEKO_DEGRADE_NONE,      // interpolated sprite and cursor every wakeup
+   NEKO_DEGRADE_SKIP,      // sprite only on animation ticks
+   NEKO_DEGRADE_MERGE,     // cursor moves merged to one per NEKO_RENDER_MS
+   NEKO_DEGRADE_SLOW,      // sprite every NEKO_SLOW_TICKS ticks
+   NEKO_DEGRADE_COUNT
+} NEKO_DEGRADE;
+
+typedef struct {
+   NEKO_DEGRADE Level;
+   UINT64 LimitUs;         // NEKO_FRAME_BUDGET_US, or the host's budget
+   UINT64 AvgUs;           // moving average of a render pass, 1/8 weight
+   UINT64 MaxUs;
+   UINTN Over;             // consecutive passes over budget
+   UINTN Under;            // consecutive passes under half of it
+   UINTN Ticks;            // ticks since the sprite was last drawn
+   UINT64 CursorDrawn;     // ClkNowMs() of the last cursor draw
+   BOOLEAN CursorPending;  // a merged cursor move still has to be drawn
+   UINT64 Frames;
+   UINT64 Overruns;
+   UINT64 Degrades;
+   UINT64 Recoveries;
+} NEKO_FRAME_BUDGET;
+
+typedef struct {
+   NEKO_POINTERS Pointers;
+   NEKO_POINTER_SCALE PtrScale;
    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+   NEKO_GOP_CONFIG GopConfig;
+   NEKO_BLITTER Blitter;
 
    INT32 NekoX;
    INT32 NekoY;
@@ -53,12 +293,68 @@ typedef struct {
    INT32 PtrY;
    INT32 PtrXPrev;
    INT32 PtrYPrev;
+   BOOLEAN LeftButtonPrev;
+   BOOLEAN RightButtonPrev;
 
    INT32 ScrX;
    INT32 ScrY;
 
    BOOLEAN ShouldQuit;
    BOOLEAN NekoPaused;
+   // drawn over a host's screen, which must not be cleared. what was
+   // under the sprite and the cursor is kept to be put back instead.
+   BOOLEAN Overlay;
+   BOOLEAN DrawCursor;
+   NEKO_UNDER SpriteUnder;
+   NEKO_UNDER CursorUnder;
+   // host drawing reported since the last tick. Damaged is set once that
+   // hit the cat, which then has to be drawn on top again.
+   NEKO_DAMAGE Damage;
+   BOOLEAN Damaged;
+   EFINEKO_STATS Stats;
+
+   // pointers and keys are sampled every NEKO_INPUT_INTERVAL at
+   // NEKO_INPUT_TPL; the main loop only drains the ring. InputLatency is
+   // the longest a sample has waited there, in clock ticks.
+   NEKO_INPUT Input;
+   UINT64 InputLatency;
+   // the oldest pointer sample not yet drawn, and how long samples took
+   // from being taken to being on screen when drawn here
+   UINT64 InputPending;
+   NEKO_LATENCY Latency;
+
+   // with --pipeline an AP draws, and the frames only get described here
+   NEKO_PIPE Pipe;
+
+   // the other cats of --cats, stepped and drawn along with this one
+   NEKO_HERD Herd;
+
+   // the simulation runs in fixed NEKO_SIM_STEP_MS steps of ClkNowMs()
+   // time, TickSteps of them per animation tick. SimX and SimY hold
+   // the cat after the last step and SimPrevX and SimPrevY before it, in
+   // 16.16; NekoX and NekoY are drawn in between. TickEvent is a one-shot
+   // timer armed for the next frame worth drawing, so a sleeping cat only
+   // wakes up when its frame changes.
+   EFI_EVENT TickEvent;
+   NEKO_FRAME_BUDGET Budget;
+   UINTN TickSteps;
+   UINT64 SimLast;
+   UINT64 SimAcc;
+   UINTN StepInTick;
+   BOOLEAN Moving;
+   INT64 SimX;
+   INT64 SimY;
+   INT64 SimPrevX;
+   INT64 SimPrevY;
+
+   // main loop wakeups. the rate also counts sampler runs and is taken
+   // over windows of at least a second; WindowWakeups is the combined
+   // count when the current window started.
+   UINT64 Wakeups;
+   UINT64 WakeupStart;
+   UINT64 WindowStart;
+   UINT64 WindowWakeups;
+   UINT64 WakeupRate;
 
    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *CursorImage;
    UINTN CursorWidth;
@@ -67,107 +363,113 @@ typedef struct {
    EFI_GRAPHICS_OUTPUT_BLT_PIXEL *SpsImage;
    UINTN SpsWidth;
    UINTN SpsHeight;
+   NEKO_SKIN_CACHE SkinCache;
+   NEKO_DECODE_JOB Ahead;  // the next skin, while an AP decodes it
 
-   NekoAnimationType CurrentAnimation;
-   UINT8 CurrentFrame;
-   UINT8 LoopIndex;
-   UINTN TicksElapsed;
-   UINT8 SpriteSheetX;
-   UINT8 SpriteSheetY;
+   CONST NEKO_ANIMS *Anims; // the active skin's
+   NEKO_ANIM_STATE Anim;
+   UINT8 Cell;             // the frame's, of Anims->Sprites
+   UINT8 CellPrev;         // as NekoDrawHerd drew it last
+
+   // startup is timed from NekoInitDefaultState. the assets are decoded
+   // on every processor MP services will lend us.
+   NEKO_MP Mp;
+   UINT64 LaunchStart;
+   UINT64 AssetUs;
+   UINT64 FirstFrameUs;
 
    EFI_HANDLE ImageHandle;
 } NekoState;
 
-EFI_STATUS EFIAPI
-EfiNekoInit(EFINEKO_SETUP *Setup, EFINEKO_STATE *State) {
-   EFI_EVENT MouseEvent;
-   EC(gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &MouseEvent));
-   EC(gBS->SetTimer(MouseEvent, TimerPeriodic, NEKO_INPUT_INTERVAL));
-
-   EFI_EVENT NekoTickEvent;
-   UINTN TickSpeed = Setup->NekoTickSpeed == 0 ? NEKO_ANIM_INTERVAL
-                                               : Setup->NekoTickSpeed;
-   EC(gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &NekoTickEvent));
-   EC(gBS->SetTimer(NekoTickEvent, TimerPeriodic, TickSpeed));
-
-   State->WaitList[0] = MouseEvent;
-   State->WaitList[1] = NekoTickEvent;
-   if (Setup->EnableKeyboardEvents) {
-      State->WaitList[2] = gST->ConIn->WaitForKey;
-   }
-
-   return EFI_SUCCESS;
-}
+static EFI_STATUS EFIAPI
+NekoCacheGopModes(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, NEKO_GOP_CONFIG *Config) {
+   UINT32 MaxMode = Gop->Mode->MaxMode;
 
-EFI_STATUS EFIAPI
-EfiNekoDestroy(EFINEKO_STATE *State) {
-   if (!State) {
-      return EFI_INVALID_PARAMETER;
+   Config->Modes = AllocatePool(MaxMode * sizeof(NEKO_GOP_MODE));
+   if (Config->Modes == NULL) {
+      return EFI_OUT_OF_RESOURCES;
    }
+   Config->ModeCount = 0;
 
-   EC(gBS->SetTimer(State->WaitList[0], TimerCancel, 0));
-   EC(gBS->CloseEvent(State->WaitList[0]));
-   EC(gBS->SetTimer(State->WaitList[1], TimerCancel, 0));
-   EC(gBS->CloseEvent(State->WaitList[1]));
-
-   return EFI_SUCCESS;
-}
-
-VOID EFIAPI
-NekoHardReset(NekoState *State) {
+   for (UINT32 i = 0; i < MaxMode; i++) {
+      UINTN InfoSize;
+      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *ModeInfo;
 
-}
+      // QueryMode allocates ModeInfo itself, the caller only frees it
+      if (EFI_ERROR(Gop->QueryMode(Gop, i, &InfoSize, &ModeInfo))) {
+         continue;
+      }
 
-static EFI_STATUS EFIAPI
-NekoInitSpp(EFI_SIMPLE_POINTER_PROTOCOL **Spp) {
-   EFI_STATUS Status;
+      NEKO_GOP_MODE *Mode = &Config->Modes[Config->ModeCount++];
+      Mode->Mode = i;
+      Mode->Width = ModeInfo->HorizontalResolution;
+      Mode->Height = ModeInfo->VerticalResolution;
 
-   if (Spp == NULL) {
-      return EFI_INVALID_PARAMETER;
+      FreePool(ModeInfo);
    }
 
-   Status = gBS->LocateProtocol(&gEfiSimplePointerProtocolGuid,
-                                NULL,
-                                (VOID**)Spp);
-   FASTFAIL();
-
-   Status = (*Spp)->Reset(*Spp, FALSE);
-   FASTFAIL();
-
    return EFI_SUCCESS;
 }
 
-static EFI_STATUS EFIAPI
-NekoSetGopMode(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop) {
-   EFI_STATUS Status;
-   UINTN MaxMode = Gop->Mode->MaxMode;
-   UINTN BestIdx = 0;
+static UINT32 EFIAPI
+NekoPickGopMode(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, NEKO_GOP_CONFIG *Config) {
+   UINT32 Current = Gop->Mode->Mode;
+   UINT32 Best = Current;
    UINTN BestRes = 0;
 
-   for (UINTN i = 0; i < MaxMode; i++) {
-      UINTN OutSize = 0;
-      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *ModeInfo = NULL;
-
-      Status = Gop->QueryMode(Gop, i, &OutSize, &ModeInfo);
-      ModeInfo = AllocatePool(OutSize);
-      if (ModeInfo == NULL) {
-         continue;
+   switch (Config->Policy) {
+   case NEKO_GOP_KEEP:
+      break;
+   case NEKO_GOP_PREFERRED:
+      for (UINTN i = 0; i < Config->ModeCount; i++) {
+         if (Config->Modes[i].Width == Config->PreferredWidth &&
+             Config->Modes[i].Height == Config->PreferredHeight) {
+            Best = Config->Modes[i].Mode;
+            if (Best == Current) {
+               break;
+            }
+         }
       }
-
-      Status = Gop->QueryMode(Gop, i, &OutSize, &ModeInfo);
-      if (!EFI_ERROR(Status)) {
-         UINTN CurrentRes = ModeInfo->HorizontalResolution
-                          * ModeInfo->VerticalResolution;
-         if (CurrentRes > BestRes) {
+      break;
+   case NEKO_GOP_BUDGET:
+      for (UINTN i = 0; i < Config->ModeCount; i++) {
+         UINTN CurrentRes = (UINTN)Config->Modes[i].Width
+                          * Config->Modes[i].Height;
+         if (CurrentRes > Config->PixelBudget) {
+            continue;
+         }
+         // on a tie the active mode wins, saving a SetMode
+         if (CurrentRes > BestRes ||
+             (CurrentRes == BestRes && Config->Modes[i].Mode == Current)) {
             BestRes = CurrentRes;
-            BestIdx = i;
+            Best = Config->Modes[i].Mode;
          }
       }
+      break;
+   }
 
-      FreePool(ModeInfo);
+   return Best;
+}
+
+static EFI_STATUS EFIAPI
+NekoSetGopMode(EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop, NEKO_GOP_CONFIG *Config) {
+   EFI_STATUS Status;
+
+   if (Config->Policy == NEKO_GOP_KEEP) {
+      return EFI_SUCCESS;
+   }
+
+   if (Config->Modes == NULL) {
+      Status = NekoCacheGopModes(Gop, Config);
+      FASTFAIL();
+   }
+
+   UINT32 Mode = NekoPickGopMode(Gop, Config);
+   if (Mode == Gop->Mode->Mode) {
+      return EFI_SUCCESS;
    }
 
-   Status = Gop->SetMode(Gop, BestIdx);
+   Status = Gop->SetMode(Gop, Mode);
    FASTFAIL();
 
    return EFI_SUCCESS;
@@ -186,7 +488,7 @@ NekoInitGop(EFI_GRAPHICS_OUTPUT_PROTOCOL **Gop, NekoState *State) {
                                 (VOID**)Gop);
    FASTFAIL();
 
-   Status = NekoSetGopMode(*Gop);
+   Status = NekoSetGopMode(*Gop, &State->GopConfig);
    FASTFAIL();
 
    State->ScrX = (*Gop)->Mode->Info->HorizontalResolution;
@@ -195,60 +497,6 @@ NekoInitGop(EFI_GRAPHICS_OUTPUT_PROTOCOL **Gop, NekoState *State) {
    return EFI_SUCCESS;
 }
 
-static EFI_STATUS EFIAPI
-NekoPngToGopBlt(UINT8 *ImageData, 
-                UINTN ImageSize, 
-                EFI_GRAPHICS_OUTPUT_BLT_PIXEL **BltBuffer,
-                UINTN *Width,
-                UINTN *Height) {
-   unsigned char *Image = NULL;
-   unsigned int W, H;
-
-   UINT32 Error = lodepng_decode32(&Image, &W, &H, ImageData, ImageSize);
-   if (Error) {
-      return EFI_INVALID_PARAMETER;
-   }
-
-   *Width = W;
-   *Height = H;
-
-   *BltBuffer = AllocatePool(W * H * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
-   if (*BltBuffer == NULL) {
-      lodepng_free(Image);
-      return EFI_OUT_OF_RESOURCES;
-   }
-
-   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter;
-   Filter.Red = Image[0];
-   Filter.Green = Image[1];
-   Filter.Blue = Image[2];
-   Filter.Reserved = Image[3];
-
-   for (UINTN y = 0; y < H; y++) {
-      for (UINTN x = 0; x < W; x++) {
-         UINTN idx = (y * W + x) * 4;
-
-         if (Image[idx + 0] == Filter.Red && 
-             Image[idx + 1] == Filter.Green &&
-             Image[idx + 2] == Filter.Blue) {
-            (*BltBuffer)[y * W + x].Red = 0;
-            (*BltBuffer)[y * W + x].Green = 0;
-            (*BltBuffer)[y * W + x].Blue = 0;
-            (*BltBuffer)[y * W + x].Reserved = 0;
-         } else {
-            (*BltBuffer)[y * W + x].Red = Image[idx];
-            (*BltBuffer)[y * W + x].Green = Image[idx + 1];
-            (*BltBuffer)[y * W + x].Blue = Image[idx + 2];
-            (*BltBuffer)[y * W + x].Reserved = Image[idx + 3];
-         }
-      }
-   }
-
-   lodepng_free(Image);
-
-   return EFI_SUCCESS;
-}
-
 static EFI_STATUS EFIAPI
 NekoDrawBackground(NekoState *State) {
    EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = State->Gop;
@@ -258,35 +506,89 @@ NekoDrawBackground(NekoState *State) {
    UINTN Width = Gop->Mode->Info->HorizontalResolution;
    UINTN Height = Gop->Mode->Info->VerticalResolution;
 
-   Gop->Blt(Gop, &Pix, EfiBltVideoFill, 0, 0, 0, 0, Width, Height, 0);
+   BlitFill(&State->Blitter, Pix, 0, 0, Width, Height);
 
    return EFI_SUCCESS;
 }
 
 static VOID EFIAPI
-NekoUpdateCursorPos(EFI_SIMPLE_POINTER_STATE Ptr, NekoState *State) {
-   // FIXME: add adaptive scaling
-   INT32 NewX = State->PtrX + (Ptr.RelativeMovementX / 10000);
-   INT32 NewY = State->PtrY + (Ptr.RelativeMovementY / 10000);
+NekoUpdateCursorPos(NEKO_POINTER_INPUT *Input, NekoState *State) {
+   NEKO_POINTER_SCALE *Scale = &State->PtrScale;
+   INT64 Dx = Input->Dx;
+   INT64 Dy = Input->Dy;
+
+   // an absolute report places the cursor outright; relative motion from
+   // the same batch is dropped in its favour
+   if (Input->HasAbsolute) {
+      State->PtrX = MAX(0, MIN(Input->AbsX, State->ScrX - CURSOR_WIDTH));
+      State->PtrY = MAX(0, MIN(Input->AbsY, State->ScrY - CURSOR_HEIGHT));
+      Scale->RemX = 0;
+      Scale->RemY = 0;
+      return;
+   }
+
+   // linear acceleration past NEKO_ACCEL_THRESHOLD px per update, capped
+   // at NEKO_ACCEL_MAX times the base gain
+   if (Scale->Accel != 0) {
+      INT64 Speed = ABS(Dx) + ABS(Dy);
+      INT64 Threshold = (INT64)NEKO_ACCEL_THRESHOLD << NEKO_FP_SHIFT;
+
+      if (Speed > Threshold) {
+         INT64 Factor = NEKO_FP_ONE + 
+            ((Speed - Threshold) * (INT64)Scale->Accel) / 100;
+         Factor = MIN(Factor, (INT64)NEKO_ACCEL_MAX << NEKO_FP_SHIFT);
+         Dx = (Dx * Factor) >> NEKO_FP_SHIFT;
+         Dy = (Dy * Factor) >> NEKO_FP_SHIFT;
+      }
+   }
+
+   Scale->RemX += Dx;
+   Scale->RemY += Dy;
+
+   INT32 StepX = (INT32)(Scale->RemX / NEKO_FP_ONE);
+   INT32 StepY = (INT32)(Scale->RemY / NEKO_FP_ONE);
+   Scale->RemX -= (INT64)StepX * NEKO_FP_ONE;
+   Scale->RemY -= (INT64)StepY * NEKO_FP_ONE;
+
+   INT32 NewX = State->PtrX + StepX;
+   INT32 NewY = State->PtrY + StepY;
 
    State->PtrX = MAX(0, MIN(NewX, (INT32)State->ScrX - CURSOR_WIDTH));
    State->PtrY = MAX(0, MIN(NewY, (INT32)State->ScrY - CURSOR_HEIGHT));
+
+   // pushing against an edge must not bank motion for the way back
+   if (State->PtrX != NewX) {
+      Scale->RemX = 0;
+   }
+   if (State->PtrY != NewY) {
+      Scale->RemY = 0;
+   }
 }
 
 static VOID EFIAPI
 NekoDrawCursor(NekoState *State) {
-   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = State->Gop;
-
-   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Blk = {0, 0, 0, 0};
-   Gop->Blt(Gop, &Blk, EfiBltVideoFill, 0, 0, 
-            State->PtrXPrev, State->PtrYPrev,
-            State->CursorWidth, State->CursorHeight,
-            State->CursorWidth * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   if (!State->DrawCursor) {
+      State->PtrXPrev = State->PtrX;
+      State->PtrYPrev = State->PtrY;
+      return;
+   }
 
-   Gop->Blt(Gop, State->CursorImage, EfiBltBufferToVideo, 0, 0,
-            State->PtrX, State->PtrY,
-            State->CursorWidth, State->CursorHeight,
-            State->CursorWidth * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   if (State->Overlay) {
+      OverlayUnderRestore(&State->Blitter, &State->CursorUnder);
+      OverlayUnderDraw(&State->Blitter, &State->CursorUnder,
+                       State->CursorImage, State->CursorWidth, 0, 0,
+                       State->PtrX, State->PtrY,
+                       State->CursorWidth, State->CursorHeight);
+   } else {
+      EFI_GRAPHICS_OUTPUT_BLT_PIXEL Blk = {0, 0, 0, 0};
+      BlitFill(&State->Blitter, Blk,
+               State->PtrXPrev, State->PtrYPrev,
+               State->CursorWidth, State->CursorHeight);
+
+      BlitDraw(&State->Blitter, State->CursorImage, State->CursorWidth, 0, 0,
+               State->PtrX, State->PtrY,
+               State->CursorWidth, State->CursorHeight);
+   }
 
    State->PtrXPrev = State->PtrX;
    State->PtrYPrev = State->PtrY;
@@ -327,418 +629,2229 @@ NekoGetDirection(INT32 Dx, INT32 Dy) {
    }
 }
 
-static UINT32 EFIAPI
-NekoIntSqrt(UINT32 Value) {
-    if (Value <= 1) return Value;
-    
-    UINT32 Result = 0;
-    UINT32 Bit = 1UL << 30;  // Start with highest power of 4 <= Value
-    
-    while (Bit > Value) {
-        Bit >>= 2;
-    }
-    
-    while (Bit != 0) {
-        if (Value >= Result + Bit) {
-            Value -= Result + Bit;
-            Result = (Result >> 1) + Bit;
-        } else {
-            Result >>= 1;
-        }
-        Bit >>= 2;
-    }
-    
-    return Result;
-}
-
-static VOID EFIAPI
-NekoUpdateAnimation(NekoState *State) {
-   const AnimationSequence *Sequence = 
-      &AnimationSequences[State->CurrentAnimation];
-   const AnimationFrame *Frame = &Sequence->Frames[State->CurrentFrame];
-
-   State->TicksElapsed += 1;
-
-   if (State->TicksElapsed == Frame->Duration) {
-      if (Frame->Flags == NEKO_FRAME_FLAG_LOOP_END) {
-         if (State->LoopIndex < Frame->LoopIterations - 1 
-               || Frame->LoopIterations == 0) {
-            for (UINTN i = State->CurrentFrame; i >= 0; i--) {
-               if (Sequence->Frames[i].Flags == NEKO_FRAME_FLAG_LOOP_BEGIN) {
-                  State->CurrentFrame = i;
-                  State->TicksElapsed = 0;
-                  break;
-               }
-            }
-            State->LoopIndex++;
-         } else {
-            State->CurrentFrame++;
-            State->TicksElapsed = 0;
-            State->LoopIndex = 0;
-         }
-      } else {
-         State->CurrentFrame++;
-         State->TicksElapsed = 0;
-      }
-
-      if (State->CurrentFrame >= Sequence->FrameCount) {
-         State->CurrentFrame = 0;
-         State->TicksElapsed = 0;
-      }
-   }
+// squared distance from the cat to the cursor; within NEKO_NEAR_DIST the
+// cat stays put
+#define NEKO_NEAR_DIST 1600
 
-   const AnimationSequence *NewSequence = 
-      &AnimationSequences[State->CurrentAnimation];
-   const AnimationFrame *NewFrame = &NewSequence->Frames[State->CurrentFrame];
+static UINT32 EFIAPI
+NekoCursorDist(NekoState *State, INT32 *Dx, INT32 *Dy) {
+   *Dx = ((INT32)State->PtrX - State->CursorWidth / 2) - 
+      NEKO_SIM_PX(State->SimX);
+   *Dy = ((INT32)State->PtrY - State->CursorHeight / 2) - 
+      NEKO_SIM_PX(State->SimY);
 
-   State->SpriteSheetX = NewFrame->SpriteSheetX;
-   State->SpriteSheetY = NewFrame->SpriteSheetY;
+   return (*Dx * *Dx) + (*Dy * *Dy);
 }
 
+// picks the animation for the coming tick and advances it by one frame
+// tick. whether the cat runs during the tick is left in State->Moving.
 static VOID EFIAPI
-NekoUpdateSpritePos(NekoState *State) {
-   if (State->NekoPaused == TRUE) {
-      return;
-   }
-
-   INT32 Dx = ((INT32)State->PtrX - State->CursorWidth / 2) - 
-      (INT32)State->NekoX;
-   INT32 Dy = ((INT32)State->PtrY - State->CursorHeight / 2) - 
-      (INT32)State->NekoY;
+NekoAnimTick(NekoState *State) {
+   INT32 Dx;
+   INT32 Dy;
+   UINT32 Dist = NekoCursorDist(State, &Dx, &Dy);
 
-   UINT32 Dist = (Dx * Dx) + (Dy * Dy);
-
-   if (Dist <= 1600) {
+   if (Dist <= NEKO_NEAR_DIST) {
       Dx = 0;
       Dy = 0;
    }
 
-   NekoAnimationType AnimationType = NekoGetDirection(Dx, Dy);
+   UINT8 Wanted = NekoGetDirection(Dx, Dy);
+
+   // against an edge it scratches instead
+   INT32 SimX = NEKO_SIM_PX(State->SimX);
+   INT32 SimY = NEKO_SIM_PX(State->SimY);
+   if (SimX == 0) {
+      Wanted = NEKO_ANIM_SCRATCH_LEFT;
+   } else if (SimX == State->ScrX) {
+      Wanted = NEKO_ANIM_SCRATCH_RIGHT;
+   } else if (SimY == 0) {
+      Wanted = NEKO_ANIM_SCRATCH_DOWN;
+   } else if (SimY == State->ScrY) {
+      Wanted = NEKO_ANIM_SCRATCH_UP;
+   }
 
-   const AnimationSequence *Sequence = 
-      &AnimationSequences[State->CurrentAnimation];
-   const AnimationFrame *Frame = &Sequence->Frames[State->CurrentFrame];
+   AnimTick(State->Anims, &State->Anim, Wanted);
 
-   if (Sequence->Flags & NEKO_ANIM_FLAG_NO_INTERRUPT) {
-      if (State->CurrentFrame == Sequence->FrameCount - 1 &&
-          State->TicksElapsed == Frame->Duration - 1) {
-         State->TicksElapsed = 0;
-         State->CurrentFrame = 0;
-         State->LoopIndex = 0;
-         State->CurrentAnimation = AnimationType;
-      }
-   } else {
-      if (AnimationType != State->CurrentAnimation) {
-         if (State->CurrentAnimation == NEKO_ANIM_IDLE) {
-            AnimationType = NEKO_ANIM_STARTLED;
-         }
-         State->TicksElapsed = 0;
-         State->CurrentFrame = 0;
-         State->CurrentAnimation = AnimationType;
-      }
-   }
+   CONST NEKO_ANIM_FRAME *Frame = AnimFrame(State->Anims, &State->Anim);
+   State->Cell = Frame->Cell;
+   State->Moving = !(State->Anims->Sequences[State->Anim.Sequence].Flags &
+                     NEKO_ANIM_FLAG_STILL) &&
+                   Dist > NEKO_NEAR_DIST;
+}
 
-   if (State->NekoX == 0) {
-      State->CurrentAnimation = NEKO_ANIM_SCRATCH_LEFT;
-   } else if (State->NekoX == State->ScrX) {
-      State->CurrentAnimation = NEKO_ANIM_SCRATCH_RIGHT;
-   } else if (State->NekoY == 0) {
-      State->CurrentAnimation = NEKO_ANIM_SCRATCH_DOWN;
-   } else if (State->NekoY == State->ScrY) {
-      State->CurrentAnimation = NEKO_ANIM_SCRATCH_UP;
-   }
+// one fixed simulation step. the first step of every tick runs the
+// animation, the rest only move the cat NEKO_SPEED px per tick, spread
+// evenly over the tick's steps. returns TRUE if this step was a tick.
+static BOOLEAN EFIAPI
+NekoSimStep(NekoState *State) {
+   BOOLEAN Ticked = State->StepInTick == 0;
 
-   NekoUpdateAnimation(State);
+   State->SimPrevX = State->SimX;
+   State->SimPrevY = State->SimY;
 
-   if (State->CurrentAnimation == NEKO_ANIM_STARTLED) {
-      return;
+   if (Ticked) {
+      NekoAnimTick(State);
+   }
+   State->StepInTick = (State->StepInTick + 1) % State->TickSteps;
+
+   if (!State->Moving) {
+      return Ticked;
    }
 
-   const INT32 NEKO_SPEED = 5;
+   INT32 Dx;
+   INT32 Dy;
+   UINT32 Dist = NekoCursorDist(State, &Dx, &Dy);
+   INT64 Length = UtIntSqrt(Dist);
 
-   INT32 Length = (INT32)NekoIntSqrt(Dist);
-   if (Length > 0) {
-      INT32 StepX = (Dx * NEKO_SPEED * 1000) / Length;
-      INT32 StepY = (Dy * NEKO_SPEED * 1000) / Length;
-        
-      State->NekoX = (UINT32)((INT32)State->NekoX + (StepX + 500) / 1000);
-      State->NekoY = (UINT32)((INT32)State->NekoY + (StepY + 500) / 1000);
+   if (Dist > NEKO_NEAR_DIST && Length != 0) {
+      State->SimX += ((INT64)Dx * NEKO_SPEED * NEKO_FP_ONE) 
+                   / (Length * State->TickSteps);
+      State->SimY += ((INT64)Dy * NEKO_SPEED * NEKO_FP_ONE) 
+                   / (Length * State->TickSteps);
    }
+   return Ticked;
 }
 
-VOID EFIAPI
-NekoDrawSprite(NekoState *State) {
-   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = State->Gop;
-   #define SPRITE_SIZE 32
-   #define BORDER_SIZE 1
+// runs the simulation up to now and interpolates the drawing position
+// between the last two steps, so the cat glides instead of jumping a whole
+// tick's distance at once. paused time is not simulated. returns the
+// number of animation ticks that passed.
+static UINTN EFIAPI
+NekoAdvance(NekoState *State) {
+   UINT64 Now = ClkNowMs();
+   UINT64 Lag = Now - State->SimLast;
+   UINTN Ticks = 0;
+
+   State->SimLast = Now;
+   if (State->NekoPaused) {
+      return 0;
+   }
 
-   UINT8 SpriteX = State->SpriteSheetX;
-   UINT8 SpriteY = State->SpriteSheetY;
+   UINTN StepInTick = State->StepInTick;
+   UINTN Steps = 0;
 
-   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Blk = {0, 0, 0, 0};
-   Gop->Blt(Gop, &Blk, EfiBltVideoFill, 0, 0, 
-            State->NekoXPrev, State->NekoYPrev,
-            SPRITE_SIZE, SPRITE_SIZE,
-            SPRITE_SIZE * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
-
-   for (UINT32 y = 0; y < SPRITE_SIZE; y++) {
-      EFI_GRAPHICS_OUTPUT_BLT_PIXEL *RowStart = &State->SpsImage[
-         ((SpriteY * (SPRITE_SIZE + BORDER_SIZE) + y) * State->SpsWidth) + 
-         (SpriteX * (SPRITE_SIZE + BORDER_SIZE))
-      ];
-
-      Gop->Blt(
-         Gop,
-         RowStart,
-         EfiBltBufferToVideo,
-         0,
-         0,
-         State->NekoX,
-         State->NekoY + y,
-         SPRITE_SIZE,
-         1,
-         State->SpsWidth
-      );
+   State->SimAcc = MIN(State->SimAcc + Lag, NEKO_SIM_MAX_LAG_MS);
+   while (State->SimAcc >= NEKO_SIM_STEP_MS) {
+      Ticks += NekoSimStep(State);
+      State->SimAcc -= NEKO_SIM_STEP_MS;
+      Steps++;
    }
 
-   State->NekoXPrev = State->NekoX;
-   State->NekoYPrev = State->NekoY;
+   // the cursor stands still in between, so the herd takes all of the
+   // steps at once, spread over the processors
+   HerdStep(&State->Herd, (INT32)(State->PtrX - State->CursorWidth / 2),
+            (INT32)(State->PtrY - State->CursorHeight / 2), StepInTick,
+            Steps);
+
+   INT64 Alpha = (INT64)State->SimAcc;
+   INT64 X = State->SimPrevX + 
+             (State->SimX - State->SimPrevX) * Alpha / NEKO_SIM_STEP_MS;
+   INT64 Y = State->SimPrevY + 
+             (State->SimY - State->SimPrevY) * Alpha / NEKO_SIM_STEP_MS;
+   State->NekoX = NEKO_SIM_PX(X + NEKO_FP_ONE / 2);
+   State->NekoY = NEKO_SIM_PX(Y + NEKO_FP_ONE / 2);
+   HerdInterpolate(&State->Herd, (INT32)Alpha, NEKO_SIM_STEP_MS);
+
+   return Ticks;
 }
 
-VOID EFIAPI
-NekoHandleKeyEvent(EFI_INPUT_KEY Key, NekoState *State) {
-   switch (Key.UnicodeChar) {
-   case 'q':
-   case 'Q':
-      State->ShouldQuit = TRUE;
-      break;
-   case 'r':
-   case 'R':
-      NekoHardReset(State);
-      break;
-   case 'p':
-   case 'P':
-      State->NekoPaused = TRUE;
-      break;
+// puts the pixels Sprite shows into the skin's atlas, unless they already
+// are. FALSE if there was nothing to do. the raw decode goes with the last.
+static BOOLEAN EFIAPI
+NekoSkinFill(NEKO_SKIN_CACHE *Cache, NEKO_SKIN *Skin, UINTN Sprite) {
+   if (!AtlasFill(&Skin->Atlas, Skin->Anims, Sprite)) {
+      return FALSE;
    }
-}
 
-VOID EFIAPI
-NekoHandleMouseEvent(EFI_SIMPLE_POINTER_STATE Ptr, NekoState *State) {
-   NekoUpdateCursorPos(Ptr, State);
+   if (Skin->Atlas.Pending == 0 && Skin->Rgba != NULL) {
+      lodepng_free(Skin->Rgba);
+      Skin->Rgba = NULL;
+      Skin->Bytes -= Skin->RgbaBytes;
+      Cache->Used -= Skin->RgbaBytes;
+      Skin->RgbaBytes = 0;
+   }
+   return TRUE;
 }
 
+// fills in one outstanding sprite of the active skin. called once per loop
+// iteration so a freshly decoded sheet finishes in the background.
 static VOID EFIAPI
-NekoStrnCpy(CHAR16 *Dest, CONST CHAR16 *Source, UINTN Count) {
-   while (Count > 0 && *Source != L'\0') {
-      *Dest++ = *Source++;
-      Count--;
-   }
-   while (Count > 0) {
-      *Dest++ = L'\0';
-      Count--;
+NekoSkinStep(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_SKIN *Skin = &Cache->Skins[Cache->Active];
+
+   for (UINTN i = 0; i < Skin->Anims->SpriteCount &&
+                     Skin->Atlas.Pending != 0; i++) {
+      if (NekoSkinFill(Cache, Skin, i)) {
+         break;
+      }
    }
 }
 
-static INTN EFIAPI
-NekoStrCmp(CONST CHAR16 *Str1, CONST CHAR16 *Str2) {
-   while (*Str1 && (*Str1 == *Str2)) {
-      Str1++;
-      Str2++;
+// the whole atlas at once, for a herd that is on every sprite at once
+static VOID EFIAPI
+NekoSkinFinish(NEKO_SKIN_CACHE *Cache, NEKO_SKIN *Skin) {
+   for (UINTN i = 0; i < Skin->Anims->SpriteCount; i++) {
+      NekoSkinFill(Cache, Skin, i);
    }
-   return (INTN)(*Str1 - *Str2);
 }
 
-static UINT32 EFIAPI 
-NekoGetArgc(CHAR16 *CmdLine, UINTN CmdLineLength) {
-   UINTN Count = 1;
-   for (UINTN i = 0; i < CmdLineLength; i++) {
-      if (CmdLine[i] == L' ') {
-         Count++;
+static VOID EFIAPI
+NekoSkinRelease(NEKO_SKIN_CACHE *Cache, NEKO_SKIN *Skin) {
+   AtlasFree(&Skin->Atlas);
+   if (Skin->Rgba != NULL) {
+      lodepng_free(Skin->Rgba);
+      Skin->Rgba = NULL;
+   }
+   if (Skin->Anims != NULL) {
+      FreePool(Skin->Anims);
+      Skin->Anims = NULL;
+   }
 
-         while (i < CmdLineLength && CmdLine[i] == L' ') {
-            i++;
+   Cache->Used -= Skin->Bytes;
+   Skin->Bytes = 0;
+   Skin->RgbaBytes = 0;
+}
+
+// drops least recently used skins until Needed more bytes fit the budget.
+// the active skin and Keep are never evicted, so a single oversized sheet is
+// allowed to overshoot the budget rather than fail.
+static VOID EFIAPI
+NekoSkinEvict(NEKO_SKIN_CACHE *Cache, UINTN Needed, NEKO_SKIN *Keep) {
+   while (Cache->Used + Needed > Cache->Budget) {
+      NEKO_SKIN *Victim = NULL;
+
+      for (UINTN i = 0; i < Cache->Count; i++) {
+         NEKO_SKIN *Skin = &Cache->Skins[i];
+         if (i == Cache->Active || Skin == Keep ||
+             Skin->Atlas.Image == NULL) {
+            continue;
          }
+         if (Victim == NULL || Skin->LastUsed < Victim->LastUsed) {
+            Victim = Skin;
+         }
+      }
+
+      if (Victim == NULL) {
+         break;
       }
+
+      NekoSkinRelease(Cache, Victim);
+      Cache->Evictions++;
    }
-   return Count;
 }
 
-static CHAR16** EFIAPI
-NekoGetArgv(CHAR16 *CmdLine, UINTN CmdLineLength, UINTN Argc) {
-   CHAR16 **Argv = AllocateZeroPool((Argc + 1) * sizeof(CHAR16*));
-   if (Argv == NULL) {
-      return NULL;
+// a sheet's manifest is foo.anim next to foo.png
+static EFI_STATUS EFIAPI
+NekoSkinReadManifest(NekoState *State, NEKO_SKIN *Skin, CHAR8 **Text,
+                     UINTN *Size) {
+   if (Skin->Path == NULL) {
+      return EFI_NOT_FOUND;
    }
 
-   UINTN ArgvIdx = 0;
-   UINTN Start = 0;
-   BOOLEAN InArg = FALSE;
+   UINTN Length = StrLen(Skin->Path);
+   UINTN Dot = Length;
+   while (Dot > 0 && Skin->Path[Dot - 1] != L'.' &&
+          Skin->Path[Dot - 1] != L'\\') {
+      Dot--;
+   }
+   Dot = (Dot > 0 && Skin->Path[Dot - 1] == L'.') ? Dot - 1 : Length;
 
-   for (UINTN i = 0; i <= CmdLineLength; i++) {
-      if (CmdLine[i] == L' ' || CmdLine[i] == L'\0') {
-         if (InArg) {
-            UINTN ArgLen = i - Start;
-            Argv[ArgvIdx] = AllocateZeroPool((ArgLen + 1) * sizeof(CHAR16));
-            if (Argv[ArgvIdx] == NULL) {
-               while (ArgvIdx > 0) {
-                  FreePool(Argv[--ArgvIdx]);
-               }
-               FreePool(Argv);
-               return NULL;
-            }
+   UINTN PathSize = (Dot + sizeof(".anim")) * sizeof(CHAR16);
+   CHAR16 *Path = AllocatePool(PathSize);
+   if (Path == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   CopyMem(Path, Skin->Path, Dot * sizeof(CHAR16));
+   StrCpyS(Path + Dot, sizeof(".anim"), L".anim");
+   EFI_STATUS Status = UtLoadFileFromRoot(State->ImageHandle, Path,
+                                          (VOID**)Text, Size);
+   FreePool(Path);
+
+   return Status;
+}
+
+// gives Skin its animations and lays out what they show of Rgba in its
+// atlas, to be filled in from there. a sheet plays its manifest over the
+// built-in animations, or the built-in ones alone without one, or with one
+// that does not compile or has sprites off the sheet.
+static EFI_STATUS EFIAPI
+NekoSkinPack(NekoState *State, NEKO_SKIN *Skin, CONST UINT8 *Rgba,
+             UINTN Width, UINTN Height) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   CHAR8 *Text;
+   UINTN Size;
+   UINTN Line = 0;
+   EFI_STATUS Status;
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter = {
+      .Red = Rgba[0], .Green = Rgba[1], .Blue = Rgba[2], .Reserved = Rgba[3]
+   };
+
+   NEKO_ANIMS *Anims = AllocatePool(sizeof(NEKO_ANIMS));
+   if (Anims == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   Status = NekoSkinReadManifest(State, Skin, &Text, &Size);
+   if (!EFI_ERROR(Status)) {
+      Status = AnimCompile(Anims, Text, Size, &Line);
+      FreePool(Text);
+      if (!EFI_ERROR(Status)) {
+         Status = AtlasBuild(&Skin->Atlas, Anims, Rgba, Width, Height,
+                             Filter);
+      }
+      if (!EFI_ERROR(Status)) {
+         Cache->Manifests++;
+      } else {
+         Cache->BadManifests++;
+         Cache->BadLine = Line;
+      }
+   }
+   if (EFI_ERROR(Status)) {
+      CopyMem(Anims, AnimBuiltin(), sizeof(NEKO_ANIMS));
+      Status = AtlasBuild(&Skin->Atlas, Anims, Rgba, Width, Height, Filter);
+   }
+   if (EFI_ERROR(Status)) {
+      FreePool(Anims);
+      return Status;
+   }
+
+   Skin->Anims = Anims;
+   Skin->Bytes = Skin->Atlas.Width * Skin->Atlas.Height
+               * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL) + sizeof(NEKO_ANIMS);
+   Cache->Used += Skin->Bytes;
+
+   return EFI_SUCCESS;
+}
+
+static EFI_STATUS EFIAPI
+NekoSkinDecode(NekoState *State, NEKO_SKIN *Skin) {
+   EFI_STATUS Status;
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   UINT8 *Png;
+   UINTN PngSize;
+   BOOLEAN MemLoad = FALSE;
+   unsigned char *Rgba = NULL;
+   unsigned int W, H;
+
+   // evicting below, or the reload this is for, may free a sheet the AP
+   // is still drawing from
+   PipeSync(&State->Pipe);
+
+   if (Skin->Path == NULL) {
+      Png = NekoMemPng;
+      PngSize = NekoMemPngLen;
+      MemLoad = TRUE;
+   } else {
+      Status = UtGetFileTimeFromRoot(State->ImageHandle, Skin->Path,
+                                     &Skin->ModTime);
+      FASTFAIL();
+
+      Status = UtLoadFileFromRoot(State->ImageHandle, Skin->Path,
+                                  (VOID**)&Png, &PngSize);
+      FASTFAIL();
+   }
+
+   UINT32 Error = lodepng_decode32(&Rgba, &W, &H, Png, PngSize);
+   if (MemLoad == FALSE) {
+      FreePool(Png);
+   }
+   if (Error) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   // the raw decode stays alive until the last sprite is filled in, and
+   // the atlas is at most about as large
+   UINTN RgbaBytes = W * H * 4;
+   NekoSkinEvict(Cache, 2 * RgbaBytes, Skin);
+
+   Status = NekoSkinPack(State, Skin, Rgba, W, H);
+   if (EFI_ERROR(Status)) {
+      lodepng_free(Rgba);
+      return Status;
+   }
+
+   Skin->Rgba = Rgba;
+   Skin->RgbaBytes = RgbaBytes + sizeof(NEKO_ATLAS_FILL);
+   Skin->Bytes += Skin->RgbaBytes;
+   Cache->Used += Skin->RgbaBytes;
+
+   return EFI_SUCCESS;
+}
+
+// frees whatever of Job was not handed on
+static VOID EFIAPI
+NekoDecodeRelease(NEKO_DECODE_JOB *Job) {
+   if (Job->Rgba != NULL && Job->Arena.Base == NULL) {
+      lodepng_free(Job->Rgba);
+   }
+   Job->Rgba = NULL;
+   MpArenaRelease(&Job->Arena);
+
+   if (Job->Image != NULL) {
+      FreePool(Job->Image);
+      Job->Image = NULL;
+   }
+   if (Job->PngPool) {
+      FreePool(Job->Png);
+      Job->PngPool = FALSE;
+   }
+   Job->Png = NULL;
+}
+
+// reads the image and its header. the header is enough to size the
+// output, and the arena for everything the decode allocates on the way:
+// the compressed data gathered from its chunks, scanlines and the
+// unfiltered image, and the RGBA result.
+static EFI_STATUS EFIAPI
+NekoDecodePrepare(NekoState *State,
+                  NEKO_DECODE_JOB *Job,
+                  CHAR16 *Path,
+                  UINT8 *MemPng,
+                  UINTN MemPngLen) {
+   EFI_STATUS Status;
+   LodePNGState Png;
+   unsigned int W, H;
+
+   ZeroMem(Job, sizeof(NEKO_DECODE_JOB));
+   Job->Path = Path;
+
+   if (Path == NULL) {
+      Job->Png = MemPng;
+      Job->PngSize = MemPngLen;
+   } else {
+      Status = UtGetFileTimeFromRoot(State->ImageHandle, Path,
+                                     &Job->ModTime);
+      FASTFAIL();
+
+      Status = UtLoadFileFromRoot(State->ImageHandle, Path,
+                                  (VOID**)&Job->Png, &Job->PngSize);
+      FASTFAIL();
+      Job->PngPool = TRUE;
+   }
+
+   lodepng_state_init(&Png);
+   UINT32 Error = lodepng_inspect(&W, &H, &Png, Job->Png, Job->PngSize);
+   UINTN Raw = lodepng_get_raw_size(W, H, &Png.info_png.color);
+   lodepng_state_cleanup(&Png);
+   if (Error) {
+      NekoDecodeRelease(Job);
+      return EFI_INVALID_PARAMETER;
+   }
+
+   Job->Width = W;
+   Job->Height = H;
+
+   // without one the job waits for the BSP, which still works
+   if (State->Mp.Processors > 1) {
+      MpArenaInit(&Job->Arena, Job->PngSize + 2 * (Raw + H) + W * H * 4 +
+                               NEKO_ARENA_SLACK);
+   }
+
+   return EFI_SUCCESS;
+}
+
+// runs on any processor, or on the BSP with the arena already released
+static VOID EFIAPI
+NekoDecodeJob(NEKO_DECODE_JOB *Job) {
+   unsigned char *Rgba = NULL;
+   unsigned int W, H;
+
+   Job->Error = lodepng_decode32(&Rgba, &W, &H, Job->Png, Job->PngSize);
+   if (Job->Error) {
+      return;
+   }
+
+   Job->Rgba = Rgba;
+   Job->Filter.Red = Rgba[0];
+   Job->Filter.Green = Rgba[1];
+   Job->Filter.Blue = Rgba[2];
+   Job->Filter.Reserved = Rgba[3];
+}
+
+static VOID EFIAPI
+NekoDecodeTask(VOID *Context, UINTN Index) {
+   NEKO_DECODE_JOB *Job = &((NEKO_DECODE_BATCH*)Context)->Jobs[Index];
+
+   if (Job->Arena.Base == NULL) {
+      return;
+   }
+
+   MpArenaEnter(&Job->Arena);
+   NekoDecodeJob(Job);
+   MpArenaLeave();
+}
+
+static VOID EFIAPI
+NekoConvertTask(VOID *Context, UINTN Index) {
+   NEKO_DECODE_BATCH *Batch = Context;
+   NEKO_DECODE_JOB *Job = NULL;
+
+   // chunks are numbered in job order, skipping the jobs that failed and
+   // those without an Image
+   for (UINTN i = 0; i < Batch->Count; i++) {
+      if (Batch->Jobs[i].Image != NULL && Batch->Jobs[i].FirstChunk <= Index) {
+         Job = &Batch->Jobs[i];
+      }
+   }
+
+   UINTN FirstRow = (Index - Job->FirstChunk) * NEKO_CONVERT_ROWS;
+   UINTN Rows = MIN(NEKO_CONVERT_ROWS, Job->Height - FirstRow);
+   UtRgbaToBlt(&Job->Image[FirstRow * Job->Width],
+               &Job->Rgba[FirstRow * Job->Width * 4],
+               Rows * Job->Width, Job->Filter);
+}
+
+// decodes every prepared job, one per task, then converts those with an
+// Image into it, spread out by rows. a job that failed is left without
+// either.
+static VOID EFIAPI
+NekoDecodeBatch(NekoState *State, NEKO_DECODE_BATCH *Batch) {
+   MpRun(&State->Mp, NekoDecodeTask, Batch, Batch->Count);
+
+   Batch->Chunks = 0;
+   for (UINTN i = 0; i < Batch->Count; i++) {
+      NEKO_DECODE_JOB *Job = &Batch->Jobs[i];
+
+      // there was no arena, or it ran out. the pool is safe again here.
+      if (Job->Arena.Base == NULL || Job->Error == NEKO_PNG_OUT_OF_MEMORY) {
+         MpArenaRelease(&Job->Arena);
+         NekoDecodeJob(Job);
+      }
+      if (Job->Rgba == NULL) {
+         NekoDecodeRelease(Job);
+         continue;
+      }
+      if (Job->Image == NULL) {
+         continue;
+      }
+
+      Job->FirstChunk = Batch->Chunks;
+      Batch->Chunks += (Job->Height + NEKO_CONVERT_ROWS - 1)
+                     / NEKO_CONVERT_ROWS;
+   }
+
+   MpRun(&State->Mp, NekoConvertTask, Batch, Batch->Chunks);
+}
+
+// a skin decoded with the batch is filled in from the job's decode right
+// away, as that goes with the job. one that fails here is decoded again
+// once it is needed.
+static VOID EFIAPI
+NekoSkinAdopt(NekoState *State, NEKO_DECODE_JOB *Job) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_SKIN *Skin = &Cache->Skins[Job->Skin];
+
+   Skin->ModTime = Job->ModTime;
+   Cache->Misses++;
+   if (!EFI_ERROR(NekoSkinPack(State, Skin, Job->Rgba, Job->Width,
+                               Job->Height))) {
+      NekoSkinFinish(Cache, Skin);
+   }
+}
+
+// runs on the AP NekoSkinAhead lent
+static VOID EFIAPI
+NekoDecodeAhead(VOID *Context) {
+   NEKO_DECODE_JOB *Job = Context;
+
+   MpArenaEnter(&Job->Arena);
+   NekoDecodeJob(Job);
+   MpArenaLeave();
+}
+
+// takes in what NekoSkinAhead decoded, unless the skin got there first
+static VOID EFIAPI
+NekoSkinAheadDone(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_DECODE_JOB *Job = &State->Ahead;
+   NEKO_SKIN *Skin = &Cache->Skins[Job->Skin];
+
+   if (Job->Rgba != NULL && Skin->Atlas.Image == NULL) {
+      NekoSkinEvict(Cache, Job->Width * Job->Height
+                           * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL), Skin);
+      NekoSkinAdopt(State, Job);
+      Skin->LastUsed = ++Cache->Clock;
+      Cache->Ahead++;
+   }
+   NekoDecodeRelease(Job);
+}
+
+// decodes the skin n switches to next on a lent AP while the cat goes on
+// here, so the switch finds it in the cache. once per switch, and only
+// with an AP to spare: while the pipeline has it, the switch still stalls
+// on the decode.
+static VOID EFIAPI
+NekoSkinAhead(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_DECODE_JOB *Job = &State->Ahead;
+
+   if (Job->Png != NULL) {
+      if (MpTryJoin(&State->Mp)) {
+         NekoSkinAheadDone(State);
+      }
+      return;
+   }
+   if (!Cache->AheadWanted || State->Mp.Lent) {
+      return;
+   }
+   Cache->AheadWanted = FALSE;
+
+   UINTN Index = (Cache->Active + 1) % Cache->Count;
+   NEKO_SKIN *Skin = &Cache->Skins[Index];
+   if (Index == Cache->Active || Skin->Atlas.Image != NULL ||
+       EFI_ERROR(NekoDecodePrepare(State, Job, Skin->Path, NekoMemPng,
+                                   NekoMemPngLen))) {
+      return;
+   }
+
+   Job->Skin = Index;
+   if (Job->Arena.Base == NULL ||
+       EFI_ERROR(MpSpawn(&State->Mp, NekoDecodeAhead, Job))) {
+      NekoDecodeRelease(Job);
+   }
+}
+
+// the size a herd cat takes up, of a cat and of the herd's dirty squares
+static INT32 EFIAPI
+NekoHerdSize(CONST NEKO_ANIMS *Anims) {
+   return (INT32)MAX(Anims->BoxWidth, Anims->BoxHeight);
+}
+
+static VOID EFIAPI
+NekoSkinBind(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_SKIN *Skin = &Cache->Skins[Cache->Active];
+   CONST NEKO_ANIMS *Old = State->Anims;
+
+   State->SpsImage = Skin->Atlas.Image;
+   State->SpsWidth = Skin->Atlas.Width;
+   State->SpsHeight = Skin->Atlas.Height;
+   State->Anims = Skin->Anims;
+
+   // other sequences start the cats over on them, the same ones only
+   // look different
+   if (Old == NULL || !AnimSameShape(Old, State->Anims)) {
+      AnimStart(State->Anims, &State->Anim, NEKO_ANIM_IDLE, 0);
+   }
+   HerdAnims(&State->Herd, State->Anims);
+   State->Cell = AnimFrame(State->Anims, &State->Anim)->Cell;
+
+   // the current frame is drawable right away, the rest follows in
+   // NekoSkinStep. a herd is on every sprite at once.
+   NekoSkinFill(Cache, Skin, State->Cell);
+   if (State->Herd.Count != 0) {
+      NekoSkinFinish(Cache, Skin);
+   }
+
+   if (Old == NULL || (Old->BoxWidth == State->Anims->BoxWidth &&
+                       Old->BoxHeight == State->Anims->BoxHeight)) {
+      if (State->Herd.Count != 0) {
+         State->Herd.Invalid = TRUE;
+      }
+      return;
+   }
+
+   // a cat of another size clears from where it was only in part
+   UINTN BoxWidth = State->Anims->BoxWidth;
+   UINTN BoxHeight = State->Anims->BoxHeight;
+   if (State->Pipe.Running) {
+      PipeDamageAll(&State->Pipe);
+      State->Damaged = TRUE;
+   } else if (!State->Overlay) {
+      NekoDrawBackground(State);
+   } else if (State->SpriteUnder.Capacity != 0 &&
+              State->SpriteUnder.Capacity < BoxWidth * BoxHeight) {
+      OverlayUnderRestore(&State->Blitter, &State->SpriteUnder);
+      OverlayUnderFree(&State->SpriteUnder);
+      OverlayUnderInit(&State->SpriteUnder, BoxWidth, BoxHeight);
+   }
+
+   // and a herd of them spreads out on a grid of it
+   NEKO_HERD *Herd = &State->Herd;
+   if (Herd->Count != 0 && Herd->Size != NekoHerdSize(State->Anims)) {
+      UINTN Count = Herd->Count;
+
+      HerdFree(Herd);
+      if (EFI_ERROR(HerdInit(Herd, Count, State->ScrX, State->ScrY,
+                             NekoHerdSize(State->Anims), NEKO_SPEED,
+                             NEKO_NEAR_DIST, State->TickSteps, State->Anims,
+                             &State->Mp))) {
+         HerdFree(Herd);
+      }
+   }
+   State->Herd.Invalid = TRUE;
+}
+
+static EFI_STATUS EFIAPI
+NekoSkinActivate(NekoState *State, UINTN Index) {
+   EFI_STATUS Status;
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_SKIN *Skin = &Cache->Skins[Index];
+
+   // one on its way is nearer done than one started over
+   if (State->Ahead.Png != NULL && State->Ahead.Skin == Index) {
+      MpJoin(&State->Mp);
+      NekoSkinAheadDone(State);
+   }
+
+   if (Skin->Atlas.Image != NULL) {
+      Cache->Hits++;
+   } else {
+      Cache->Misses++;
+      Status = NekoSkinDecode(State, Skin);
+      FASTFAIL();
+   }
+
+   Skin->LastUsed = ++Cache->Clock;
+   Cache->Active = Index;
+   Cache->PollTicks = 0;
+   Cache->AheadWanted = TRUE;
+   NekoSkinBind(State);
+
+   return EFI_SUCCESS;
+}
+
+static VOID EFIAPI
+NekoSkinNext(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+
+   for (UINTN i = 1; i < Cache->Count; i++) {
+      UINTN Index = (Cache->Active + i) % Cache->Count;
+      if (!EFI_ERROR(NekoSkinActivate(State, Index))) {
+         return;
+      }
+   }
+}
+
+// reloads the active skin in place once its file has been modified. called
+// on the animation tick with the number of ticks it covers; the file system
+// is only touched every NEKO_SKIN_POLL_TICKS ticks.
+static VOID EFIAPI
+NekoSkinPoll(NekoState *State, UINTN Ticks) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_SKIN *Skin = &Cache->Skins[Cache->Active];
+   EFI_TIME ModTime;
+
+   Cache->PollTicks += Ticks;
+   if (Cache->PollTicks < NEKO_SKIN_POLL_TICKS) {
+      return;
+   }
+   Cache->PollTicks = 0;
+
+   if (Skin->Path == NULL || Skin->Atlas.Image == NULL) {
+      return;
+   }
+
+   if (EFI_ERROR(UtGetFileTimeFromRoot(State->ImageHandle, Skin->Path,
+                                       &ModTime))) {
+      return;
+   }
+   if (CompareMem(&ModTime, &Skin->ModTime, sizeof(EFI_TIME)) == 0) {
+      return;
+   }
+
+   NEKO_SKIN Fresh = { 0 };
+   Fresh.Path = Skin->Path;
+   if (EFI_ERROR(NekoSkinDecode(State, &Fresh))) {
+      // most likely caught mid-write; retry once the time stamp moves again
+      Skin->ModTime = ModTime;
+      return;
+   }
+
+   // the cats are on the old animations until bound to the new ones
+   NEKO_SKIN Stale = *Skin;
+   Fresh.LastUsed = Skin->LastUsed;
+   *Skin = Fresh;
+   Cache->Reloads++;
+
+   NekoSkinBind(State);
+   NekoSkinRelease(Cache, &Stale);
+}
+
+static VOID EFIAPI
+NekoSkinFreeAll(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+
+   for (UINTN i = 0; i < Cache->Count; i++) {
+      NekoSkinRelease(Cache, &Cache->Skins[i]);
+      if (Cache->Skins[i].Path != NULL && i != 0) {
+         FreePool(Cache->Skins[i].Path);
+      }
+      Cache->Skins[i].Path = NULL;
+   }
+   Cache->Count = 0;
+}
+
+VOID EFIAPI
+NekoDrawSprite(NekoState *State) {
+   CONST NEKO_ANIM_SPRITE *Sprite = &State->Anims->Sprites[State->Cell];
+
+   NekoSkinFill(&State->SkinCache,
+                &State->SkinCache.Skins[State->SkinCache.Active], State->Cell);
+
+   if (State->Overlay) {
+      // the cursor was saved on top of the sprite, so it comes off first.
+      // NekoRender always draws it again afterwards.
+      OverlayUnderRestore(&State->Blitter, &State->CursorUnder);
+      OverlayUnderRestore(&State->Blitter, &State->SpriteUnder);
+      OverlayUnderDraw(&State->Blitter, &State->SpriteUnder,
+                       State->SpsImage, State->SpsWidth,
+                       Sprite->SrcX, Sprite->SrcY,
+                       State->NekoX + Sprite->OffX,
+                       State->NekoY + Sprite->OffY,
+                       Sprite->Width, Sprite->Height);
+   } else {
+      EFI_GRAPHICS_OUTPUT_BLT_PIXEL Blk = {0, 0, 0, 0};
+      BlitFill(&State->Blitter, Blk,
+               State->NekoXPrev, State->NekoYPrev,
+               NEKO_BOX_WIDTH(State), NEKO_BOX_HEIGHT(State));
+
+      BlitDraw(&State->Blitter, State->SpsImage, State->SpsWidth,
+               Sprite->SrcX, Sprite->SrcY,
+               State->NekoX + Sprite->OffX, State->NekoY + Sprite->OffY,
+               Sprite->Width, Sprite->Height);
+   }
+
+   State->NekoXPrev = State->NekoX;
+   State->NekoYPrev = State->NekoY;
+}
+
+static BOOLEAN EFIAPI
+NekoOverlaps(INT32 X1, INT32 Y1, INT32 W1, INT32 H1,
+             INT32 X2, INT32 Y2, INT32 W2, INT32 H2) {
+   return X1 < X2 + W2 && X2 < X1 + W1 && Y1 < Y2 + H2 && Y2 < Y1 + H1;
+}
+
+// the herd, the main cat and the cursor in one go, so erasing any of them
+// never leaves a hole in another. only what HerdPlan found is touched; the
+// herd goes bottom most, in atlas frame order. the main cat and the cursor
+// are drawn again when they changed or a cat under them was.
+static VOID EFIAPI
+NekoDrawHerd(NekoState *State) {
+   NEKO_HERD *Herd = &State->Herd;
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL Blk = {0, 0, 0, 0};
+   BOOLEAN Sprite = Herd->Invalid || State->Damaged ||
+                    State->NekoX != State->NekoXPrev ||
+                    State->NekoY != State->NekoYPrev ||
+                    State->Cell != State->CellPrev;
+   BOOLEAN Cursor = State->DrawCursor &&
+                    (Herd->Invalid || State->PtrX != State->PtrXPrev ||
+                     State->PtrY != State->PtrYPrev);
+
+   if (Sprite) {
+      HerdMarkDirty(Herd, State->NekoXPrev, State->NekoYPrev,
+                    NEKO_BOX_WIDTH(State), NEKO_BOX_HEIGHT(State));
+   }
+   if (Cursor) {
+      HerdMarkDirty(Herd, State->PtrXPrev, State->PtrYPrev,
+                    (INT32)State->CursorWidth, (INT32)State->CursorHeight);
+   }
+   UINTN Count = HerdPlan(Herd);
+
+   for (UINTN k = 0; k < Herd->ChangedCount; k++) {
+      UINT32 i = Herd->Changed[k];
+
+      if (Herd->DrawnCell[i] != NEKO_HERD_UNDRAWN) {
+         BlitFill(&State->Blitter, Blk, Herd->DrawnX[i], Herd->DrawnY[i],
+                  Herd->Size, Herd->Size);
+      }
+   }
+   if (Sprite) {
+      BlitFill(&State->Blitter, Blk, State->NekoXPrev, State->NekoYPrev,
+               NEKO_BOX_WIDTH(State), NEKO_BOX_HEIGHT(State));
+   }
+   if (Cursor) {
+      BlitFill(&State->Blitter, Blk, State->PtrXPrev, State->PtrYPrev,
+               State->CursorWidth, State->CursorHeight);
+   }
+
+   for (UINTN k = 0; k < Count; k++) {
+      UINT32 i = Herd->Order[k];
+      CONST NEKO_ANIM_SPRITE *Cell = &State->Anims->Sprites[Herd->Cell[i]];
+
+      BlitDraw(&State->Blitter, State->SpsImage, State->SpsWidth,
+               Cell->SrcX, Cell->SrcY,
+               Herd->DrawX[i] + Cell->OffX, Herd->DrawY[i] + Cell->OffY,
+               Cell->Width, Cell->Height);
+   }
+
+   // unchanged, the main cat is still where it was drawn last
+   Sprite |= HerdTouches(Herd, State->NekoX, State->NekoY,
+                         NEKO_BOX_WIDTH(State), NEKO_BOX_HEIGHT(State));
+   Cursor |= State->DrawCursor &&
+             (HerdTouches(Herd, State->PtrX, State->PtrY,
+                          (INT32)State->CursorWidth,
+                          (INT32)State->CursorHeight) ||
+              (Sprite && NekoOverlaps(State->NekoX, State->NekoY,
+                                      NEKO_BOX_WIDTH(State),
+                                      NEKO_BOX_HEIGHT(State),
+                                      State->PtrX, State->PtrY,
+                                      (INT32)State->CursorWidth,
+                                      (INT32)State->CursorHeight)));
+   HerdCommit(Herd);
+
+   if (Sprite) {
+      CONST NEKO_ANIM_SPRITE *Cell = &State->Anims->Sprites[State->Cell];
+
+      NekoSkinFill(&State->SkinCache,
+                   &State->SkinCache.Skins[State->SkinCache.Active],
+                   State->Cell);
+      BlitDraw(&State->Blitter, State->SpsImage, State->SpsWidth,
+               Cell->SrcX, Cell->SrcY,
+               State->NekoX + Cell->OffX, State->NekoY + Cell->OffY,
+               Cell->Width, Cell->Height);
+   }
+   State->NekoXPrev = State->NekoX;
+   State->NekoYPrev = State->NekoY;
+   State->CellPrev = State->Cell;
+
+   if (Cursor) {
+      BlitDraw(&State->Blitter, State->CursorImage, State->CursorWidth, 0, 0,
+               State->PtrX, State->PtrY,
+               State->CursorWidth, State->CursorHeight);
+   }
+   State->PtrXPrev = State->PtrX;
+   State->PtrYPrev = State->PtrY;
+}
+
+// puts the cat back in its starting corner and repaints the screen, unless
+// it is someone else's
+VOID EFIAPI
+NekoHardReset(NekoState *State) {
+   State->NekoX = 0;
+   State->NekoY = 0;
+   State->NekoXPrev = 0;
+   State->NekoYPrev = 0;
+   State->SimX = 0;
+   State->SimY = 0;
+   State->SimPrevX = 0;
+   State->SimPrevY = 0;
+   ZeroMem(&State->Anim, sizeof(NEKO_ANIM_STATE));
+   State->NekoPaused = FALSE;
+   State->PtrScale.RemX = 0;
+   State->PtrScale.RemY = 0;
+
+   if (State->Pipe.Running) {
+      PipeDamageAll(&State->Pipe);
+      State->Damaged = TRUE;
+   } else if (!State->Overlay) {
+      NekoDrawBackground(State);
+      State->Herd.Invalid = TRUE;
+   }
+}
+
+VOID EFIAPI
+NekoHandleKeyEvent(EFI_INPUT_KEY Key, NekoState *State) {
+   switch (Key.UnicodeChar) {
+   case 'q':
+   case 'Q':
+      State->ShouldQuit = TRUE;
+      break;
+   case 'r':
+   case 'R':
+      NekoHardReset(State);
+      break;
+   case 'p':
+   case 'P':
+      State->NekoPaused = !State->NekoPaused;
+      break;
+   case 'n':
+   case 'N':
+      NekoSkinNext(State);
+      break;
+   }
+}
+
+// a button going down clicks where the cursor's tip ends up: the left one
+// startles the herd cats under it, the right one puts them to sleep
+VOID EFIAPI
+NekoHandleMouseEvent(NEKO_POINTER_INPUT *Input, NekoState *State) {
+   NekoUpdateCursorPos(Input, State);
+
+   if (Input->LeftButton && !State->LeftButtonPrev) {
+      HerdPoke(&State->Herd, State->PtrX, State->PtrY,
+               NEKO_HERD_POKE_STARTLE);
+   }
+   if (Input->RightButton && !State->RightButtonPrev) {
+      HerdPoke(&State->Herd, State->PtrX, State->PtrY, NEKO_HERD_POKE_SLEEP);
+   }
+   State->LeftButtonPrev = Input->LeftButton;
+   State->RightButtonPrev = Input->RightButton;
+}
+
+// drains the samples taken since the last wakeup. pointer samples are
+// merged so the cursor moves once however many arrived; keys are handled
+// in the order they were typed.
+static VOID EFIAPI
+NekoDrainInput(NekoState *State) {
+   NEKO_INPUT_SAMPLE Sample;
+   NEKO_POINTER_INPUT Motion;
+   BOOLEAN Moved = FALSE;
+   UINT64 Now = ClkTicks();
+
+   ZeroMem(&Motion, sizeof(Motion));
+   while (InputPop(&State->Input, &Sample)) {
+      State->InputLatency = MAX(State->InputLatency, Now - Sample.Time);
+
+      if (Sample.Type == NEKO_SAMPLE_KEY) {
+         NekoHandleKeyEvent(Sample.Key, State);
+         continue;
+      }
+
+      if (State->InputPending == 0) {
+         State->InputPending = Sample.Time;
+      }
+      Motion.Dx += Sample.Pointer.Dx;
+      Motion.Dy += Sample.Pointer.Dy;
+      if (Sample.Pointer.HasAbsolute) {
+         Motion.HasAbsolute = TRUE;
+         Motion.AbsX = Sample.Pointer.AbsX;
+         Motion.AbsY = Sample.Pointer.AbsY;
+      }
+      Motion.LeftButton |= Sample.Pointer.LeftButton;
+      Motion.RightButton |= Sample.Pointer.RightButton;
+      Moved = TRUE;
+   }
+
+   if (Moved) {
+      NekoHandleMouseEvent(&Motion, State);
+   }
+}
+
+// the pipelined NekoDrawSprite and NekoDrawCursor. the AP works out what
+// has to be cleared from what it drew last.
+static VOID EFIAPI
+NekoPipeFrame(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   CONST NEKO_ANIM_SPRITE *Sprite = &State->Anims->Sprites[State->Cell];
+   NEKO_FRAME Frame;
+
+   NekoSkinFill(Cache, &Cache->Skins[Cache->Active], State->Cell);
+
+   ZeroMem(&Frame, sizeof(Frame));
+   Frame.Layers[Frame.LayerCount++] = (NEKO_LAYER) {
+      .Src = State->SpsImage,
+      .SrcWidth = State->SpsWidth,
+      .SrcX = Sprite->SrcX,
+      .SrcY = Sprite->SrcY,
+      .X = State->NekoX + Sprite->OffX,
+      .Y = State->NekoY + Sprite->OffY,
+      .Width = Sprite->Width,
+      .Height = Sprite->Height,
+   };
+   if (State->DrawCursor) {
+      Frame.Layers[Frame.LayerCount++] = (NEKO_LAYER) {
+         .Src = State->CursorImage,
+         .SrcWidth = State->CursorWidth,
+         .X = State->PtrX,
+         .Y = State->PtrY,
+         .Width = State->CursorWidth,
+         .Height = State->CursorHeight,
+      };
+   }
+   Frame.InputTime = State->InputPending;
+   PipePublish(&State->Pipe, &Frame);
+   State->InputPending = 0;
+
+   State->NekoXPrev = State->NekoX;
+   State->NekoYPrev = State->NekoY;
+   State->PtrXPrev = State->PtrX;
+   State->PtrYPrev = State->PtrY;
+}
+
+// number of animation ticks until the next one that can change anything,
+// 0 if none will. only a settled idle cat skips ticks: its frame cannot
+// change before Duration runs out and it does not move.
+static UINTN EFIAPI
+NekoTicksToDeadline(NekoState *State) {
+   INT32 Dx;
+   INT32 Dy;
+
+   if (State->NekoPaused) {
+      return 0;
+   }
+   // NekoSkinStep finishes a fresh sheet one sprite per wakeup
+   if (State->SkinCache.Skins[State->SkinCache.Active].Atlas.Pending != 0) {
+      return 1;
+   }
+   // a herd's parked cats wake up as their frames run out
+   UINTN Herd = HerdTicksToDeadline(&State->Herd);
+   if (Herd == 1) {
+      return 1;
+   }
+   if (State->Anim.Sequence != NEKO_ANIM_IDLE ||
+       NekoCursorDist(State, &Dx, &Dy) > NEKO_NEAR_DIST) {
+      return 1;
+   }
+
+   CONST NEKO_ANIM_FRAME *Frame = AnimFrame(State->Anims, &State->Anim);
+   UINTN Ticks = Frame->Duration > State->Anim.Elapsed
+               ? Frame->Duration - State->Anim.Elapsed : 1;
+   return Herd != 0 ? MIN(Ticks, Herd) : Ticks;
+}
+
+// arms the one-shot TickEvent for the next time there is something new to
+// draw: NEKO_RENDER_MS while the cat runs, otherwise the step that runs
+// the next tick able to change its frame. nothing at all while paused.
+static VOID EFIAPI
+NekoSchedule(NekoState *State) {
+   UINTN Ticks = NekoTicksToDeadline(State);
+
+   if (Ticks == 0) {
+      gBS->SetTimer(State->TickEvent, TimerCancel, 0);
+      return;
+   }
+
+   // steps still to go in this tick, then the step that runs the next one
+   UINT64 Steps = (State->TickSteps - State->StepInTick) % State->TickSteps;
+   UINT64 Ms = (Steps + 1) * NEKO_SIM_STEP_MS - State->SimAcc 
+             + (Ticks - 1) * State->TickSteps * NEKO_SIM_STEP_MS;
+
+   // in between frames are only worth a wakeup if they get drawn
+   if ((State->Moving || State->Herd.Moving != 0) &&
+       State->Budget.Level == NEKO_DEGRADE_NONE) {
+      Ms = MIN(Ms, NEKO_RENDER_MS);
+   }
+   if (State->Budget.CursorPending) {
+      Ms = MIN(Ms, NEKO_RENDER_MS);
+   }
+   gBS->SetTimer(State->TickEvent, TimerRelative, MultU64x32(Ms, 10000));
+}
+
+static VOID EFIAPI
+NekoBudgetFeed(NEKO_FRAME_BUDGET *Budget, UINT64 Us) {
+   Budget->AvgUs = (Budget->AvgUs * 7 + Us) / 8;
+   Budget->MaxUs = MAX(Budget->MaxUs, Us);
+   Budget->Frames++;
+   if (Us > Budget->LimitUs) {
+      Budget->Overruns++;
+   }
+
+   if (Budget->AvgUs > Budget->LimitUs) {
+      Budget->Under = 0;
+      if (++Budget->Over >= NEKO_DEGRADE_AFTER &&
+          Budget->Level < NEKO_DEGRADE_COUNT - 1) {
+         Budget->Level++;
+         Budget->Degrades++;
+         Budget->Over = 0;
+      }
+   } else if (Budget->AvgUs < Budget->LimitUs / 2) {
+      Budget->Over = 0;
+      if (++Budget->Under >= NEKO_RECOVER_AFTER &&
+          Budget->Level > NEKO_DEGRADE_NONE) {
+         Budget->Level--;
+         Budget->Recoveries++;
+         Budget->Under = 0;
+      }
+   } else {
+      Budget->Over = 0;
+      Budget->Under = 0;
+   }
+}
+
+// draws as much as the degradation level allows and feeds the time it
+// took back into the budget. the cursor is never held back by more than
+// NEKO_RENDER_MS, whatever the level, so input stays responsive.
+static VOID EFIAPI
+NekoRender(NekoState *State, UINTN Ticks) {
+   NEKO_FRAME_BUDGET *Budget = &State->Budget;
+   UINT64 Now = ClkNowMs();
+   BOOLEAN Sprite;
+   BOOLEAN Cursor = State->PtrX != State->PtrXPrev || 
+                    State->PtrY != State->PtrYPrev ||
+                    Budget->CursorPending;
+
+   Budget->Ticks += Ticks;
+   switch (Budget->Level) {
+   case NEKO_DEGRADE_NONE:
+      Sprite = TRUE;
+      break;
+   case NEKO_DEGRADE_SKIP:
+   case NEKO_DEGRADE_MERGE:
+      Sprite = Budget->Ticks != 0;
+      break;
+   default:
+      Sprite = Budget->Ticks >= NEKO_SLOW_TICKS;
+      break;
+   }
+   // the host drew over the cats, or the herd has to be drawn anew,
+   // however degraded we are
+   Sprite |= State->Damaged || State->Herd.Invalid;
+
+   if (Cursor && !Sprite && Budget->Level >= NEKO_DEGRADE_MERGE &&
+       Now - Budget->CursorDrawn < NEKO_RENDER_MS) {
+      Budget->CursorPending = TRUE;
+      Cursor = FALSE;
+   }
+
+   // erasing the old cursor would punch a hole into a sprite left alone
+   if (Cursor && !Sprite) {
+      Sprite = NekoOverlaps(State->PtrXPrev, State->PtrYPrev,
+                            State->CursorWidth, State->CursorHeight,
+                            State->NekoXPrev, State->NekoYPrev,
+                            NEKO_BOX_WIDTH(State), NEKO_BOX_HEIGHT(State)) ||
+               HerdDrawnUnder(&State->Herd, State->PtrXPrev, State->PtrYPrev,
+                              (INT32)State->CursorWidth,
+                              (INT32)State->CursorHeight);
+   }
+   // and a redrawn sprite may cover the cursor
+   Cursor |= Sprite;
+
+   if (!Sprite && !Cursor) {
+      return;
+   }
+
+   UINT64 Start = ClkTicks();
+   if (State->FirstFrameUs == 0 && Sprite) {
+      State->FirstFrameUs = ClkTicksToUs(Start - State->LaunchStart);
+   }
+   if (State->Pipe.Running) {
+      NekoPipeFrame(State);
+      Budget->Ticks = 0;
+      State->Damaged = FALSE;
+   } else {
+      if (State->Herd.Count != 0 && Sprite) {
+         NekoDrawHerd(State);
+         Budget->Ticks = 0;
+         State->Damaged = FALSE;
+      } else {
+         if (Sprite) {
+            NekoDrawSprite(State);
+            Budget->Ticks = 0;
+            State->Damaged = FALSE;
+         }
+         NekoDrawCursor(State);
+      }
+      if (State->InputPending != 0) {
+         PipeLatencyFeed(&State->Latency,
+                         ClkTicksToUs(ClkTicks() - State->InputPending));
+         State->InputPending = 0;
+      }
+   }
+   Budget->CursorDrawn = Now;
+   Budget->CursorPending = FALSE;
+
+   NekoBudgetFeed(Budget, ClkTicksToUs(ClkTicks() - Start));
+}
+
+// hotkeys are notified and left in the console buffer, with every other
+// key. a cat on its own owns the console, so it empties that, or the keys
+// pile up there and reach the Shell once it quits.
+static VOID EFIAPI
+NekoFlushConIn(NekoState *State) {
+   EFI_INPUT_KEY Key;
+
+   if (State->Input.HotkeyCount == 0) {
+      return;
+   }
+   for (UINTN i = 0; i < NEKO_INPUT_RING_SIZE; i++) {
+      if (gST->ConIn->ReadKeyStroke(gST->ConIn, &Key) != EFI_SUCCESS) {
+         break;
+      }
+   }
+}
+
+// keeps a one second window of wakeups so the tickless effect shows up
+static VOID EFIAPI
+NekoCountWakeup(NekoState *State) {
+   UINT64 Now = ClkTicks();
+   UINT64 Us = ClkTicksToUs(Now - State->WindowStart);
+
+   State->Wakeups++;
+   if (Us >= 1000000) {
+      UINT64 Total = State->Wakeups + State->Input.Wakeups;
+      State->WakeupRate = DivU64x64Remainder(
+         MultU64x32(Total - State->WindowWakeups, 1000000), Us, NULL);
+      State->WindowWakeups = Total;
+      State->WindowStart = Now;
+   }
+}
+
+static VOID EFIAPI
+NekoStrnCpy(CHAR16 *Dest, CONST CHAR16 *Source, UINTN Count) {
+   while (Count > 0 && *Source != L'\0') {
+      *Dest++ = *Source++;
+      Count--;
+   }
+   while (Count > 0) {
+      *Dest++ = L'\0';
+      Count--;
+   }
+}
+
+static INTN EFIAPI
+NekoStrCmp(CONST CHAR16 *Str1, CONST CHAR16 *Str2) {
+   while (*Str1 && (*Str1 == *Str2)) {
+      Str1++;
+      Str2++;
+   }
+   return (INTN)(*Str1 - *Str2);
+}
+
+static UINT32 EFIAPI 
+NekoGetArgc(CHAR16 *CmdLine, UINTN CmdLineLength) {
+   UINTN Count = 1;
+   for (UINTN i = 0; i < CmdLineLength; i++) {
+      if (CmdLine[i] == L' ') {
+         Count++;
+
+         while (i < CmdLineLength && CmdLine[i] == L' ') {
+            i++;
+         }
+      }
+   }
+   return Count;
+}
+
+static CHAR16** EFIAPI
+NekoGetArgv(CHAR16 *CmdLine, UINTN CmdLineLength, UINTN Argc) {
+   CHAR16 **Argv = AllocateZeroPool((Argc + 1) * sizeof(CHAR16*));
+   if (Argv == NULL) {
+      return NULL;
+   }
+
+   UINTN ArgvIdx = 0;
+   UINTN Start = 0;
+   BOOLEAN InArg = FALSE;
+
+   for (UINTN i = 0; i <= CmdLineLength; i++) {
+      if (CmdLine[i] == L' ' || CmdLine[i] == L'\0') {
+         if (InArg) {
+            UINTN ArgLen = i - Start;
+            Argv[ArgvIdx] = AllocateZeroPool((ArgLen + 1) * sizeof(CHAR16));
+            if (Argv[ArgvIdx] == NULL) {
+               while (ArgvIdx > 0) {
+                  FreePool(Argv[--ArgvIdx]);
+               }
+               FreePool(Argv);
+               return NULL;
+            }
+
+            NekoStrnCpy(Argv[ArgvIdx], CmdLine + Start, ArgLen);
+            Argv[ArgvIdx][ArgLen] = L'\0';
+
+            ArgvIdx++;
+            InArg = FALSE;
+         }
+
+         while (CmdLine[i] == L' ') {
+            i++;
+         }
+
+         Start = i;
+      }
+
+      if (CmdLine[i] != L' ' && CmdLine[i] != L'\0') {
+         if (!InArg) {
+            Start = i;
+            InArg = TRUE;
+         }
+      }
+   }
+
+   return Argv;
+}
+
+static EFI_STATUS EFIAPI
+NekoParseCommandLine(EFI_HANDLE ImageHandle, UINTN *Argc, CHAR16 ***Argv) {
+   EFI_STATUS Status;
+   EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+
+   Status = gBS->HandleProtocol(
+         ImageHandle,
+         &gEfiLoadedImageProtocolGuid,
+         (VOID**)&LoadedImage
+   );
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   CHAR16 *LoadOptions = (CHAR16*)LoadedImage->LoadOptions;
+   UINTN LoadOptionsSize = LoadedImage->LoadOptionsSize;
+
+   *Argc = NekoGetArgc(LoadOptions, LoadOptionsSize);
+   *Argv = NekoGetArgv(LoadOptions, LoadOptionsSize, *Argc);
+
+   return EFI_SUCCESS;
+}
+
+static VOID EFIAPI
+NekoInitDefaultState(EFI_HANDLE ImageHandle, NekoState *State) {
+   State->Cell = 0;
+   State->CellPrev = 0;
+   State->PtrX = 0;
+   State->PtrY = 0;
+   State->PtrXPrev = 0;
+   State->PtrYPrev = 0;
+   State->NekoX = 0;
+   State->NekoY = 0;
+   State->NekoXPrev = 0;
+   State->NekoYPrev = 0;
+   State->ShouldQuit = FALSE;
+   State->NekoPaused = FALSE;
+   State->DrawCursor = TRUE;
+   State->TickSteps = NEKO_TICK_STEPS;
+   State->Budget.LimitUs = NEKO_FRAME_BUDGET_US;
+   State->SkinCache.Budget = NEKO_SKIN_BUDGET;
+   State->ImageHandle = ImageHandle;
+
+   ClkInit();
+   State->LaunchStart = ClkTicks();
+}
+
+static BOOLEAN EFIAPI
+NekoHasFlag(UINTN Argc, CHAR16 **Argv, CONST CHAR16 *Flag) {
+   for (UINTN i = 0; i < Argc; i++) {
+      if (NekoStrCmp(Argv[i], Flag) == 0) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+// the value following Short or Long, NULL if neither is given
+static CHAR16* EFIAPI
+NekoGetOption(UINTN Argc, CHAR16 **Argv, CONST CHAR16 *Short,
+              CONST CHAR16 *Long) {
+   CHAR16 *Value = NULL;
+
+   for (UINTN i = 0; i < Argc; i++) {
+      if (Argv[i + 1] == NULL) {
+         continue;
+      }
+      if ((Short != NULL && NekoStrCmp(Argv[i], Short) == 0) ||
+          NekoStrCmp(Argv[i], Long) == 0) {
+         Value = Argv[i + 1];
+      }
+   }
+   return Value;
+}
+
+// --mode keep | WxH | max, --max-pixels N bounds "max" (default: no bound)
+static VOID EFIAPI
+NekoParseGopPolicy(UINTN Argc, CHAR16 **Argv, NEKO_GOP_CONFIG *Config) {
+   Config->Policy = NEKO_GOP_KEEP;
+   Config->PixelBudget = MAX_UINTN;
+
+   for (UINTN i = 0; i < Argc; i++) {
+      if (Argv[i + 1] == NULL) {
+         continue;
+      }
+
+      if (NekoStrCmp(Argv[i], L"-m") == 0 ||
+          NekoStrCmp(Argv[i], L"--mode") == 0) {
+         CHAR16 *Value = Argv[i + 1];
+
+         if (NekoStrCmp(Value, L"keep") == 0) {
+            Config->Policy = NEKO_GOP_KEEP;
+         } else if (NekoStrCmp(Value, L"max") == 0) {
+            Config->Policy = NEKO_GOP_BUDGET;
+         } else {
+            CHAR16 *Sep = Value;
+            while (*Sep != L'\0' && *Sep != L'x' && *Sep != L'X') {
+               Sep++;
+            }
+            if (*Sep != L'\0') {
+               Config->Policy = NEKO_GOP_PREFERRED;
+               Config->PreferredWidth = (UINT32)StrDecimalToUintn(Value);
+               Config->PreferredHeight = (UINT32)StrDecimalToUintn(Sep + 1);
+            }
+         }
+      } else if (NekoStrCmp(Argv[i], L"--max-pixels") == 0) {
+         Config->PixelBudget = StrDecimalToUintn(Argv[i + 1]);
+      }
+   }
+}
+
+// --pointer-travel <mm> to sweep the screen, --pointer-accel <percent>
+static EFI_STATUS EFIAPI
+NekoInitPointers(UINTN Argc, CHAR16 **Argv, NekoState *State) {
+   UINTN TravelMm = 0;
+   UINTN Accel = 0;
+
+   for (UINTN i = 0; i < Argc; i++) {
+      if (Argv[i + 1] == NULL) {
+         continue;
+      }
+
+      if (NekoStrCmp(Argv[i], L"--pointer-travel") == 0) {
+         TravelMm = StrDecimalToUintn(Argv[i + 1]);
+      } else if (NekoStrCmp(Argv[i], L"--pointer-accel") == 0) {
+         Accel = StrDecimalToUintn(Argv[i + 1]);
+      }
+   }
+
+   State->PtrScale.RemX = 0;
+   State->PtrScale.RemY = 0;
+   State->PtrScale.Accel = Accel;
+
+   return PointerInit(&State->Pointers, State->ScrX, State->ScrY, TravelMm);
+}
+
+// skin 0 is the sheet the caller gave, or the built-in one. the rest are
+// whatever SPRITE_DIRECTORY holds.
+static VOID EFIAPI
+NekoListSkins(NekoState *State, CHAR16 *SpriteSheetPath) {
+   EFI_STATUS Status;
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   CHAR16 **Names;
+   UINTN NameCount;
+
+   Cache->Skins[0].Path = SpriteSheetPath;
+   Cache->Count = 1;
+
+   Status = UtListDirectoryFromRoot(State->ImageHandle, SPRITE_DIRECTORY,
+                                    L".png", &Names, &NameCount);
+   if (EFI_ERROR(Status)) {
+      return;
+   }
+
+   for (UINTN i = 0; i < NameCount; i++) {
+      if (Cache->Count < NEKO_SKIN_MAX) {
+         Cache->Skins[Cache->Count++].Path = Names[i];
+      } else {
+         FreePool(Names[i]);
+      }
+   }
+   FreePool(Names);
+}
+
+// fills Batch with the cursor, the sheet and, for processors that would
+// otherwise sit idle, the next skins as far as they fit the budget. a
+// cursor file that cannot be read falls back to the built-in one.
+static EFI_STATUS EFIAPI
+NekoPlanAssets(NekoState *State, EFINEKO_SETUP *Setup,
+               NEKO_DECODE_BATCH *Batch) {
+   EFI_STATUS Status;
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_DECODE_JOB *Job = &Batch->Jobs[Batch->Count];
+
+   Status = EFI_NOT_FOUND;
+   if (Setup->CursorPath != NULL) {
+      Status = NekoDecodePrepare(State, Job, Setup->CursorPath, NULL, 0);
+   }
+   if (EFI_ERROR(Status)) {
+      Status = NekoDecodePrepare(State, Job, NULL, CursorMemPng,
+                                 CursorMemPngLen);
+      FASTFAIL();
+   }
+   // the cursor is drawn from whole, the skins only from their atlas
+   Job->Image = AllocatePool(Job->Width * Job->Height
+                             * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   if (Job->Image == NULL) {
+      NekoDecodeRelease(Job);
+      return EFI_OUT_OF_RESOURCES;
+   }
+   Batch->Count++;
 
-            NekoStrnCpy(Argv[ArgvIdx], CmdLine + Start, ArgLen);
-            Argv[ArgvIdx][ArgLen] = L'\0';
+   UINTN Planned = 0;
+   for (UINTN i = 0; i < Cache->Count; i++) {
+      if (i > 0 && Batch->Count >= State->Mp.Processors) {
+         break;
+      }
 
-            ArgvIdx++;
-            InArg = FALSE;
-         }
+      Job = &Batch->Jobs[Batch->Count];
+      if (EFI_ERROR(NekoDecodePrepare(State, Job, Cache->Skins[i].Path,
+                                      NekoMemPng, NekoMemPngLen))) {
+         continue;
+      }
 
-         while (CmdLine[i] == L' ') {
-            i++;
-         }
+      // the sheet is needed whatever its size
+      UINTN Bytes = Job->Width * Job->Height
+                  * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL);
+      if (i > 0 && Planned + Bytes > Cache->Budget) {
+         NekoDecodeRelease(Job);
+         break;
+      }
 
-         Start = i;
+      Planned += Bytes;
+      Job->Skin = i;
+      Batch->Count++;
+   }
+
+   return EFI_SUCCESS;
+}
+
+// what NekoMain and EfiNekoInit share once the screen and the pointers are
+// set up. the skin cache's Budget has to be set before.
+static EFI_STATUS EFIAPI
+NekoLoadAssets(NekoState *State, EFINEKO_SETUP *Setup) {
+   EFI_STATUS Status;
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   UINT64 Start = ClkTicks();
+
+   NEKO_DECODE_BATCH *Batch = AllocateZeroPool(sizeof(NEKO_DECODE_BATCH));
+   if (Batch == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   // without MP services everything below simply runs on the BSP
+   MpInit(&State->Mp);
+   NekoListSkins(State, Setup->SpriteSheetPath);
+
+   Status = NekoPlanAssets(State, Setup, Batch);
+   if (!EFI_ERROR(Status)) {
+      NekoDecodeBatch(State, Batch);
+
+      NEKO_DECODE_JOB *Cursor = &Batch->Jobs[0];
+      State->CursorImage = Cursor->Image;
+      State->CursorWidth = Cursor->Width;
+      State->CursorHeight = Cursor->Height;
+      Cursor->Image = NULL;
+      if (State->CursorImage == NULL) {
+         Status = EFI_INVALID_PARAMETER;
       }
 
-      if (CmdLine[i] != L' ' && CmdLine[i] != L'\0') {
-         if (!InArg) {
-            Start = i;
-            InArg = TRUE;
+      for (UINTN i = 1; i < Batch->Count; i++) {
+         if (Batch->Jobs[i].Rgba != NULL) {
+            NekoSkinAdopt(State, &Batch->Jobs[i]);
          }
       }
    }
+   for (UINTN i = 0; i < Batch->Count; i++) {
+      NekoDecodeRelease(&Batch->Jobs[i]);
+   }
+   FreePool(Batch);
+   FASTFAIL();
+
+   // a sheet that failed above is tried once more, and then the built-in
+   // one, the way any other skin is decoded
+   Status = NekoSkinActivate(State, 0);
+   if (EFI_ERROR(Status) && Setup->SpriteSheetPath != NULL) {
+      Cache->Skins[0].Path = NULL;
+      Status = NekoSkinActivate(State, 0);
+   }
+   FASTFAIL();
 
-   return Argv;
+   State->AssetUs = ClkTicksToUs(ClkTicks() - Start);
+
+   return gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL,
+                           &State->TickEvent);
 }
 
+// starts sampling and the simulation clock. the last step before the first
+// frame, so nothing before it gets simulated.
 static EFI_STATUS EFIAPI
-NekoParseCommandLine(EFI_HANDLE ImageHandle, UINTN *Argc, CHAR16 ***Argv) {
+NekoStartInput(NekoState *State, EFINEKO_SETUP *Setup) {
    EFI_STATUS Status;
-   EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
 
-   Status = gBS->HandleProtocol(
-         ImageHandle,
-         &gEfiLoadedImageProtocolGuid,
-         (VOID**)&LoadedImage
-   );
-   if (EFI_ERROR(Status)) {
-      return Status;
-   }
+   Status = ClkInit();
+   FASTFAIL();
 
-   CHAR16 *LoadOptions = (CHAR16*)LoadedImage->LoadOptions;
-   UINTN LoadOptionsSize = LoadedImage->LoadOptionsSize;
+   Status = InputInit(&State->Input, &State->Pointers, NEKO_INPUT_INTERVAL);
+   FASTFAIL();
+   // keys read with another image in the foreground would be its keys
+   if (Setup->EnableKeyboardEvents) {
+      InputHotkeys(&State->Input, NEKO_HOTKEYS,
+                   State->Overlay ? NEKO_HOTKEY_SHIFT : 0, !State->Overlay);
+   }
 
-   *Argc = NekoGetArgc(LoadOptions, LoadOptionsSize);
-   *Argv = NekoGetArgv(LoadOptions, LoadOptionsSize, *Argc);
+   State->WakeupStart = ClkTicks();
+   State->WindowStart = State->WakeupStart;
+   State->SimLast = ClkNowMs();
+   NekoSchedule(State);
 
    return EFI_SUCCESS;
 }
 
+// undoes NekoLoadAssets and NekoStartInput, however far they got
 static VOID EFIAPI
-NekoInitDefaultState(EFI_HANDLE ImageHandle, NekoState *State) {
-   State->SpriteSheetX = 0;
-   State->SpriteSheetY = 0;
-   State->PtrX = 0;
-   State->PtrY = 0;
-   State->PtrXPrev = 0;
-   State->PtrYPrev = 0;
-   State->NekoX = 0;
-   State->NekoY = 0;
-   State->NekoXPrev = 0;
-   State->NekoYPrev = 0;
-   State->LoopIndex = 0;
-   State->ShouldQuit = FALSE;
-   State->NekoPaused = FALSE;
-   State->ImageHandle = ImageHandle;
+NekoStop(NekoState *State) {
+   PipeStop(&State->Pipe);
+   // a skin decoding ahead is still in its arena
+   MpJoin(&State->Mp);
+   NekoDecodeRelease(&State->Ahead);
+   if (State->TickEvent != NULL) {
+      gBS->SetTimer(State->TickEvent, TimerCancel, 0);
+      gBS->CloseEvent(State->TickEvent);
+      State->TickEvent = NULL;
+   }
+
+   // the sampler reads the pointer list, so it has to go first
+   InputFree(&State->Input);
+   PointerFree(&State->Pointers);
+
+   NekoSkinFreeAll(State);
+   MpFree(&State->Mp);
+   HerdFree(&State->Herd);
+   OverlayUnderFree(&State->SpriteUnder);
+   OverlayUnderFree(&State->CursorUnder);
+   if (State->CursorImage != NULL) {
+      FreePool(State->CursorImage);
+      State->CursorImage = NULL;
+   }
+   if (State->GopConfig.Modes != NULL) {
+      FreePool(State->GopConfig.Modes);
+      State->GopConfig.Modes = NULL;
+   }
+   ClkFree();
+}
+
+// brings what is saved under the cat up to date with the host's drawing.
+// only the parts of the saved regions that were drawn over are read back.
+static VOID EFIAPI
+NekoApplyDamage(NekoState *State) {
+   NEKO_DAMAGE *Damage = &State->Damage;
+
+   for (UINTN i = 0; i < Damage->Count; i++) {
+      State->Damaged |= OverlayUnderRefresh(&State->Blitter,
+                                            &State->CursorUnder,
+                                            &Damage->Rects[i]);
+      State->Damaged |= OverlayUnderRefresh(&State->Blitter,
+                                            &State->SpriteUnder,
+                                            &Damage->Rects[i]);
+   }
+   Damage->Count = 0;
+}
+
+// a region whose probe changed since we last drew there is damaged all
+// over. the refresh then sorts out which pixels the host actually took.
+static VOID EFIAPI
+NekoProbeCheck(NekoState *State) {
+   NEKO_UNDER *Unders[] = { &State->SpriteUnder, &State->CursorUnder };
+   UINTN Pixels;
+
+   for (UINTN i = 0; i < ARRAY_SIZE(Unders); i++) {
+      NEKO_UNDER *Under = Unders[i];
+
+      if (Under->Valid &&
+          OverlayUnderProbe(&State->Blitter, Under, &Pixels) != Under->Hash) {
+         OverlayDamageAdd(&State->Damage, Under->X, Under->Y,
+                          Under->Width, Under->Height);
+         State->Stats.ProbeHits++;
+      }
+   }
+}
+
+static VOID EFIAPI
+NekoProbeBaseline(NekoState *State) {
+   NEKO_UNDER *Unders[] = { &State->SpriteUnder, &State->CursorUnder };
+   UINTN Pixels;
+
+   State->Stats.ProbePixels = 0;
+   for (UINTN i = 0; i < ARRAY_SIZE(Unders); i++) {
+      Unders[i]->Hash = OverlayUnderProbe(&State->Blitter, Unders[i],
+                                          &Pixels);
+      State->Stats.ProbePixels += Pixels;
+   }
+}
+
+// what reading the whole screen back would cost, from one row, so the
+// probe's cost can be held against it
+static VOID EFIAPI
+NekoMeasureReadback(NekoState *State) {
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row =
+      AllocatePool(State->ScrX * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   if (Row == NULL) {
+      return;
+   }
+
+   UINT64 Start = ClkTicks();
+   State->Gop->Blt(State->Gop, Row, EfiBltVideoToBltBuffer, 0, 0, 0, 0,
+                   State->ScrX, 1, 0);
+   State->Stats.ReadbackUs =
+      ClkTicksToUs(MultU64x32(ClkTicks() - Start, State->ScrY));
+
+   FreePool(Row);
+}
+
+// the host set a new mode. whatever was saved under the cat went with the
+// old screen, so the cat is simply drawn afresh on the new one.
+static VOID EFIAPI
+NekoScreenChanged(NekoState *State) {
+   NEKO_BLITTER *Blitter = &State->Blitter;
+   NEKO_BLIT_PATH BlitPath = Blitter->BlitPath;
+   NEKO_FILL_PATH FillPath = Blitter->FillPath;
+
+   // the tuned paths stay, unless they needed a framebuffer that is gone
+   BlitInit(Blitter, State->Gop);
+   if (Blitter->FrameBuffer != NULL || BlitPath != NEKO_BLIT_FRAMEBUFFER) {
+      Blitter->BlitPath = BlitPath;
+   }
+   if (Blitter->FrameBuffer != NULL || FillPath != NEKO_FILL_FRAMEBUFFER) {
+      Blitter->FillPath = FillPath;
+   }
+
+   State->ScrX = Blitter->ScrX;
+   State->ScrY = Blitter->ScrY;
+   EFI_TPL OldTpl = gBS->RaiseTPL(NEKO_INPUT_TPL);
+   PointerResize(&State->Pointers, State->ScrX, State->ScrY);
+   gBS->RestoreTPL(OldTpl);
+
+   State->PtrX = MIN(State->PtrX, State->ScrX - CURSOR_WIDTH);
+   State->PtrY = MIN(State->PtrY, State->ScrY - CURSOR_HEIGHT);
+   State->SpriteUnder.Valid = FALSE;
+   State->CursorUnder.Valid = FALSE;
+   State->Damage.Count = 0;
+   State->Damaged = TRUE;
+}
+
+// one frame of the cat. everything the main loop does after a wakeup,
+// without the wait
+static VOID EFIAPI
+NekoFrame(NekoState *State) {
+   UINTN Ticks = NekoAdvance(State);
+   NekoSkinPoll(State, Ticks);
+   NekoRender(State, Ticks);
+   NekoSchedule(State);
 }
 
+// the cat goes on top of the host's screen in whatever mode the host set,
+// and never clears it
 EFI_STATUS EFIAPI
-NekoLoadCursor(UINTN Argc, CHAR16 **Argv, NekoState *State) {
+EfiNekoInit(EFINEKO_SETUP *Setup, EFINEKO_STATE *State) {
    EFI_STATUS Status;
-   CHAR16 *CursorPath = NULL;
-   UINT8 *CursorPng;
-   UINTN CursorSize;
-   BOOLEAN MemLoad = FALSE;
 
-   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *CursorBltBuffer = NULL;
-   UINTN CursorWidth;
-   UINTN CursorHeight;
+   if (Setup == NULL || State == NULL) {
+      return EFI_INVALID_PARAMETER;
+   }
 
-   for (UINTN i = 0; i < Argc; i++) {
-      if (NekoStrCmp(Argv[i], L"-c") == 0 || 
-          NekoStrCmp(Argv[i], L"--cursor") == 0) {
-         if (Argv[i + 1] != NULL) {
-            CursorPath = Argv[i + 1];
-         }
-      }
+   NekoState *Neko = AllocateZeroPool(sizeof(NekoState));
+   if (Neko == NULL) {
+      return EFI_OUT_OF_RESOURCES;
    }
-   if (CursorPath == NULL || UtLoadFileFromRoot(State->ImageHandle,
-            CursorPath, (VOID**)&CursorPng, &CursorSize) != EFI_SUCCESS) {
-      CursorPng = CursorMemPng;
-      CursorSize = CursorMemPngLen;
-      MemLoad = TRUE;
+
+   NekoInitDefaultState(Setup->ImageHandle, Neko);
+   Neko->Overlay = TRUE;
+   Neko->DrawCursor = Setup->DrawCursor;
+   Neko->GopConfig.Policy = NEKO_GOP_KEEP;
+   Neko->GopConfig.PixelBudget = MAX_UINTN;
+   if (Setup->NekoTickSpeed != 0) {
+      Neko->TickSteps = MAX(1, Setup->NekoTickSpeed 
+                             / (NEKO_SIM_STEP_MS * 10000));
    }
 
-   Status = NekoPngToGopBlt(CursorPng, CursorSize, &CursorBltBuffer,
-                            &CursorWidth, &CursorHeight);
-   if (MemLoad == FALSE) {
-      FreePool(CursorPng);
+   Status = NekoInitGop(&Neko->Gop, Neko);
+   if (!EFI_ERROR(Status)) {
+      BlitInit(&Neko->Blitter, Neko->Gop);
+      Status = PointerInit(&Neko->Pointers, Neko->ScrX, Neko->ScrY, 0);
+   }
+   if (!EFI_ERROR(Status) && Setup->SharePointers) {
+      Status = PointerShare(&Neko->Pointers);
+   }
+   if (!EFI_ERROR(Status)) {
+      Status = NekoLoadAssets(Neko, Setup);
+   }
+   if (!EFI_ERROR(Status)) {
+      Status = OverlayUnderInit(&Neko->SpriteUnder, Neko->Anims->BoxWidth,
+                                Neko->Anims->BoxHeight);
+   }
+   if (!EFI_ERROR(Status)) {
+      Status = OverlayUnderInit(&Neko->CursorUnder, Neko->CursorWidth,
+                                Neko->CursorHeight);
+   }
+   if (!EFI_ERROR(Status)) {
+      // a probe puts back the corner it timed on, so it is safe here too
+      BlitTune(&Neko->Blitter, Neko->SpsImage, Neko->SpsWidth,
+               Neko->Anims->Sprites[0].Width, Neko->Anims->Sprites[0].Height,
+               FALSE);
+      Status = NekoStartInput(Neko, Setup);
    }
    if (EFI_ERROR(Status)) {
+      NekoStop(Neko);
+      FreePool(Neko);
       return Status;
    }
+   if (Neko->Blitter.FrameBuffer != NULL) {
+      NekoMeasureReadback(Neko);
+   }
 
-   State->CursorImage = CursorBltBuffer;
-   State->CursorWidth = CursorWidth;
-   State->CursorHeight = CursorHeight;
+   ZeroMem(State->WaitList, sizeof(State->WaitList));
+   State->WaitList[NEKO_WAIT_TICK] = Neko->TickEvent;
+   State->WaitList[NEKO_WAIT_INPUT] = Neko->Input.ReadyEvent;
+   State->WaitList[NEKO_WAIT_DEVICES] = Neko->Pointers.DeviceEvent;
+   // the host does not know about the pointer slots, so no tickless input
+   State->WaitCount = NEKO_WAIT_POINTER;
+   State->Neko = Neko;
 
    return EFI_SUCCESS;
 }
 
+// called once per host frame, after the host has drawn. the render steps
+// down as NekoRender does once it keeps taking longer than BudgetUs (0 for
+// NEKO_FRAME_BUDGET_US), and finishing a fresh sheet only gets whatever is
+// left of it. returns EFI_ABORTED once the cat was dismissed with q.
 EFI_STATUS EFIAPI
-NekoLoadSpriteSheet(UINTN Argc, CHAR16 **Argv, NekoState *State) {
-   EFI_STATUS Status;
-   CHAR16 *SpriteSheetPath = NULL;
-   UINT8 *SpriteSheetPng;
-   UINTN SpriteSheetSize;
-   BOOLEAN MemLoad = FALSE;
+EfiNekoTick(EFINEKO_STATE *State, UINT64 BudgetUs) {
+   if (State == NULL || State->Neko == NULL) {
+      return EFI_INVALID_PARAMETER;
+   }
 
-   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *SpriteSheetBltBuffer = NULL;
-   UINTN SpriteSheetWidth;
-   UINTN SpriteSheetHeight;
+   NekoState *Neko = State->Neko;
+   UINT64 Start = ClkTicks();
 
-   for (UINTN i = 0; i < Argc; i++) {
-      if (NekoStrCmp(Argv[i], L"-s") == 0 ||
-          NekoStrCmp(Argv[i], L"--sprite") == 0) {
-         if (Argv[i + 1] != NULL) {
-            SpriteSheetPath = Argv[i + 1];
+   if (Neko->ShouldQuit) {
+      return EFI_ABORTED;
+   }
+   Neko->Budget.LimitUs = BudgetUs != 0 ? BudgetUs : NEKO_FRAME_BUDGET_US;
+
+   // the events are only there for a host that sleeps, and are reset here
+   // so they do not stay signalled
+   gBS->CheckEvent(Neko->TickEvent);
+   gBS->CheckEvent(Neko->Input.ReadyEvent);
+   if (gBS->CheckEvent(Neko->Pointers.DeviceEvent) == EFI_SUCCESS) {
+      PointerRefresh(&Neko->Pointers);
+   }
+
+   // only a framebuffer can be written behind our back
+   BOOLEAN Probe = Neko->Blitter.FrameBuffer != NULL;
+   UINT64 ProbeTime = 0;
+   if (Probe) {
+      UINT64 ProbeStart = ClkTicks();
+      NekoProbeCheck(Neko);
+      ProbeTime = ClkTicks() - ProbeStart;
+   }
+
+   NekoDrainInput(Neko);
+   NekoApplyDamage(Neko);
+   NekoFrame(Neko);
+   if (ClkTicksToUs(ClkTicks() - Start) < Neko->Budget.LimitUs) {
+      NekoSkinStep(Neko);
+      NekoSkinAhead(Neko);
+   }
+   Neko->Stats.Ticks++;
+
+   if (Probe) {
+      UINT64 ProbeStart = ClkTicks();
+      NekoProbeBaseline(Neko);
+      UINT64 Us = ClkTicksToUs(ProbeTime + ClkTicks() - ProbeStart);
+
+      Neko->Stats.ProbeTicks++;
+      Neko->Stats.ProbeUs += Us;
+      Neko->Stats.ProbeMaxUs = MAX(Neko->Stats.ProbeMaxUs, Us);
+   }
+
+   return Neko->ShouldQuit ? EFI_ABORTED : EFI_SUCCESS;
+}
+
+// the host drew into the rectangle since the last EfiNekoTick. that tick
+// then reads back what it covers of the cat and draws the cat on top.
+EFI_STATUS EFIAPI
+EfiNekoDamage(EFINEKO_STATE *State, INTN X, INTN Y, UINTN Width,
+              UINTN Height) {
+   if (State == NULL || State->Neko == NULL) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   NekoState *Neko = State->Neko;
+   OverlayDamageAdd(&Neko->Damage, X, Y, Width, Height);
+
+   return EFI_SUCCESS;
+}
+
+// takes the cat off the screen if it covers any of the rectangle, so the
+// host can read or copy its own pixels there. EfiNekoRepair puts it back.
+BOOLEAN EFIAPI
+EfiNekoHide(EFINEKO_STATE *State, INTN X, INTN Y, UINTN Width,
+            UINTN Height) {
+   if (State == NULL || State->Neko == NULL) {
+      return FALSE;
+   }
+
+   NekoState *Neko = State->Neko;
+   if (!OverlayUnderOverlaps(&Neko->SpriteUnder, X, Y, Width, Height) &&
+       !OverlayUnderOverlaps(&Neko->CursorUnder, X, Y, Width, Height)) {
+      return FALSE;
+   }
+
+   OverlayUnderRestore(&Neko->Blitter, &Neko->CursorUnder);
+   OverlayUnderRestore(&Neko->Blitter, &Neko->SpriteUnder);
+   Neko->Damaged = TRUE;
+
+   return TRUE;
+}
+
+// applies the damage reported so far right away and draws the cat on top
+// again where the host drew over it, without advancing it. for a host
+// that wants the cat back before its frame is seen, not a tick later.
+EFI_STATUS EFIAPI
+EfiNekoRepair(EFINEKO_STATE *State) {
+   if (State == NULL || State->Neko == NULL) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   NekoState *Neko = State->Neko;
+   if (Neko->ShouldQuit) {
+      return EFI_ABORTED;
+   }
+   NekoApplyDamage(Neko);
+   if (Neko->Damaged) {
+      NekoDrawSprite(Neko);
+      NekoDrawCursor(Neko);
+      Neko->Damaged = FALSE;
+      if (Neko->Blitter.FrameBuffer != NULL) {
+         NekoProbeBaseline(Neko);
+      }
+   }
+
+   return EFI_SUCCESS;
+}
+
+EFI_STATUS EFIAPI
+EfiNekoScreenChanged(EFINEKO_STATE *State) {
+   if (State == NULL || State->Neko == NULL) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   NekoScreenChanged(State->Neko);
+   return EFI_SUCCESS;
+}
+
+EFI_STATUS EFIAPI
+EfiNekoGetStats(EFINEKO_STATE *State, EFINEKO_STATS *Stats) {
+   if (State == NULL || State->Neko == NULL || Stats == NULL) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   NekoState *Neko = State->Neko;
+   CopyMem(Stats, &Neko->Stats, sizeof(EFINEKO_STATS));
+   return EFI_SUCCESS;
+}
+
+EFI_STATUS EFIAPI
+EfiNekoDestroy(EFINEKO_STATE *State) {
+   if (State == NULL) {
+      return EFI_INVALID_PARAMETER;
+   }
+   if (State->Neko == NULL) {
+      return EFI_SUCCESS;
+   }
+
+   // leave the host's screen the way it would be without the cat
+   NekoState *Neko = State->Neko;
+   OverlayUnderRestore(&Neko->Blitter, &Neko->CursorUnder);
+   OverlayUnderRestore(&Neko->Blitter, &Neko->SpriteUnder);
+
+   NekoStop(State->Neko);
+   FreePool(State->Neko);
+   State->Neko = NULL;
+
+   ZeroMem(State->WaitList, sizeof(State->WaitList));
+   State->WaitCount = 0;
+
+   return EFI_SUCCESS;
+}
+
+static VOID EFIAPI
+NekoPrintDiagnostics(NekoState *State) {
+   NEKO_SKIN_CACHE *Cache = &State->SkinCache;
+   NEKO_BLITTER *Blitter = &State->Blitter;
+
+   Print(L"skins: %lu hits, %lu misses (%lu ahead), %lu evictions, "
+         L"%lu reloads, %lu/%lu KiB\n",
+         (UINT64)Cache->Hits, (UINT64)Cache->Misses, (UINT64)Cache->Ahead,
+         (UINT64)Cache->Evictions, (UINT64)Cache->Reloads,
+         (UINT64)(Cache->Used / 1024), (UINT64)(Cache->Budget / 1024));
+   Print(L"anims: %lu frames in %lu sequences, %lu manifests, "
+         L"%lu rejected",
+         (UINT64)State->Anims->FrameCount,
+         (UINT64)State->Anims->SequenceCount,
+         (UINT64)Cache->Manifests, (UINT64)Cache->BadManifests);
+   if (Cache->BadManifests != 0) {
+      Print(L", last at line %lu", (UINT64)Cache->BadLine);
+   }
+   Print(L"\n");
+   Print(L"atlas: %lu sprites, %lu merged, %lux%lu px, box %lux%lu px\n",
+         (UINT64)State->Anims->SpriteCount,
+         (UINT64)Cache->Skins[Cache->Active].Atlas.Merged,
+         (UINT64)State->SpsWidth, (UINT64)State->SpsHeight,
+         (UINT64)State->Anims->BoxWidth, (UINT64)State->Anims->BoxHeight);
+   Print(L"blit: %s at %lu px/ms, fill: %s at %lu px/ms (%s)\n",
+         BlitPathName(Blitter->BlitPath), Blitter->BlitRate,
+         BlitFillPathName(Blitter->FillPath), Blitter->FillRate,
+         Blitter->Probed ? L"probed" :
+         Blitter->BlitRate != 0 ? L"cached" : L"default");
+   UINTN Absolute = 0;
+   for (UINTN i = 0; i < State->Pointers.Count; i++) {
+      Absolute += State->Pointers.Devices[i].App != NULL;
+   }
+   Print(L"startup: assets in %lu us on %lu processors, %lu/%lu tasks on "
+         L"APs, first frame after %lu us\n",
+         State->AssetUs, (UINT64)State->Mp.Processors, State->Mp.ApTasks,
+         State->Mp.Tasks, State->FirstFrameUs);
+   Print(L"pointer: %lu devices (%lu absolute)\n",
+         (UINT64)State->Pointers.Count, (UINT64)Absolute);
+   if (State->Input.HotkeyCount != 0) {
+      Print(L"keys: %lu hotkeys via RegisterKeyNotify%s\n",
+            (UINT64)State->Input.HotkeyCount,
+            State->Input.HotkeyShift != 0 ? L", with ctrl+alt" : L"");
+   } else {
+      Print(L"keys: %s\n", State->Input.ConIn != NULL ? L"polled" : L"off");
+   }
+   UINT64 Us = ClkTicksToUs(ClkTicks() - State->WakeupStart);
+   Print(L"wakeups: %lu loop, %lu sampler, %lu/s last window, "
+         L"%lu/s average\n",
+         State->Wakeups, State->Input.Wakeups, State->WakeupRate,
+         Us == 0 ? 0 : DivU64x64Remainder(
+            MultU64x32(State->Wakeups + State->Input.Wakeups, 1000000),
+            Us, NULL));
+   CONST CHAR16 *Levels[NEKO_DEGRADE_COUNT] = {
+      L"none", L"skip", L"merge", L"slow"
+   };
+   NEKO_FRAME_BUDGET *Budget = &State->Budget;
+   Print(L"frame: degrade %s, %lu us avg, %lu us max, %lu/%lu over "
+         L"budget, %lu degrades, %lu recoveries\n",
+         Levels[Budget->Level], Budget->AvgUs, Budget->MaxUs,
+         Budget->Overruns, Budget->Frames, Budget->Degrades,
+         Budget->Recoveries);
+   Print(L"input: %lu samples, %u overflows, depth %u/%u, "
+         L"latency %lu us max\n",
+         State->Input.Ring.Pushed, State->Input.Ring.Overflows,
+         State->Input.Ring.MaxDepth, NEKO_INPUT_RING_SIZE,
+         ClkTicksToUs(State->InputLatency));
+   NEKO_PIPE *Pipe = &State->Pipe;
+   NEKO_LATENCY *Latency = &State->Latency;
+   if (Pipe->Sequence != 0) {
+      Print(L"pipeline: %u frames, %lu composed, %lu us avg, %lu us max, "
+            L"%lu torn reads\n",
+            Pipe->Sequence, Pipe->Composed,
+            Pipe->Composed == 0 ? 0 : DivU64x64Remainder(Pipe->ComposeUs,
+                                                         Pipe->Composed,
+                                                         NULL),
+            Pipe->ComposeMaxUs, Pipe->Retries);
+      Latency = &Pipe->Latency;
+   }
+   Print(L"photon: %lu us avg, %lu us max from pointer sample to screen, "
+         L"%lu frames %s\n",
+         Latency->Frames == 0 ? 0 : DivU64x64Remainder(Latency->TotalUs,
+                                                       Latency->Frames,
+                                                       NULL),
+         Latency->MaxUs, Latency->Frames,
+         Pipe->Sequence != 0 ? L"pipelined" : L"direct");
+   NEKO_HERD *Herd = &State->Herd;
+   if (Herd->Count != 0) {
+      Print(L"herd: %lu cats, %lu parked, %lu wakeups, %lu us avg per "
+            L"step, %lu cats drawn per frame avg\n",
+            (UINT64)Herd->Count + 1,
+            (UINT64)(Herd->Count - Herd->ActiveCount), Herd->Wakeups,
+            Herd->Steps == 0 ? 0 : DivU64x64Remainder(
+               ClkTicksToUs(Herd->StepTicks), Herd->Steps, NULL),
+            Budget->Frames == 0 ? 0 : DivU64x64Remainder(
+               Herd->Draws, Budget->Frames, NULL));
+   }
+}
+
+// --herd-bench: what a tick of the herd costs as it grows. running cats
+// go first on the BSP alone and then on every processor MP services lends
+// us; run it under QEMU at -smp 1 to 8 for the scaling curve. idle and
+// sleeping cats should cost next to nothing. nothing is drawn.
+static VOID EFIAPI
+NekoHerdBench(NekoState *State) {
+   CONST NEKO_HERD_BENCH Modes[4] = {
+      NEKO_HERD_BENCH_RUN, NEKO_HERD_BENCH_RUN,
+      NEKO_HERD_BENCH_IDLE, NEKO_HERD_BENCH_ASLEEP
+   };
+   NEKO_HERD Herd;
+   UINT64 Ns[4];
+   UINT64 Processors;
+
+   MpInit(&State->Mp);
+   Processors = State->Mp.Processors;
+   for (UINTN Count = 64; Count <= NEKO_HERD_BENCH_MAX; Count *= 4) {
+      // running on one processor, then running, idle and asleep on all
+      for (UINTN Run = 0; Run < 4; Run++) {
+         EFI_STATUS Status = HerdInit(&Herd, Count, State->ScrX, State->ScrY,
+                                      NekoHerdSize(AnimBuiltin()),
+                                      NEKO_SPEED,
+                                      NEKO_NEAR_DIST, State->TickSteps,
+                                      AnimBuiltin(),
+                                      Run == 0 ? NULL : &State->Mp);
+         if (EFI_ERROR(Status)) {
+            Print(L"herd: %lu cats: %r\n", (UINT64)Count, Status);
+            return;
          }
+
+         Ns[Run] = HerdBench(&Herd, NEKO_HERD_BENCH_TICKS, Modes[Run]);
+         HerdFree(&Herd);
       }
+
+      Print(L"herd: %5lu cats, %lu ticks/s on 1 processor, %lu ticks/s on "
+            L"%lu, %lu%% efficiency\n",
+            (UINT64)Count,
+            Ns[0] == 0 ? 0 : DivU64x64Remainder(1000000000ULL, Ns[0], NULL),
+            Ns[1] == 0 ? 0 : DivU64x64Remainder(1000000000ULL, Ns[1], NULL),
+            Processors,
+            Ns[1] == 0 ? 0 : DivU64x64Remainder(Ns[0] * 100,
+                                                Ns[1] * Processors, NULL));
+      Print(L"herd: %5lu cats, %lu ns per tick running, %lu idle, "
+            L"%lu asleep\n",
+            (UINT64)Count, Ns[1], Ns[2], Ns[3]);
    }
-   if (SpriteSheetPath == NULL || UtLoadFileFromRoot(State->ImageHandle,
-            SpriteSheetPath, (VOID**)&SpriteSheetPng, 
-            &SpriteSheetSize) != EFI_SUCCESS) {
-      SpriteSheetPng = NekoMemPng;
-      SpriteSheetSize = NekoMemPngLen;
-      MemLoad = TRUE;
+}
+
+// --run <path> [args]: the cat goes on top of another image instead of
+// taking the screen. our own options come before --run, everything after
+// the path is the host's, with the path as its first argument.
+static EFI_STATUS EFIAPI
+NekoRunHost(EFI_HANDLE ImageHandle, UINTN Argc, CHAR16 **Argv, UINTN Run) {
+   EFI_STATUS Status;
+   NEKO_OVERLAY_STATS Stats;
+   UINTN Size = 0;
+
+   for (UINTN i = Run + 1; i < Argc && Argv[i] != NULL; i++) {
+      Size += StrSize(Argv[i]);
    }
 
-   Status = NekoPngToGopBlt(SpriteSheetPng, SpriteSheetSize,
-         &SpriteSheetBltBuffer, &SpriteSheetWidth, &SpriteSheetHeight);
-   if (MemLoad == FALSE) {
-      FreePool(SpriteSheetPng);
+   CHAR16 *Options = AllocateZeroPool(Size);
+   if (Options == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   for (UINTN i = Run + 1; i < Argc && Argv[i] != NULL; i++) {
+      if (i > Run + 1) {
+         StrCatS(Options, Size / sizeof(CHAR16), L" ");
+      }
+      StrCatS(Options, Size / sizeof(CHAR16), Argv[i]);
    }
+
+   // keys and pointers belong to the host, and it keeps whatever mode it
+   // sets. the hotkeys, held with ctrl+alt, only look on, where the console
+   // lets them, and the cat only follows the pointer as far as the host
+   // reads it.
+   EFINEKO_SETUP Setup = {
+      .ImageHandle = ImageHandle,
+      .EnableKeyboardEvents = TRUE,
+      .SharePointers = TRUE,
+      .DrawCursor = TRUE,
+      .SpriteSheetPath = NekoGetOption(Run, Argv, L"-s", L"--sprite"),
+      .CursorPath = NekoGetOption(Run, Argv, L"-c", L"--cursor"),
+   };
+
+   Status = OverlayRun(ImageHandle, Argv[Run + 1], Options, &Setup, &Stats);
+   FreePool(Options);
    if (EFI_ERROR(Status)) {
+      Print(L"%s: %r\n", Argv[Run + 1], Status);
       return Status;
    }
 
-   State->SpsImage = SpriteSheetBltBuffer;
-   State->SpsWidth = SpriteSheetWidth;
-   State->SpsHeight = SpriteSheetHeight;
+   // the share of the host's run time spent in the cat, in 1/100 %
+   UINT64 Share = Stats.HostUs == 0 ? 0 : DivU64x64Remainder(
+      MultU64x32(Stats.TotalUs, 10000), Stats.HostUs, NULL);
+   Print(L"overlay: %lu ticks, %lu skipped, %lu us avg, %lu us max, "
+         L"%lu over %u us\n",
+         Stats.Frames, Stats.Skipped,
+         Stats.Frames == 0 ? 0 : DivU64x64Remainder(Stats.TotalUs,
+                                                    Stats.Frames, NULL),
+         Stats.MaxUs, Stats.Overruns, NEKO_OVERLAY_BUDGET_US);
+   Print(L"overlay: %lu.%02lu%% of %lu ms host time, %lu console damage "
+         L"reports, host returned %r\n",
+         Share / 100, Share % 100, Stats.HostUs / 1000, Stats.TextDamage,
+         Stats.HostStatus);
+   Print(L"overlay: %lu host Blt calls drew, %lu mode changes\n",
+         Stats.BltDamage, Stats.ModeChanges);
+   EFINEKO_STATS *Neko = &Stats.Neko;
+   if (Neko->ProbeTicks != 0) {
+      Print(L"probe: %lu us avg, %lu us max over %lu px per tick, %lu hits, "
+            L"full readback %lu us\n",
+            DivU64x64Remainder(Neko->ProbeUs, Neko->ProbeTicks, NULL),
+            Neko->ProbeMaxUs, Neko->ProbePixels, Neko->ProbeHits,
+            Neko->ReadbackUs);
+   } else {
+      Print(L"probe: off, no framebuffer\n");
+   }
 
-   return EFI_SUCCESS;
+   return Stats.HostStatus;
 }
 
 EFI_STATUS EFIAPI 
@@ -749,70 +2862,148 @@ NekoMain(EFI_HANDLE ImageHandle, EFI_SYSTEM_TABLE *SystemTable) {
    CHAR16 **Argv;
    Status = NekoParseCommandLine(ImageHandle, &Argc, &Argv);
 
+   for (UINTN i = 0; i + 1 < Argc; i++) {
+      if (Argv[i + 1] != NULL && NekoStrCmp(Argv[i], L"--run") == 0) {
+         return NekoRunHost(ImageHandle, Argc, Argv, i);
+      }
+   }
+
    NekoState State = {0};
 
-   Status = NekoInitSpp(&State.Spp);
-   if (EFI_ERROR(Status)) {
-      return Status;
-   }
+   NekoInitDefaultState(ImageHandle, &State);
+   NekoParseGopPolicy(Argc, Argv, &State.GopConfig);
 
    Status = NekoInitGop(&State.Gop, &State);
    if (EFI_ERROR(Status)) {
       return Status;
    }
 
-   NekoInitDefaultState(ImageHandle, &State);
+   BlitInit(&State.Blitter, State.Gop);
 
-   Status = NekoLoadCursor(Argc, Argv, &State);
+   Status = NekoInitPointers(Argc, Argv, &State);
    if (EFI_ERROR(Status)) {
       return Status;
    }
 
-   Status = NekoLoadSpriteSheet(Argc, Argv, &State);
+   EFINEKO_SETUP Setup = {
+      .ImageHandle = ImageHandle,
+      .EnableKeyboardEvents = TRUE,
+      .DrawCursor = TRUE,
+      .SpriteSheetPath = NekoGetOption(Argc, Argv, L"-s", L"--sprite"),
+      .CursorPath = NekoGetOption(Argc, Argv, L"-c", L"--cursor"),
+   };
+   CHAR16 *SkinBudget = NekoGetOption(Argc, Argv, NULL, L"--skin-budget");
+   if (SkinBudget != NULL) {
+      State.SkinCache.Budget = StrDecimalToUintn(SkinBudget) * 1024;
+   }
+
+   if (NekoHasFlag(Argc, Argv, L"--herd-bench")) {
+      NekoHerdBench(&State);
+      NekoStop(&State);
+      return EFI_SUCCESS;
+   }
+
+   Status = NekoLoadAssets(&State, &Setup);
    if (EFI_ERROR(Status)) {
+      NekoStop(&State);
       return Status;
    }
 
-   EFI_EVENT MouseEvent;
-   EC(gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &MouseEvent));
-   EC(gBS->SetTimer(MouseEvent, TimerPeriodic, NEKO_INPUT_INTERVAL));
+   // --cats N: N cats in all, this one and a herd of the others
+   CHAR16 *Cats = NekoGetOption(Argc, Argv, NULL, L"--cats");
+   if (Cats != NULL && StrDecimalToUintn(Cats) > 1) {
+      Status = HerdInit(&State.Herd, StrDecimalToUintn(Cats) - 1,
+                        State.ScrX, State.ScrY, NekoHerdSize(State.Anims),
+                        NEKO_SPEED, NEKO_NEAR_DIST, State.TickSteps,
+                        State.Anims, &State.Mp);
+      if (EFI_ERROR(Status)) {
+         Print(L"cats: %r, only one\n", Status);
+      }
+      NekoSkinBind(&State);
+   }
 
-   EFI_EVENT NekoTickEvent;
-   EC(gBS->CreateEvent(EVT_TIMER, TPL_CALLBACK, NULL, NULL, &NekoTickEvent));
-   EC(gBS->SetTimer(NekoTickEvent, TimerPeriodic, NEKO_ANIM_INTERVAL));
+   NekoDrawBackground(&State);
 
-   EFI_EVENT WaitList[3] = { 
-      MouseEvent,
-      NekoTickEvent,
-      gST->ConIn->WaitForKey
-   };
+   // an empty profile just keeps the per-row default, drawing still works
+   BlitTune(&State.Blitter, State.SpsImage, State.SpsWidth,
+            State.Anims->Sprites[0].Width, State.Anims->Sprites[0].Height,
+            NekoHasFlag(Argc, Argv, L"--probe"));
+
+   // the AP takes over the framebuffer as the probe left it. it only
+   // knows of two layers, so a herd keeps drawing here.
+   if (NekoHasFlag(Argc, Argv, L"--pipeline") && State.Herd.Count != 0) {
+      Print(L"pipeline: not with --cats, drawing here instead\n");
+   } else if (NekoHasFlag(Argc, Argv, L"--pipeline")) {
+      Status = PipeStart(&State.Pipe, &State.Mp, &State.Blitter);
+      if (EFI_ERROR(Status)) {
+         Print(L"pipeline: %r, drawing here instead\n", Status);
+      }
+   }
 
-   NekoDrawBackground(&State);
+   // started after the probe so sampling does not skew its timings
+   Status = NekoStartInput(&State, &Setup);
+   if (EFI_ERROR(Status)) {
+      NekoStop(&State);
+      return Status;
+   }
+   State.Input.Tickless = TRUE;
+
+   EFI_EVENT WaitList[NEKO_WAIT_MAX] = { 
+      [NEKO_WAIT_TICK] = State.TickEvent,
+      [NEKO_WAIT_INPUT] = State.Input.ReadyEvent,
+      [NEKO_WAIT_DEVICES] = State.Pointers.DeviceEvent
+   };
 
    while (State.ShouldQuit == FALSE) {
       UINTN Idx;
-      Status = gBS->WaitForEvent(3, WaitList, &Idx);
-
-      switch (Idx) {
-      case 0: // pointer interval
-         EFI_SIMPLE_POINTER_STATE Ptr;
-         if (State.Spp->GetState(State.Spp, &Ptr) == EFI_SUCCESS) {
-            NekoHandleMouseEvent(Ptr, &State);
+      UINTN WaitCount = NEKO_WAIT_POINTER;
+
+      // a suspended sampler hands wakeups over to the devices themselves
+      if (State.Input.Suspended) {
+         for (UINTN i = 0; i < State.Pointers.Count; i++) {
+            NEKO_POINTER_DEVICE *Device = &State.Pointers.Devices[i];
+            WaitList[WaitCount++] = Device->App != NULL 
+                                  ? Device->App->WaitForInput
+                                  : Device->Spp->WaitForInput;
          }
-         break;
-      case 1: // animation interval
-         NekoUpdateSpritePos(&State);
-         break;
-      case 2: // keyboard input
-         EFI_INPUT_KEY Key;
-         if (gST->ConIn->ReadKeyStroke(gST->ConIn, &Key) == EFI_SUCCESS) {
-            NekoHandleKeyEvent(Key, &State);
-         }
-         break;
       }
-      NekoDrawSprite(&State);
-      NekoDrawCursor(&State);
+
+      Status = gBS->WaitForEvent(WaitCount, WaitList, &Idx);
+      NekoCountWakeup(&State);
+      if (EFI_ERROR(Status)) {
+         // a device unplugged while the sampler slept closes its
+         // WaitForInput under us. the list is built again without it.
+         PointerRefresh(&State.Pointers);
+         InputResume(&State.Input);
+         continue;
+      }
+
+      // the tick slot needs nothing of its own: every wakeup catches the
+      // simulation up to the present
+      if (Idx == NEKO_WAIT_INPUT) { // pointer motion and keys
+         NekoDrainInput(&State);
+      } else if (Idx == NEKO_WAIT_DEVICES) { // pointer hotplug
+         PointerRefresh(&State.Pointers);
+      } else if (Idx >= NEKO_WAIT_POINTER) { // a device woke the sampler
+         State.Pointers.Devices[Idx - NEKO_WAIT_POINTER].Signals = TRUE;
+         InputResume(&State.Input);
+      }
+      NekoFrame(&State);
+      NekoSkinStep(&State);
+      NekoSkinAhead(&State);
+      NekoFlushConIn(&State);
+   }
+
+   // and whatever came in after the last wakeup
+   if (State.Input.HotkeyCount != 0) {
+      gST->ConIn->Reset(gST->ConIn, FALSE);
    }
 
+   // diagnostics still read the pointer list, which outlives the sampler
+   InputFree(&State.Input);
+   PipeStop(&State.Pipe);
+   NekoPrintDiagnostics(&State);
+   NekoStop(&State);
+
    return EFI_SUCCESS;
 }
@@ -2,60 +2,75 @@
 #define __EFINEKO_H__
 
 #include <Uefi.h>
-#include <Library/BaseMemoryLib.h>
-#include <Library/MemoryAllocationLib.h>
-
-typedef unsigned long size_t;
 
+// the cat as a library: EfiNekoInit loads everything, the host then calls
+// EfiNekoTick once per frame of its own loop, and EfiNekoDestroy undoes
+// it all. paths are relative to the volume ImageHandle was loaded from.
 typedef struct {
-   BOOLEAN EnableKeyboardEvents;
-   CHAR16 *SpriteSheetPath;
-   UINTN NekoTickSpeed;
+   EFI_HANDLE ImageHandle;
+   BOOLEAN EnableKeyboardEvents; // ctrl+alt hotkeys, never taken from ConIn
+   BOOLEAN DrawCursor;        // FALSE if the host draws its own
+   BOOLEAN SharePointers;     // the host reads the pointers, the cat looks on
+   CHAR16 *SpriteSheetPath;   // NULL for the built-in sheet
+   CHAR16 *CursorPath;        // NULL for the built-in cursor
+   UINTN NekoTickSpeed;       // 100 ns units, 0 for the default
 } EFINEKO_SETUP;
 
+#include "Input.h"
+
+// WaitList layout. pointers and keys are sampled by a notify function into
+// a ring, and the input slot fires once it holds samples. the devices slot
+// fires when a pointer protocol is installed. while a tickless sampler is
+// suspended, one slot per pointer device (its WaitForInput) follows.
+#define NEKO_WAIT_TICK     0
+#define NEKO_WAIT_INPUT    1
+#define NEKO_WAIT_DEVICES  2
+#define NEKO_WAIT_POINTER  3
+#define NEKO_WAIT_MAX      (NEKO_WAIT_POINTER + NEKO_POINTER_MAX)
+
+// what the cat cost its host so far
+typedef struct {
+   UINT64 Ticks;
+   UINT64 ProbeTicks;      // ticks that checked the framebuffer probe
+   UINT64 ProbeUs;         // hashing, checks and baselines together
+   UINT64 ProbeMaxUs;
+   UINT64 ProbePixels;     // read per tick, both regions
+   UINT64 ProbeHits;       // regions found drawn over
+   UINT64 ReadbackUs;      // one full screen readback, estimated
+} EFINEKO_STATS;
+
+// EfiNekoTick never waits. a host that sleeps between frames may wait on
+// the first WaitCount events to learn when the cat has something new.
 typedef struct {
-   EFI_EVENT WaitList[3];
+   EFI_EVENT WaitList[NEKO_WAIT_MAX];
+   UINTN WaitCount;
+   VOID *Neko;             // private to the library
 } EFINEKO_STATE;
 
 EFI_STATUS EFIAPI
 EfiNekoInit(EFINEKO_SETUP *Setup, EFINEKO_STATE *State);
 
 EFI_STATUS EFIAPI
-EfiNekoDestroy(EFINEKO_STATE *State);
-
-#define LODEPNG_NO_COMPILE_ALLOCATORS
-
-void* lodepng_malloc(size_t Size) {
-   return AllocatePool(Size);
-}
+EfiNekoTick(EFINEKO_STATE *State, UINT64 BudgetUs);
 
-void lodepng_free(void *Addr) {
-   if (Addr) {
-      FreePool(Addr);
-   }
-}
-
-void* lodepng_realloc(void *Addr, size_t Size) {
-   if (Size == 0) {
-      lodepng_free(Addr);
-      return NULL;
-   }
+EFI_STATUS EFIAPI
+EfiNekoDamage(EFINEKO_STATE *State, INTN X, INTN Y, UINTN Width,
+              UINTN Height);
 
-   if (Addr == NULL) {
-      return lodepng_malloc(Size);
-   }
+BOOLEAN EFIAPI
+EfiNekoHide(EFINEKO_STATE *State, INTN X, INTN Y, UINTN Width,
+            UINTN Height);
 
-   VOID *NewAddr = AllocatePool(Size);
-   if (NewAddr == NULL) {
-      return NULL;
-   }
+EFI_STATUS EFIAPI
+EfiNekoRepair(EFINEKO_STATE *State);
 
-   CopyMem(NewAddr, Addr, Size);
+EFI_STATUS EFIAPI
+EfiNekoScreenChanged(EFINEKO_STATE *State);
 
-   lodepng_free(Addr);
-   return NewAddr;
-}
+EFI_STATUS EFIAPI
+EfiNekoGetStats(EFINEKO_STATE *State, EFINEKO_STATS *Stats);
 
-#include "lodepng.h"
+EFI_STATUS EFIAPI
+EfiNekoDestroy(EFINEKO_STATE *State);
 
 #endif // __EFINEKO_H__
@@ -0,0 +1,1060 @@
+#include <Uefi.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+
+#include "Herd.h"
+#include "Clock.h"
+#include "Pointer.h"
+#include "Util.h"
+
+// NekoGetDirection without the division: a run is steep past a slope of
+// 2.414 and shallow under 0.414. by steep, shallow or diagonal, then by
+// Dx > 0 and Dy > 0.
+static CONST UINT8 mHerdDirections[3][2][2] = {
+   {
+      { NEKO_ANIM_RUN_UP, NEKO_ANIM_RUN_DOWN },
+      { NEKO_ANIM_RUN_UP, NEKO_ANIM_RUN_DOWN },
+   },
+   {
+      { NEKO_ANIM_RUN_LEFT, NEKO_ANIM_RUN_LEFT },
+      { NEKO_ANIM_RUN_RIGHT, NEKO_ANIM_RUN_RIGHT },
+   },
+   {
+      { NEKO_ANIM_RUN_UP_LEFT, NEKO_ANIM_RUN_DOWN_LEFT },
+      { NEKO_ANIM_RUN_UP_RIGHT, NEKO_ANIM_RUN_DOWN_RIGHT },
+   },
+};
+
+static UINT32 EFIAPI
+HerdRandom(NEKO_HERD *Herd) {
+   UINT32 X = Herd->Seed;
+
+   X ^= X << 13;
+   X ^= X >> 17;
+   X ^= X << 5;
+   Herd->Seed = X;
+   return X;
+}
+
+// points every per cat array into one block at Base, cache line aligned,
+// and returns its size. with a NULL Base it only counts.
+static UINTN EFIAPI
+HerdLayout(NEKO_HERD *Herd, UINT8 *Base) {
+   UINTN Used = 0;
+
+#define HERD_ARRAY(Field, Entries) \
+   Herd->Field = (VOID*)((UINTN)Base + Used); \
+   Used += ALIGN_VALUE((Entries) * sizeof(*Herd->Field), 64)
+
+   HERD_ARRAY(X, Herd->Count);
+   HERD_ARRAY(Y, Herd->Count);
+   HERD_ARRAY(PrevX, Herd->Count);
+   HERD_ARRAY(PrevY, Herd->Count);
+   HERD_ARRAY(OffX, Herd->Count);
+   HERD_ARRAY(OffY, Herd->Count);
+   HERD_ARRAY(Dx, Herd->Count);
+   HERD_ARRAY(Dy, Herd->Count);
+   HERD_ARRAY(Dist, Herd->Count);
+   HERD_ARRAY(Direction, Herd->Count);
+   HERD_ARRAY(PushX, Herd->Count);
+   HERD_ARRAY(PushY, Herd->Count);
+   HERD_ARRAY(Shoves, Herd->Count);
+   HERD_ARRAY(Square, Herd->Count);
+   HERD_ARRAY(SquareNext, Herd->Count);
+   HERD_ARRAY(SquarePrev, Herd->Count);
+   HERD_ARRAY(SquareHead, Herd->GridX * Herd->GridY);
+   HERD_ARRAY(DirtySquares, Herd->GridX * Herd->GridY);
+   HERD_ARRAY(Walk, Herd->GridX * Herd->GridY);
+   HERD_ARRAY(Anim, Herd->Count);
+   HERD_ARRAY(Run, Herd->Count);
+   HERD_ARRAY(Cell, Herd->Count);
+   HERD_ARRAY(DrawX, Herd->Count);
+   HERD_ARRAY(DrawY, Herd->Count);
+   HERD_ARRAY(DrawnX, Herd->Count);
+   HERD_ARRAY(DrawnY, Herd->Count);
+   HERD_ARRAY(DrawnCell, Herd->Count);
+   HERD_ARRAY(Changed, Herd->Count);
+   HERD_ARRAY(Order, Herd->Count);
+   HERD_ARRAY(Redraw, Herd->Count);
+   HERD_ARRAY(Next, Herd->Count);
+   HERD_ARRAY(Due, Herd->Count);
+   HERD_ARRAY(Parked, Herd->Count);
+   HERD_ARRAY(Active, Herd->Count);
+   HERD_ARRAY(Settled, Herd->Count);
+   HERD_ARRAY(Listed, Herd->Count);
+   HERD_ARRAY(ChunkMoving, Herd->Chunks);
+
+#undef HERD_ARRAY
+
+   return Used;
+}
+
+// the grid square under a cat's corner
+static UINT32 EFIAPI
+HerdSquareOf(NEKO_HERD *Herd, UINT32 Cat) {
+   UINTN X = (UINTN)(Herd->X[Cat] >> NEKO_FP_SHIFT) / Herd->Size;
+   UINTN Y = (UINTN)(Herd->Y[Cat] >> NEKO_FP_SHIFT) / Herd->Size;
+
+   return (UINT32)(Y * Herd->GridX + X);
+}
+
+static VOID EFIAPI
+HerdList(NEKO_HERD *Herd, UINT32 Cat, UINT32 Square) {
+   UINT32 Head = Herd->SquareHead[Square];
+
+   Herd->Square[Cat] = Square;
+   Herd->SquarePrev[Cat] = NEKO_HERD_NIL;
+   Herd->SquareNext[Cat] = Head;
+   if (Head != NEKO_HERD_NIL) {
+      Herd->SquarePrev[Head] = Cat;
+   }
+   Herd->SquareHead[Square] = Cat;
+}
+
+static VOID EFIAPI
+HerdUnlist(NEKO_HERD *Herd, UINT32 Cat) {
+   UINT32 Prev = Herd->SquarePrev[Cat];
+   UINT32 Next = Herd->SquareNext[Cat];
+
+   if (Prev != NEKO_HERD_NIL) {
+      Herd->SquareNext[Prev] = Next;
+   } else {
+      Herd->SquareHead[Herd->Square[Cat]] = Next;
+   }
+   if (Next != NEKO_HERD_NIL) {
+      Herd->SquarePrev[Next] = Prev;
+   }
+}
+
+// the cats start idle, scattered over the screen and out of step with
+// each other
+EFI_STATUS EFIAPI
+HerdInit(NEKO_HERD *Herd, UINTN Count, INT32 ScrX, INT32 ScrY, INT32 Size,
+         INT32 Speed, UINT32 NearDist, UINTN TickSteps,
+         CONST NEKO_ANIMS *Anims, NEKO_MP *Mp) {
+   ZeroMem(Herd, sizeof(NEKO_HERD));
+   if (Count == 0 || Size <= 0) {
+      return EFI_SUCCESS;
+   }
+
+   Herd->Count = Count;
+   Herd->MaxX = MAX(0, ScrX - Size);
+   Herd->MaxY = MAX(0, ScrY - Size);
+   Herd->Size = Size;
+   Herd->Speed = Speed;
+   Herd->NearDist = NearDist;
+   Herd->TickSteps = MAX(1, TickSteps);
+   Herd->GridX = ScrX / Size + 1;
+   Herd->GridY = ScrY / Size + 1;
+   Herd->Mp = Mp;
+   Herd->Anims = Anims;
+   Herd->Chunks = (Count + NEKO_HERD_CHUNK - 1) / NEKO_HERD_CHUNK;
+
+   UINTN Bytes = HerdLayout(Herd, NULL);
+   UINT8 *Pool = AllocateZeroPool(Bytes + 64 +
+                                  2 * Herd->GridX * Herd->GridY);
+   if (Pool == NULL) {
+      ZeroMem(Herd, sizeof(NEKO_HERD));
+      return EFI_OUT_OF_RESOURCES;
+   }
+   UINT8 *Base = ALIGN_POINTER(Pool, 64);
+   HerdLayout(Herd, Base);
+   Herd->Dirty = Base + Bytes;
+   Herd->Walked = Herd->Dirty + Herd->GridX * Herd->GridY;
+   Herd->Pool = Pool;
+   Herd->Seed = (UINT32)ClkTicks() | 1;
+   Herd->ActiveCount = Count;
+   Herd->TargetX = MIN_INT32;
+   SetMem(Herd->Wheel, sizeof(Herd->Wheel), 0xFF);
+   SetMem(Herd->SquareHead,
+          Herd->GridX * Herd->GridY * sizeof(*Herd->SquareHead), 0xFF);
+
+   CONST NEKO_ANIM_FRAME *Idle = &Anims->Frames[
+      Anims->Sequences[NEKO_ANIM_IDLE].First];
+   for (UINTN i = 0; i < Count; i++) {
+      Herd->X[i] = (INT32)(HerdRandom(Herd) % (Herd->MaxX + 1))
+                 << NEKO_FP_SHIFT;
+      Herd->Y[i] = (INT32)(HerdRandom(Herd) % (Herd->MaxY + 1))
+                 << NEKO_FP_SHIFT;
+      Herd->PrevX[i] = Herd->X[i];
+      Herd->PrevY[i] = Herd->Y[i];
+      Herd->OffX[i] = (INT32)(HerdRandom(Herd) % (2 * NEKO_HERD_SPREAD + 1))
+                    - NEKO_HERD_SPREAD;
+      Herd->OffY[i] = (INT32)(HerdRandom(Herd) % (2 * NEKO_HERD_SPREAD + 1))
+                    - NEKO_HERD_SPREAD;
+      Herd->Anim[i].Elapsed = (UINT8)(HerdRandom(Herd) % Idle->Duration);
+      Herd->Cell[i] = Idle->Cell;
+      Herd->DrawX[i] = Herd->X[i] >> NEKO_FP_SHIFT;
+      Herd->DrawY[i] = Herd->Y[i] >> NEKO_FP_SHIFT;
+      Herd->DrawnCell[i] = NEKO_HERD_UNDRAWN;
+      Herd->Active[i] = (UINT32)i;
+      HerdList(Herd, (UINT32)i, HerdSquareOf(Herd, (UINT32)i));
+   }
+
+   return EFI_SUCCESS;
+}
+
+// the batched NekoCursorDist: how far every cat is from its spot. like
+// every pass below, it covers the active cats from First up to End.
+static VOID EFIAPI
+HerdMeasure(NEKO_HERD *Herd, UINTN First, UINTN End) {
+   CONST UINT32 *Active = Herd->Active;
+   CONST INT32 *X = Herd->X;
+   CONST INT32 *Y = Herd->Y;
+   CONST INT32 *OffX = Herd->OffX;
+   CONST INT32 *OffY = Herd->OffY;
+   INT32 *Dx = Herd->Dx;
+   INT32 *Dy = Herd->Dy;
+   UINT32 *Dist = Herd->Dist;
+
+   for (UINTN j = First; j < End; j++) {
+      UINT32 i = Active[j];
+      INT32 SpotX = MIN(MAX(Herd->TargetX + OffX[i], 0), Herd->MaxX);
+      INT32 SpotY = MIN(MAX(Herd->TargetY + OffY[i], 0), Herd->MaxY);
+
+      Dx[i] = SpotX - (X[i] >> NEKO_FP_SHIFT);
+      Dy[i] = SpotY - (Y[i] >> NEKO_FP_SHIFT);
+      Dist[i] = (UINT32)(Dx[i] * Dx[i] + Dy[i] * Dy[i]);
+   }
+}
+
+// the batched NekoGetDirection. a cat within NearDist counts as there.
+static VOID EFIAPI
+HerdDirections(NEKO_HERD *Herd, UINTN First, UINTN End) {
+   CONST INT32 *Dx = Herd->Dx;
+   CONST INT32 *Dy = Herd->Dy;
+   CONST UINT32 *Dist = Herd->Dist;
+   CONST UINT32 *Active = Herd->Active;
+   UINT8 *Direction = Herd->Direction;
+
+   for (UINTN j = First; j < End; j++) {
+      UINT32 i = Active[j];
+      BOOLEAN Near = Dist[i] <= Herd->NearDist;
+      INT32 Ax = Near ? 0 : ABS(Dx[i]);
+      INT32 Ay = Near ? 0 : ABS(Dy[i]);
+      UINTN Class = Ay * 1000 >= Ax * 2415 ? 0
+                  : Ay * 1000 < Ax * 414 ? 1 : 2;
+      UINT8 Run = mHerdDirections[Class][Dx[i] > 0][Dy[i] > 0];
+
+      Direction[i] = (Ax < 2 && Ay < 2) ? NEKO_ANIM_IDLE : Run;
+   }
+}
+
+// the batched NekoAnimTick, one cat at a time: every cat is at a
+// different point of a different sequence. a cat left settled, neither
+// running nor being shoved nor about to turn, is marked Parked with the
+// tick its frame runs out. one that has arrived loses its push once its
+// shoves are used up. returns how many of them move.
+static UINT32 EFIAPI
+HerdAnimate(NEKO_HERD *Herd, UINTN First, UINTN End) {
+   CONST NEKO_ANIMS *Anims = Herd->Anims;
+   UINT32 Moving = 0;
+
+   for (UINTN j = First; j < End; j++) {
+      UINT32 i = Herd->Active[j];
+      NEKO_ANIM_STATE *Anim = &Herd->Anim[i];
+      UINT8 Wanted = Herd->Direction[i];
+
+      // against an edge it scratches instead
+      INT32 X = Herd->X[i] >> NEKO_FP_SHIFT;
+      INT32 Y = Herd->Y[i] >> NEKO_FP_SHIFT;
+      if (X == 0) {
+         Wanted = NEKO_ANIM_SCRATCH_LEFT;
+      } else if (X == Herd->MaxX) {
+         Wanted = NEKO_ANIM_SCRATCH_RIGHT;
+      } else if (Y == 0) {
+         Wanted = NEKO_ANIM_SCRATCH_DOWN;
+      } else if (Y == Herd->MaxY) {
+         Wanted = NEKO_ANIM_SCRATCH_UP;
+      }
+
+      AnimTick(Anims, Anim, Wanted);
+      CONST NEKO_ANIM_FRAME *Frame = AnimFrame(Anims, Anim);
+      Herd->Cell[i] = Frame->Cell;
+      Herd->Run[i] = !(Anims->Sequences[Anim->Sequence].Flags &
+                       NEKO_ANIM_FLAG_STILL) &&
+                     Herd->Dist[i] > Herd->NearDist;
+
+      BOOLEAN Pushed = (Herd->PushX[i] | Herd->PushY[i]) != 0;
+      if (!Herd->Run[i]) {
+         if (Pushed && Herd->Shoves[i] > 0) {
+            Herd->Shoves[i]--;
+         } else {
+            Herd->PushX[i] = 0;
+            Herd->PushY[i] = 0;
+            Pushed = FALSE;
+         }
+      }
+      Moving += Herd->Run[i] || Pushed;
+
+      // until its frame runs out, the next tick would only count Elapsed
+      // up. a direction change needs the target to move, which wakes it.
+      Herd->Parked[i] = !Herd->Run[i] && !Pushed &&
+                        AnimSettled(Anims, Anim, Wanted);
+      Herd->Due[i] = Herd->Tick + Frame->Duration - Anim->Elapsed;
+   }
+
+   return Moving;
+}
+
+// the running cats move Speed px per tick, spread over the tick's steps,
+// and are pushed off the others as they go, as are cats being shoved. the
+// square roots go first, in
+// a pass of their own, and Dist turns into the length of the way left, 0
+// for a cat that stays.
+static VOID EFIAPI
+HerdMove(NEKO_HERD *Herd, UINTN First, UINTN End) {
+   CONST INT32 *Dx = Herd->Dx;
+   CONST INT32 *Dy = Herd->Dy;
+   CONST INT32 *PushX = Herd->PushX;
+   CONST INT32 *PushY = Herd->PushY;
+   CONST UINT8 *Run = Herd->Run;
+   CONST UINT32 *Active = Herd->Active;
+   UINT32 *Dist = Herd->Dist;
+   INT32 *X = Herd->X;
+   INT32 *Y = Herd->Y;
+   INT64 Scale = (INT64)Herd->Speed * NEKO_FP_ONE;
+   INT32 MaxX = Herd->MaxX << NEKO_FP_SHIFT;
+   INT32 MaxY = Herd->MaxY << NEKO_FP_SHIFT;
+
+   for (UINTN j = First; j < End; j++) {
+      UINT32 i = Active[j];
+      Dist[i] = (Run[i] && Dist[i] > Herd->NearDist) ? UtIntSqrt(Dist[i]) : 0;
+   }
+
+   for (UINTN j = First; j < End; j++) {
+      UINT32 i = Active[j];
+      INT32 Nx = X[i] + PushX[i];
+      INT32 Ny = Y[i] + PushY[i];
+
+      if (Dist[i] != 0) {
+         INT64 Divisor = (INT64)Dist[i] * Herd->TickSteps;
+         Nx += (INT32)((Dx[i] * Scale) / Divisor);
+         Ny += (INT32)((Dy[i] * Scale) / Divisor);
+      }
+
+      X[i] = MIN(MAX(Nx, 0), MaxX);
+      Y[i] = MIN(MAX(Ny, 0), MaxY);
+   }
+}
+
+// every step of the segment in progress for one chunk of the active cats,
+// on whichever processor MpRun hands it to. it keeps to its own cats, so
+// chunks need no locks between them.
+static VOID EFIAPI
+HerdChunk(VOID *Context, UINTN Index) {
+   NEKO_HERD *Herd = Context;
+   UINTN First = Index * NEKO_HERD_CHUNK;
+   UINTN End = MIN(First + NEKO_HERD_CHUNK, Herd->ActiveCount);
+
+   for (UINTN s = 0; s < Herd->StepCount; s++) {
+      for (UINTN j = First; j < End; j++) {
+         UINT32 i = Herd->Active[j];
+         Herd->PrevX[i] = Herd->X[i];
+         Herd->PrevY[i] = Herd->Y[i];
+      }
+
+      HerdMeasure(Herd, First, End);
+      if (s == 0 && Herd->StepInTick == 0) {
+         HerdDirections(Herd, First, End);
+         Herd->ChunkMoving[Index] = HerdAnimate(Herd, First, End);
+      }
+      HerdMove(Herd, First, End);
+   }
+}
+
+// moves the active cats that crossed into another square to its list.
+// parked ones stay where they are.
+static VOID EFIAPI
+HerdIndex(NEKO_HERD *Herd) {
+   for (UINTN j = 0; j < Herd->ActiveCount; j++) {
+      UINT32 i = Herd->Active[j];
+      UINT32 Square = HerdSquareOf(Herd, i);
+
+      if (Square != Herd->Square[i]) {
+         HerdUnlist(Herd, i);
+         HerdList(Herd, i, Square);
+      }
+   }
+}
+
+// the push a cat gets for the tick from the cats within NEKO_HERD_ROOM px,
+// parked or not, which are all in the squares its room reaches. a chunk
+// only reads positions here, so it runs as an MP task of its own before
+// any cat moves.
+static VOID EFIAPI
+HerdSpace(VOID *Context, UINTN Index) {
+   NEKO_HERD *Herd = Context;
+   UINTN First = Index * NEKO_HERD_CHUNK;
+   UINTN End = MIN(First + NEKO_HERD_CHUNK, Herd->ActiveCount);
+   INT32 Room = NEKO_HERD_ROOM;
+
+   for (UINTN j = First; j < End; j++) {
+      UINT32 i = Herd->Active[j];
+      INT32 X = Herd->X[i] >> NEKO_FP_SHIFT;
+      INT32 Y = Herd->Y[i] >> NEKO_FP_SHIFT;
+      UINTN X0 = (UINTN)MAX(X - Room + 1, 0) / Herd->Size;
+      UINTN Y0 = (UINTN)MAX(Y - Room + 1, 0) / Herd->Size;
+      UINTN X1 = MIN((UINTN)(X + Room - 1) / Herd->Size, Herd->GridX - 1);
+      UINTN Y1 = MIN((UINTN)(Y + Room - 1) / Herd->Size, Herd->GridY - 1);
+      UINTN Seen = 0;
+      INT32 PushX = 0;
+      INT32 PushY = 0;
+
+      for (UINTN y = Y0; y <= Y1; y++) {
+         for (UINTN x = X0; x <= X1; x++) {
+            UINT32 Other = Herd->SquareHead[y * Herd->GridX + x];
+
+            for (; Other != NEKO_HERD_NIL && Seen < NEKO_HERD_NEIGHBOURS;
+                 Other = Herd->SquareNext[Other]) {
+               if (Other == i) {
+                  continue;
+               }
+               Seen++;
+
+               INT32 Ax = X - (Herd->X[Other] >> NEKO_FP_SHIFT);
+               INT32 Ay = Y - (Herd->Y[Other] >> NEKO_FP_SHIFT);
+               if (ABS(Ax) >= Room || ABS(Ay) >= Room) {
+                  continue;
+               }
+               // two on the very same pixel split by who is who
+               if (Ax == 0 && Ay == 0) {
+                  Ax = i < Other ? -1 : 1;
+               }
+               PushX += Ax > 0 ? Room - Ax : Ax < 0 ? -Room - Ax : 0;
+               PushY += Ay > 0 ? Room - Ay : Ay < 0 ? -Room - Ay : 0;
+            }
+         }
+      }
+
+      // at most half as fast as it runs, so it still gets through
+      PushX = MIN(MAX(PushX, -Herd->Speed / 2), Herd->Speed / 2);
+      PushY = MIN(MAX(PushY, -Herd->Speed / 2), Herd->Speed / 2);
+      Herd->PushX[i] = (PushX << NEKO_FP_SHIFT) / (INT32)Herd->TickSteps;
+      Herd->PushY[i] = (PushY << NEKO_FP_SHIFT) / (INT32)Herd->TickSteps;
+   }
+}
+
+// one task per chunk of the active cats, on the APs if there are any
+static VOID EFIAPI
+HerdRun(NEKO_HERD *Herd, NEKO_MP_TASK Task, UINTN Chunks) {
+   if (Herd->Mp != NULL) {
+      MpRun(Herd->Mp, Task, Herd, Chunks);
+   } else {
+      for (UINTN c = 0; c < Chunks; c++) {
+         Task(Herd, c);
+      }
+   }
+}
+
+static VOID EFIAPI
+HerdWheelInsert(NEKO_HERD *Herd, UINT32 Cat) {
+   UINT32 Due = Herd->Due[Cat];
+   UINT32 *Slot;
+
+   if (Due - Herd->Tick < NEKO_HERD_WHEEL_SLOTS) {
+      Slot = &Herd->Wheel[0][Due % NEKO_HERD_WHEEL_SLOTS];
+   } else {
+      Slot = &Herd->Wheel[1][(Due >> NEKO_HERD_WHEEL_SHIFT) %
+                             NEKO_HERD_WHEEL_SLOTS];
+   }
+   Herd->Next[Cat] = *Slot;
+   *Slot = Cat;
+}
+
+// Elapsed caught up on the ticks a cat slept through, up to and
+// including Now
+static VOID EFIAPI
+HerdUnpark(NEKO_HERD *Herd, UINT32 Cat, UINT32 Now) {
+   Herd->Anim[Cat].Elapsed =
+      (UINT8)(AnimFrame(Herd->Anims, &Herd->Anim[Cat])->Duration -
+              (Herd->Due[Cat] - Now));
+   Herd->Parked[Cat] = FALSE;
+   Herd->Wakeups++;
+}
+
+// the target moved, which may turn any cat
+static VOID EFIAPI
+HerdWakeAll(NEKO_HERD *Herd) {
+   for (UINTN i = 0; i < Herd->Count; i++) {
+      if (Herd->Parked[i]) {
+         HerdUnpark(Herd, (UINT32)i, Herd->Tick);
+      }
+      Herd->Active[i] = (UINT32)i;
+   }
+   Herd->ActiveCount = Herd->Count;
+   SetMem(Herd->Wheel, sizeof(Herd->Wheel), 0xFF);
+}
+
+// moves on to the next tick: the coarse slot it starts, if any, is spread
+// over the fine one, then the cats whose frame runs out now wake up
+static VOID EFIAPI
+HerdWheelTick(NEKO_HERD *Herd) {
+   UINT32 Tick = ++Herd->Tick;
+   UINT32 Cat;
+
+   if (Tick % NEKO_HERD_WHEEL_SLOTS == 0) {
+      UINT32 *Coarse = &Herd->Wheel[1][(Tick >> NEKO_HERD_WHEEL_SHIFT) %
+                                       NEKO_HERD_WHEEL_SLOTS];
+      Cat = *Coarse;
+      *Coarse = NEKO_HERD_NIL;
+      while (Cat != NEKO_HERD_NIL) {
+         UINT32 Next = Herd->Next[Cat];
+         HerdWheelInsert(Herd, Cat);
+         Cat = Next;
+      }
+   }
+
+   UINT32 *Fine = &Herd->Wheel[0][Tick % NEKO_HERD_WHEEL_SLOTS];
+   Cat = *Fine;
+   *Fine = NEKO_HERD_NIL;
+   while (Cat != NEKO_HERD_NIL) {
+      UINT32 Next = Herd->Next[Cat];
+      HerdUnpark(Herd, Cat, Tick - 1);
+      Herd->Active[Herd->ActiveCount++] = Cat;
+      Cat = Next;
+   }
+}
+
+// after a tick: the cats HerdAnimate found settled leave the active list
+// for the wheel. they do not move while parked, so they are interpolated
+// for the last time here, and drawn once more through Settled.
+static VOID EFIAPI
+HerdPark(NEKO_HERD *Herd) {
+   UINTN Kept = 0;
+
+   for (UINTN j = 0; j < Herd->ActiveCount; j++) {
+      UINT32 i = Herd->Active[j];
+
+      if (!Herd->Parked[i]) {
+         Herd->Active[Kept++] = i;
+         continue;
+      }
+
+      HerdWheelInsert(Herd, i);
+      Herd->DrawX[i] = (Herd->X[i] + NEKO_FP_ONE / 2) >> NEKO_FP_SHIFT;
+      Herd->DrawY[i] = (Herd->Y[i] + NEKO_FP_ONE / 2) >> NEKO_FP_SHIFT;
+      if (!Herd->Listed[i]) {
+         Herd->Listed[i] = TRUE;
+         Herd->Settled[Herd->SettledCount++] = i;
+      }
+   }
+   Herd->ActiveCount = Kept;
+}
+
+// Steps simulation steps for every cat, the batched NekoSimStep. the
+// target is where the main cat heads, in px, and StepInTick says where in
+// the tick the first step falls; a step at 0 runs the animation. the
+// steps go out one tick's worth at a time, and each MpRun is the only
+// point the processors wait for each other. parked cats are not visited.
+// a tick starts by bringing the index up to date and working out the
+// pushes from it.
+VOID EFIAPI
+HerdStep(NEKO_HERD *Herd, INT32 TargetX, INT32 TargetY, UINTN StepInTick,
+         UINTN Steps) {
+   if (Herd->Count == 0 || Steps == 0) {
+      return;
+   }
+
+   UINT64 Start = ClkTicks();
+   Herd->Steps += Steps;
+
+   if (TargetX != Herd->TargetX || TargetY != Herd->TargetY) {
+      HerdWakeAll(Herd);
+      SetMem(Herd->Shoves, Herd->Count, NEKO_HERD_SHOVES);
+      Herd->TargetX = TargetX;
+      Herd->TargetY = TargetY;
+   }
+
+   while (Steps > 0) {
+      UINTN Segment = MIN(Steps, Herd->TickSteps - StepInTick);
+
+      if (StepInTick == 0) {
+         HerdWheelTick(Herd);
+      }
+
+      UINTN Chunks = (Herd->ActiveCount + NEKO_HERD_CHUNK - 1) /
+                     NEKO_HERD_CHUNK;
+      if (StepInTick == 0) {
+         HerdIndex(Herd);
+         HerdRun(Herd, HerdSpace, Chunks);
+      }
+
+      Herd->StepInTick = StepInTick;
+      Herd->StepCount = Segment;
+      HerdRun(Herd, HerdChunk, Chunks);
+
+      if (StepInTick == 0) {
+         Herd->Moving = 0;
+         for (UINTN c = 0; c < Chunks; c++) {
+            Herd->Moving += Herd->ChunkMoving[c];
+         }
+         HerdPark(Herd);
+      }
+
+      Steps -= Segment;
+      StepInTick = 0;
+   }
+
+   Herd->StepTicks += ClkTicks() - Start;
+}
+
+// animation ticks until a parked cat wakes up, 1 while any cat is active
+// and 0 with none at all. a cat in the coarse wheel counts from the tick
+// its slot is spread out.
+UINTN EFIAPI
+HerdTicksToDeadline(NEKO_HERD *Herd) {
+   if (Herd->ActiveCount != 0) {
+      return 1;
+   }
+
+   for (UINT32 d = 1; d <= NEKO_HERD_WHEEL_SLOTS; d++) {
+      if (Herd->Wheel[0][(Herd->Tick + d) % NEKO_HERD_WHEEL_SLOTS] !=
+          NEKO_HERD_NIL) {
+         return d;
+      }
+   }
+   for (UINT32 d = 1; d <= NEKO_HERD_WHEEL_SLOTS; d++) {
+      UINT32 Coarse = (Herd->Tick >> NEKO_HERD_WHEEL_SHIFT) + d;
+      if (Herd->Wheel[1][Coarse % NEKO_HERD_WHEEL_SLOTS] != NEKO_HERD_NIL) {
+         return (Coarse << NEKO_HERD_WHEEL_SHIFT) - Herd->Tick;
+      }
+   }
+   return 0;
+}
+
+// starts a cat on a sequence, from its first frame unless told otherwise.
+// it stays put for the rest of the tick.
+static VOID EFIAPI
+HerdStart(NEKO_HERD *Herd, UINT32 Cat, UINT8 Sequence, UINT8 Index) {
+   AnimStart(Herd->Anims, &Herd->Anim[Cat], Sequence, Index);
+   Herd->Run[Cat] = FALSE;
+   Herd->Cell[Cat] = AnimFrame(Herd->Anims, &Herd->Anim[Cat])->Cell;
+}
+
+// the idle sequence ends in the loop it sleeps in
+static UINT8 EFIAPI
+HerdSleepFrame(NEKO_HERD *Herd) {
+   CONST NEKO_ANIM_SEQUENCE *Idle = &Herd->Anims->Sequences[NEKO_ANIM_IDLE];
+
+   return Herd->Anims->Frames[Idle->First + Idle->Count - 1].Back;
+}
+
+// a click at X, Y. every cat drawn under it reacts, found through the
+// index: it lists a cat by where it was at the start of the tick, and it
+// may be drawn up to a tick's run further on, so the squares around the
+// clicked one are looked at too. returns how many were hit.
+UINTN EFIAPI
+HerdPoke(NEKO_HERD *Herd, INT32 X, INT32 Y, NEKO_HERD_POKE Poke) {
+   INT32 Size = Herd->Size;
+   UINTN Hit = 0;
+
+   if (Herd->Count == 0 || X < 0 || Y < 0) {
+      return 0;
+   }
+
+   UINTN Sx = MIN((UINTN)X / Size, Herd->GridX - 1);
+   UINTN Sy = MIN((UINTN)Y / Size, Herd->GridY - 1);
+   for (UINTN y = Sy > 1 ? Sy - 2 : 0;
+        y <= MIN(Sy + 1, Herd->GridY - 1); y++) {
+      for (UINTN x = Sx > 1 ? Sx - 2 : 0;
+           x <= MIN(Sx + 1, Herd->GridX - 1); x++) {
+         UINT32 Cat = Herd->SquareHead[y * Herd->GridX + x];
+
+         for (; Cat != NEKO_HERD_NIL; Cat = Herd->SquareNext[Cat]) {
+            if (X < Herd->DrawX[Cat] || X >= Herd->DrawX[Cat] + Size ||
+                Y < Herd->DrawY[Cat] || Y >= Herd->DrawY[Cat] + Size) {
+               continue;
+            }
+
+            // clicks are rare enough to take them all out of the wheel
+            // rather than look for one
+            if (Herd->Parked[Cat]) {
+               HerdWakeAll(Herd);
+            }
+
+            if (Poke == NEKO_HERD_POKE_STARTLE) {
+               Herd->OffX[Cat] = (INT32)(HerdRandom(Herd) %
+                                         (2 * NEKO_HERD_SPREAD + 1))
+                               - NEKO_HERD_SPREAD;
+               Herd->OffY[Cat] = (INT32)(HerdRandom(Herd) %
+                                         (2 * NEKO_HERD_SPREAD + 1))
+                               - NEKO_HERD_SPREAD;
+               HerdStart(Herd, Cat, NEKO_ANIM_STARTLED, 0);
+               Herd->Shoves[Cat] = NEKO_HERD_SHOVES;
+            } else {
+               // its spot moves under it, or it would be up again
+               // the next tick
+               if (Herd->TargetX != MIN_INT32) {
+                  Herd->OffX[Cat] = (Herd->X[Cat] >> NEKO_FP_SHIFT) -
+                                    Herd->TargetX;
+                  Herd->OffY[Cat] = (Herd->Y[Cat] >> NEKO_FP_SHIFT) -
+                                    Herd->TargetY;
+               }
+               HerdStart(Herd, Cat, NEKO_ANIM_IDLE, HerdSleepFrame(Herd));
+            }
+            Hit++;
+         }
+      }
+   }
+
+   return Hit;
+}
+
+// a skin with animations of its own. where a cat was in other sequences
+// means nothing in these, so every cat starts over idle and awake. in the
+// same ones it only shows another sprite.
+VOID EFIAPI
+HerdAnims(NEKO_HERD *Herd, CONST NEKO_ANIMS *Anims) {
+   if (Herd->Anims == Anims) {
+      return;
+   }
+
+   if (Herd->Anims != NULL && AnimSameShape(Herd->Anims, Anims)) {
+      Herd->Anims = Anims;
+      for (UINTN i = 0; i < Herd->Count; i++) {
+         Herd->Cell[i] = AnimFrame(Anims, &Herd->Anim[i])->Cell;
+      }
+      return;
+   }
+
+   Herd->Anims = Anims;
+   SetMem(Herd->Wheel, sizeof(Herd->Wheel), 0xFF);
+   for (UINTN i = 0; i < Herd->Count; i++) {
+      Herd->Parked[i] = FALSE;
+      Herd->Active[i] = (UINT32)i;
+      HerdStart(Herd, (UINT32)i, NEKO_ANIM_IDLE, 0);
+   }
+   Herd->ActiveCount = Herd->Count;
+}
+
+// where each active cat is drawn, Alpha ms of StepMs past its last step
+VOID EFIAPI
+HerdInterpolate(NEKO_HERD *Herd, INT32 Alpha, INT32 StepMs) {
+   CONST INT32 *X = Herd->X;
+   CONST INT32 *Y = Herd->Y;
+   CONST INT32 *PrevX = Herd->PrevX;
+   CONST INT32 *PrevY = Herd->PrevY;
+   INT32 *DrawX = Herd->DrawX;
+   INT32 *DrawY = Herd->DrawY;
+
+   for (UINTN j = 0; j < Herd->ActiveCount; j++) {
+      UINT32 i = Herd->Active[j];
+      INT32 Px = PrevX[i] + (X[i] - PrevX[i]) * Alpha / StepMs;
+      INT32 Py = PrevY[i] + (Y[i] - PrevY[i]) * Alpha / StepMs;
+
+      DrawX[i] = (Px + NEKO_FP_ONE / 2) >> NEKO_FP_SHIFT;
+      DrawY[i] = (Py + NEKO_FP_ONE / 2) >> NEKO_FP_SHIFT;
+   }
+}
+
+// the grid squares a rect covers. FALSE if it is off the grid.
+static BOOLEAN EFIAPI
+HerdSquares(NEKO_HERD *Herd, INT32 X, INT32 Y, INT32 Width, INT32 Height,
+            UINTN *X0, UINTN *Y0, UINTN *X1, UINTN *Y1) {
+   if (Herd->Dirty == NULL || Width <= 0 || Height <= 0 ||
+       X + Width <= 0 || Y + Height <= 0) {
+      return FALSE;
+   }
+
+   *X0 = (UINTN)MAX(X, 0) / Herd->Size;
+   *Y0 = (UINTN)MAX(Y, 0) / Herd->Size;
+   *X1 = MIN((UINTN)(X + Width - 1) / Herd->Size, Herd->GridX - 1);
+   *Y1 = MIN((UINTN)(Y + Height - 1) / Herd->Size, Herd->GridY - 1);
+
+   return *X0 <= *X1 && *Y0 <= *Y1;
+}
+
+VOID EFIAPI
+HerdMarkDirty(NEKO_HERD *Herd, INT32 X, INT32 Y, INT32 Width, INT32 Height) {
+   UINTN X0;
+   UINTN Y0;
+   UINTN X1;
+   UINTN Y1;
+
+   if (!HerdSquares(Herd, X, Y, Width, Height, &X0, &Y0, &X1, &Y1)) {
+      return;
+   }
+
+   for (UINTN y = Y0; y <= Y1; y++) {
+      for (UINTN x = X0; x <= X1; x++) {
+         UINTN Square = y * Herd->GridX + x;
+
+         if (!Herd->Dirty[Square]) {
+            Herd->Dirty[Square] = 1;
+            Herd->DirtySquares[Herd->DirtyCount++] = (UINT32)Square;
+         }
+      }
+   }
+}
+
+BOOLEAN EFIAPI
+HerdTouches(NEKO_HERD *Herd, INT32 X, INT32 Y, INT32 Width, INT32 Height) {
+   UINTN X0;
+   UINTN Y0;
+   UINTN X1;
+   UINTN Y1;
+
+   if (!HerdSquares(Herd, X, Y, Width, Height, &X0, &Y0, &X1, &Y1)) {
+      return FALSE;
+   }
+
+   for (UINTN y = Y0; y <= Y1; y++) {
+      for (UINTN x = X0; x <= X1; x++) {
+         if (Herd->Dirty[y * Herd->GridX + x]) {
+            return TRUE;
+         }
+      }
+   }
+   return FALSE;
+}
+
+static BOOLEAN EFIAPI
+HerdDrawnOver(NEKO_HERD *Herd, UINT32 Cat, INT32 X, INT32 Y, INT32 Width,
+              INT32 Height) {
+   return Herd->DrawnCell[Cat] != NEKO_HERD_UNDRAWN &&
+          X < Herd->DrawnX[Cat] + Herd->Size &&
+          Herd->DrawnX[Cat] < X + Width &&
+          Y < Herd->DrawnY[Cat] + Herd->Size &&
+          Herd->DrawnY[Cat] < Y + Height;
+}
+
+// whether a cat is on screen under a rect, as HerdCommit left it. the
+// ones that changed since are all active or settled, the others are found
+// through the index as HerdPoke finds them.
+BOOLEAN EFIAPI
+HerdDrawnUnder(NEKO_HERD *Herd, INT32 X, INT32 Y, INT32 Width,
+               INT32 Height) {
+   UINTN X0;
+   UINTN Y0;
+   UINTN X1;
+   UINTN Y1;
+
+   if (!HerdSquares(Herd, X, Y, Width, Height, &X0, &Y0, &X1, &Y1)) {
+      return FALSE;
+   }
+
+   for (UINTN y = Y0 > 1 ? Y0 - 2 : 0;
+        y <= MIN(Y1 + 1, Herd->GridY - 1); y++) {
+      for (UINTN x = X0 > 1 ? X0 - 2 : 0;
+           x <= MIN(X1 + 1, Herd->GridX - 1); x++) {
+         UINT32 Cat = Herd->SquareHead[y * Herd->GridX + x];
+
+         for (; Cat != NEKO_HERD_NIL; Cat = Herd->SquareNext[Cat]) {
+            if (HerdDrawnOver(Herd, Cat, X, Y, Width, Height)) {
+               return TRUE;
+            }
+         }
+      }
+   }
+
+   for (UINTN j = 0; j < Herd->ActiveCount; j++) {
+      if (HerdDrawnOver(Herd, Herd->Active[j], X, Y, Width, Height)) {
+         return TRUE;
+      }
+   }
+   for (UINTN k = 0; k < Herd->SettledCount; k++) {
+      if (HerdDrawnOver(Herd, Herd->Settled[k], X, Y, Width, Height)) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+// a cat that moved or changed frame is erased where it was and drawn
+// where it is
+static VOID EFIAPI
+HerdCheck(NEKO_HERD *Herd, UINT32 Cat) {
+   INT32 Size = Herd->Size;
+
+   if (!Herd->Invalid &&
+       Herd->DrawX[Cat] == Herd->DrawnX[Cat] &&
+       Herd->DrawY[Cat] == Herd->DrawnY[Cat] &&
+       Herd->Cell[Cat] == Herd->DrawnCell[Cat]) {
+      return;
+   }
+
+   Herd->Changed[Herd->ChangedCount++] = Cat;
+   if (Herd->DrawnCell[Cat] != NEKO_HERD_UNDRAWN) {
+      HerdMarkDirty(Herd, Herd->DrawnX[Cat], Herd->DrawnY[Cat], Size, Size);
+   }
+   HerdMarkDirty(Herd, Herd->DrawX[Cat], Herd->DrawY[Cat], Size, Size);
+}
+
+// what the coming frame has to do, on top of whatever the caller marked
+// dirty. only active cats and those parked since HerdCommit can have
+// changed. every cat touching a square that got dirty on the way is drawn
+// again, counting-sorted by atlas frame into Order so each frame's pixels
+// are read while still in cache. returns how many.
+UINTN EFIAPI
+HerdPlan(NEKO_HERD *Herd) {
+   UINT32 Start[NEKO_ANIM_CELLS];
+   UINTN WalkCount = 0;
+   UINTN Count = 0;
+
+   Herd->ChangedCount = 0;
+   if (Herd->Invalid) {
+      for (UINTN i = 0; i < Herd->Count; i++) {
+         HerdCheck(Herd, (UINT32)i);
+      }
+      Herd->Invalid = FALSE;
+   } else {
+      for (UINTN j = 0; j < Herd->ActiveCount; j++) {
+         HerdCheck(Herd, Herd->Active[j]);
+      }
+      // the rest of them woke up again and were checked above
+      for (UINTN k = 0; k < Herd->SettledCount; k++) {
+         if (Herd->Parked[Herd->Settled[k]]) {
+            HerdCheck(Herd, Herd->Settled[k]);
+         }
+      }
+   }
+
+   if (Herd->DirtyCount == 0) {
+      return 0;
+   }
+
+   // the cats that may touch a dirty square are found through the index,
+   // looking as far around it as HerdPoke does around a click
+   for (UINTN k = 0; k < Herd->DirtyCount; k++) {
+      UINTN Sx = Herd->DirtySquares[k] % Herd->GridX;
+      UINTN Sy = Herd->DirtySquares[k] / Herd->GridX;
+
+      for (UINTN y = Sy > 1 ? Sy - 2 : 0;
+           y <= MIN(Sy + 1, Herd->GridY - 1); y++) {
+         for (UINTN x = Sx > 1 ? Sx - 2 : 0;
+              x <= MIN(Sx + 1, Herd->GridX - 1); x++) {
+            UINTN Square = y * Herd->GridX + x;
+
+            if (!Herd->Walked[Square] &&
+                Herd->SquareHead[Square] != NEKO_HERD_NIL) {
+               Herd->Walked[Square] = 1;
+               Herd->Walk[WalkCount++] = (UINT32)Square;
+            }
+         }
+      }
+   }
+
+   ZeroMem(Start, sizeof(Start));
+   for (UINTN w = 0; w < WalkCount; w++) {
+      UINT32 Cat = Herd->SquareHead[Herd->Walk[w]];
+
+      for (; Cat != NEKO_HERD_NIL; Cat = Herd->SquareNext[Cat]) {
+         Herd->Redraw[Cat] = HerdTouches(Herd, Herd->DrawX[Cat],
+                                         Herd->DrawY[Cat], Herd->Size,
+                                         Herd->Size);
+         Start[Herd->Cell[Cat]] += Herd->Redraw[Cat];
+      }
+   }
+
+   for (UINTN c = 0; c < NEKO_ANIM_CELLS; c++) {
+      UINT32 Cats = Start[c];
+      Start[c] = (UINT32)Count;
+      Count += Cats;
+   }
+
+   for (UINTN w = 0; w < WalkCount; w++) {
+      UINT32 Cat = Herd->SquareHead[Herd->Walk[w]];
+
+      for (; Cat != NEKO_HERD_NIL; Cat = Herd->SquareNext[Cat]) {
+         if (Herd->Redraw[Cat]) {
+            Herd->Order[Start[Herd->Cell[Cat]]++] = Cat;
+         }
+      }
+      Herd->Walked[Herd->Walk[w]] = 0;
+   }
+
+   Herd->Draws += Count;
+   return Count;
+}
+
+// once the frame HerdPlan described is on screen
+VOID EFIAPI
+HerdCommit(NEKO_HERD *Herd) {
+   for (UINTN k = 0; k < Herd->ChangedCount; k++) {
+      UINT32 i = Herd->Changed[k];
+
+      Herd->DrawnX[i] = Herd->DrawX[i];
+      Herd->DrawnY[i] = Herd->DrawY[i];
+      Herd->DrawnCell[i] = Herd->Cell[i];
+   }
+   Herd->ChangedCount = 0;
+
+   for (UINTN k = 0; k < Herd->SettledCount; k++) {
+      Herd->Listed[Herd->Settled[k]] = FALSE;
+   }
+   Herd->SettledCount = 0;
+
+   for (UINTN k = 0; k < Herd->DirtyCount; k++) {
+      Herd->Dirty[Herd->DirtySquares[k]] = 0;
+   }
+   Herd->DirtyCount = 0;
+}
+
+VOID EFIAPI
+HerdFree(NEKO_HERD *Herd) {
+   if (Herd->Pool != NULL) {
+      FreePool(Herd->Pool);
+   }
+   ZeroMem(Herd, sizeof(NEKO_HERD));
+}
+
+// puts every cat right at its spot around the target, so the next tick
+// finds them all settled
+static VOID EFIAPI
+HerdSettle(NEKO_HERD *Herd, INT32 TargetX, INT32 TargetY) {
+   for (UINTN i = 0; i < Herd->Count; i++) {
+      INT32 X = MIN(MAX(TargetX + Herd->OffX[i], 0), Herd->MaxX);
+      INT32 Y = MIN(MAX(TargetY + Herd->OffY[i], 0), Herd->MaxY);
+
+      Herd->X[i] = X << NEKO_FP_SHIFT;
+      Herd->Y[i] = Y << NEKO_FP_SHIFT;
+      Herd->PrevX[i] = Herd->X[i];
+      Herd->PrevY[i] = Herd->Y[i];
+   }
+
+   // they are all listed where they were, so they all get looked at
+   Herd->TargetX = MIN_INT32;
+}
+
+// Ticks animation ticks of the herd in the given state, each planned as a
+// frame would be. running cats chase a target that jumps every tick; idle
+// ones have just arrived at their spots, and sleeping ones had
+// NEKO_HERD_BENCH_NAP ticks more to doze off. returns the cost in ns per
+// tick.
+UINT64 EFIAPI
+HerdBench(NEKO_HERD *Herd, UINTN Ticks, NEKO_HERD_BENCH Mode) {
+   INT32 TargetX = Herd->MaxX / 2;
+   INT32 TargetY = Herd->MaxY / 2;
+
+   if (Herd->Count == 0 || Ticks == 0) {
+      return 0;
+   }
+
+   if (Mode != NEKO_HERD_BENCH_RUN) {
+      HerdSettle(Herd, TargetX, TargetY);
+      HerdStep(Herd, TargetX, TargetY, 0, Herd->TickSteps);
+   }
+   if (Mode == NEKO_HERD_BENCH_ASLEEP) {
+      for (UINTN t = 0; t < NEKO_HERD_BENCH_NAP; t++) {
+         HerdStep(Herd, TargetX, TargetY, 0, Herd->TickSteps);
+      }
+   }
+
+   UINT64 Start = ClkTicks();
+   for (UINTN t = 0; t < Ticks; t++) {
+      if (Mode == NEKO_HERD_BENCH_RUN) {
+         TargetX = (INT32)(HerdRandom(Herd) % (Herd->MaxX + 1));
+         TargetY = (INT32)(HerdRandom(Herd) % (Herd->MaxY + 1));
+      }
+
+      HerdStep(Herd, TargetX, TargetY, 0, Herd->TickSteps);
+      HerdInterpolate(Herd, 1, 2);
+      HerdPlan(Herd);
+      HerdCommit(Herd);
+   }
+   UINT64 Us = ClkTicksToUs(ClkTicks() - Start);
+
+   return DivU64x64Remainder(MultU64x32(Us, 1000), Ticks, NULL);
+}
@@ -0,0 +1,188 @@
+#ifndef __NEKO_HERD_H__
+#define __NEKO_HERD_H__
+
+#include "Mp.h"
+#include "Anim.h"
+
+// extra cats for --cats. they chase the cursor by the main cat's rules,
+// each to its own spot around it, but every field is one array over all of
+// them so each pass below runs down memory in order and the compiler can
+// vectorize it. positions are 16.16, in 32 bits.
+#define NEKO_HERD_SPREAD 96      // px from the cursor a cat may settle
+#define NEKO_HERD_UNDRAWN NEKO_ANIM_NO_CELL // a DrawnCell for cats not drawn
+
+// the active cats are stepped in chunks of this many, one MP task each.
+// cats only look at each other in a pass before anyone moves, so a chunk
+// runs every step of a tick on its own and only writes its own cats. a
+// multiple of 64, so while every cat is active no two chunks share a cache
+// line of any array.
+#define NEKO_HERD_CHUNK 256
+
+// a settled cat, one that neither runs nor is about to turn, changes only
+// once its frame runs out. it is parked in a timer wheel under that tick
+// and not visited until then, or until the target moves. a fine wheel of
+// one tick per slot, over a coarse one of NEKO_HERD_WHEEL_SLOTS ticks.
+#define NEKO_HERD_WHEEL_SLOTS 64
+#define NEKO_HERD_WHEEL_SHIFT 6
+#define NEKO_HERD_NIL MAX_UINT32
+
+// every cat is listed under the grid square its corner is in, and moved to
+// another list only when it crosses over, so a tick costs as many updates
+// as there are active cats. a running cat shies from the others within
+// NEKO_HERD_ROOM px, looking at no more than NEKO_HERD_NEIGHBOURS of those
+// in the squares within that reach, however many are piled up there. one
+// that has arrived may still be shoved aside, but only NEKO_HERD_SHOVES
+// ticks each time the target moves, so a crowd always comes to rest.
+#define NEKO_HERD_ROOM 12
+#define NEKO_HERD_NEIGHBOURS 16
+#define NEKO_HERD_SHOVES 8
+
+// HerdBench's sleeping cats get this many ticks to doze off first
+#define NEKO_HERD_BENCH_NAP 64
+
+typedef enum {
+   NEKO_HERD_BENCH_RUN,
+   NEKO_HERD_BENCH_IDLE,
+   NEKO_HERD_BENCH_ASLEEP,
+} NEKO_HERD_BENCH;
+
+// what a click does to the cats under it
+typedef enum {
+   NEKO_HERD_POKE_STARTLE, // they jump and make off for a new spot
+   NEKO_HERD_POKE_SLEEP,   // they doze off where they are
+} NEKO_HERD_POKE;
+
+typedef struct {
+   UINTN Count;
+   INT32 MaxX;             // the furthest a cat's corner may go
+   INT32 MaxY;
+   INT32 Size;             // px, of a cat and of a dirty square
+   INT32 Speed;            // px per tick
+   UINT32 NearDist;        // squared px within which a cat stays put
+   UINTN TickSteps;
+   UINT32 Seed;
+   UINTN Moving;           // cats that run or are shoved this tick
+   NEKO_MP *Mp;            // NULL to step on the BSP alone
+   CONST NEKO_ANIMS *Anims;
+
+   // the HerdStep in progress, for the chunks
+   INT32 TargetX;
+   INT32 TargetY;
+   UINTN StepInTick;
+   UINTN StepCount;
+   UINTN Chunks;
+   UINT32 *ChunkMoving;
+
+   UINT32 Tick;            // animation ticks run so far
+   UINT32 Wheel[2][NEKO_HERD_WHEEL_SLOTS];
+   UINT32 *Next;           // in a wheel slot's list
+   UINT32 *Due;            // the tick a parked cat's frame runs out
+   UINT8 *Parked;
+   UINT32 *Active;         // the cats not parked, in no particular order
+   UINTN ActiveCount;
+   UINT32 *Settled;        // parked since HerdCommit, to be drawn once more
+   UINTN SettledCount;
+   UINT8 *Listed;          // on Settled
+   UINT64 Wakeups;
+
+   INT32 *X;
+   INT32 *Y;
+   INT32 *PrevX;           // before the last step
+   INT32 *PrevY;
+   INT32 *OffX;            // where around the cursor each cat heads
+   INT32 *OffY;
+   UINT8 *Shoves;          // ticks left to be shoved once arrived
+
+   // the spatial index, over the grid below
+   UINT32 *Square;         // the one a cat is listed under
+   UINT32 *SquareNext;
+   UINT32 *SquarePrev;
+   UINT32 *SquareHead;     // per square, NEKO_HERD_NIL if empty
+
+   // scratch for the step in progress
+   INT32 *Dx;
+   INT32 *Dy;
+   UINT32 *Dist;
+   UINT8 *Direction;
+   INT32 *PushX;           // 16.16 px per step, away from the others
+   INT32 *PushY;
+
+   NEKO_ANIM_STATE *Anim;
+   UINT8 *Run;
+   UINT8 *Cell;            // the frame's, of NEKO_ANIM_CELLS
+
+   // where a cat is drawn this frame, and where it was drawn last
+   INT32 *DrawX;
+   INT32 *DrawY;
+   INT32 *DrawnX;
+   INT32 *DrawnY;
+   UINT8 *DrawnCell;
+   BOOLEAN Invalid;        // everything gets drawn again
+
+   // HerdPlan's results: the cats that moved or changed frame, and the
+   // ones to draw, grouped by atlas frame
+   UINT32 *Changed;
+   UINTN ChangedCount;
+   UINT32 *Order;
+   UINT8 *Redraw;
+
+   // a grid of Size px squares; a cat touching a dirty one is redrawn.
+   // DirtySquares lists the ones marked since HerdCommit.
+   UINT8 *Dirty;
+   UINT32 *DirtySquares;
+   UINTN DirtyCount;
+   UINT8 *Walked;          // scratch for HerdPlan, per square
+   UINT32 *Walk;
+   UINTN GridX;
+   UINTN GridY;
+
+   UINT64 Steps;
+   UINT64 StepTicks;       // ClkTicks() spent in HerdStep
+   UINT64 Draws;
+   VOID *Pool;
+} NEKO_HERD;
+
+EFI_STATUS EFIAPI
+HerdInit(NEKO_HERD *Herd, UINTN Count, INT32 ScrX, INT32 ScrY, INT32 Size,
+         INT32 Speed, UINT32 NearDist, UINTN TickSteps,
+         CONST NEKO_ANIMS *Anims, NEKO_MP *Mp);
+
+VOID EFIAPI
+HerdAnims(NEKO_HERD *Herd, CONST NEKO_ANIMS *Anims);
+
+VOID EFIAPI
+HerdStep(NEKO_HERD *Herd, INT32 TargetX, INT32 TargetY, UINTN StepInTick,
+         UINTN Steps);
+
+VOID EFIAPI
+HerdInterpolate(NEKO_HERD *Herd, INT32 Alpha, INT32 StepMs);
+
+VOID EFIAPI
+HerdMarkDirty(NEKO_HERD *Herd, INT32 X, INT32 Y, INT32 Width, INT32 Height);
+
+BOOLEAN EFIAPI
+HerdTouches(NEKO_HERD *Herd, INT32 X, INT32 Y, INT32 Width, INT32 Height);
+
+BOOLEAN EFIAPI
+HerdDrawnUnder(NEKO_HERD *Herd, INT32 X, INT32 Y, INT32 Width,
+               INT32 Height);
+
+UINTN EFIAPI
+HerdPoke(NEKO_HERD *Herd, INT32 X, INT32 Y, NEKO_HERD_POKE Poke);
+
+UINTN EFIAPI
+HerdPlan(NEKO_HERD *Herd);
+
+VOID EFIAPI
+HerdCommit(NEKO_HERD *Herd);
+
+VOID EFIAPI
+HerdFree(NEKO_HERD *Herd);
+
+UINTN EFIAPI
+HerdTicksToDeadline(NEKO_HERD *Herd);
+
+UINT64 EFIAPI
+HerdBench(NEKO_HERD *Herd, UINTN Ticks, NEKO_HERD_BENCH Mode);
+
+#endif // __NEKO_HERD_H__
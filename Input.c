@@ -0,0 +1,259 @@
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+
+#include "Input.h"
+#include "Clock.h"
+
+#define INPUT_RING_MASK (NEKO_INPUT_RING_SIZE - 1)
+
+// key notify functions get no context, so only one NEKO_INPUT can own the
+// hotkeys at a time
+static NEKO_INPUT *mHotkeyInput = NULL;
+
+// producer side, always at NEKO_INPUT_TPL so producers never interleave. a
+// full ring drops the new sample rather than overwriting one the consumer
+// may be copying out.
+static BOOLEAN EFIAPI
+InputPush(NEKO_INPUT_RING *Ring, NEKO_INPUT_SAMPLE *Sample) {
+   UINT32 Head = Ring->Head;
+   UINT32 Depth = Head - Ring->Tail;
+
+   if (Depth >= NEKO_INPUT_RING_SIZE) {
+      Ring->Overflows++;
+      return FALSE;
+   }
+
+   CopyMem(&Ring->Samples[Head & INPUT_RING_MASK], Sample,
+           sizeof(NEKO_INPUT_SAMPLE));
+   // the sample must be complete before the consumer can see it
+   MemoryFence();
+   Ring->Head = Head + 1;
+
+   Ring->Pushed++;
+   Ring->MaxDepth = MAX(Ring->MaxDepth, Depth + 1);
+   return TRUE;
+}
+
+// full rate, or suspended: either stopped or probing slowly. runs at
+// NEKO_INPUT_TPL.
+static VOID EFIAPI
+InputSetRate(NEKO_INPUT *Input, BOOLEAN Suspend) {
+   Input->Suspended = Suspend;
+   Input->IdleSamples = 0;
+
+   if (!Suspend) {
+      gBS->SetTimer(Input->Timer, TimerPeriodic, Input->Interval);
+   } else if (PointerAllSignal(Input->Pointers)) {
+      gBS->SetTimer(Input->Timer, TimerCancel, 0);
+   } else {
+      gBS->SetTimer(Input->Timer, TimerPeriodic, NEKO_INPUT_PROBE_INTERVAL);
+   }
+}
+
+static VOID EFIAPI
+InputSample(EFI_EVENT Event, VOID *Context) {
+   NEKO_INPUT *Input = Context;
+   NEKO_POINTERS *Pointers = Input->Pointers;
+   NEKO_INPUT_SAMPLE Sample;
+   BOOLEAN Pushed = FALSE;
+   BOOLEAN Any = FALSE;
+
+   Input->Wakeups++;
+
+   ZeroMem(&Sample, sizeof(Sample));
+   Sample.Time = ClkTicks();
+   Sample.Type = NEKO_SAMPLE_POINTER;
+
+   // devices are appended with Count published after the device, so the
+   // list can grow under us without a lock. they are only dropped at
+   // NEKO_INPUT_TPL, never while this runs.
+   UINTN Count = Pointers->Count;
+   for (UINTN i = 0; i < Count; i++) {
+      Any |= PointerRead(Pointers, i, &Sample.Pointer);
+   }
+   if (Any) {
+      Pushed |= InputPush(&Input->Ring, &Sample);
+   }
+
+   if (Input->ConIn != NULL) {
+      // bounded, a misbehaving driver must not keep us at high TPL
+      for (UINTN i = 0; i < NEKO_INPUT_RING_SIZE; i++) {
+         ZeroMem(&Sample, sizeof(Sample));
+         if (Input->ConIn->ReadKeyStroke(Input->ConIn, &Sample.Key)
+             != EFI_SUCCESS) {
+            break;
+         }
+         Sample.Time = ClkTicks();
+         Sample.Type = NEKO_SAMPLE_KEY;
+         Pushed |= InputPush(&Input->Ring, &Sample);
+      }
+   }
+
+   if (Pushed) {
+      Input->IdleSamples = 0;
+      if (Input->Suspended) {
+         InputSetRate(Input, FALSE);
+      }
+   } else if (Input->Tickless && !Input->Suspended && Input->ConIn == NULL &&
+              ++Input->IdleSamples >= NEKO_INPUT_IDLE_SAMPLES) {
+      // the owner has to learn that it should wait on the devices now
+      InputSetRate(Input, TRUE);
+      Pushed = TRUE;
+   }
+
+   if (Pushed) {
+      gBS->SignalEvent(Input->ReadyEvent);
+   }
+}
+
+// runs at whatever TPL the keyboard driver notifies at, TPL_CALLBACK in
+// practice, so it steps up to NEKO_INPUT_TPL before touching the ring
+static EFI_STATUS EFIAPI
+InputHotkey(EFI_KEY_DATA *KeyData) {
+   NEKO_INPUT *Input = mHotkeyInput;
+   NEKO_INPUT_SAMPLE Sample;
+
+   if (Input == NULL) {
+      return EFI_SUCCESS;
+   }
+   // a console that matches on the key alone must not let a host's own
+   // typing through
+   if ((KeyData->KeyState.KeyShiftState & Input->HotkeyShift) !=
+       Input->HotkeyShift) {
+      return EFI_SUCCESS;
+   }
+
+   ZeroMem(&Sample, sizeof(Sample));
+   Sample.Time = ClkTicks();
+   Sample.Type = NEKO_SAMPLE_KEY;
+   Sample.Key = KeyData->Key;
+
+   EFI_TPL OldTpl = gBS->RaiseTPL(NEKO_INPUT_TPL);
+   BOOLEAN Pushed = InputPush(&Input->Ring, &Sample);
+   gBS->RestoreTPL(OldTpl);
+
+   if (Pushed) {
+      gBS->SignalEvent(Input->ReadyEvent);
+   }
+   return EFI_SUCCESS;
+}
+
+EFI_STATUS EFIAPI
+InputInit(NEKO_INPUT *Input, NEKO_POINTERS *Pointers, UINT64 Interval) {
+   EFI_STATUS Status;
+
+   ZeroMem(Input, sizeof(NEKO_INPUT));
+   Input->Pointers = Pointers;
+   Input->Interval = Interval;
+
+   Status = gBS->CreateEvent(0, 0, NULL, NULL, &Input->ReadyEvent);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+
+   Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, NEKO_INPUT_TPL,
+                             InputSample, Input, &Input->Timer);
+   if (EFI_ERROR(Status)) {
+      gBS->CloseEvent(Input->ReadyEvent);
+      Input->ReadyEvent = NULL;
+      return Status;
+   }
+
+   return gBS->SetTimer(Input->Timer, TimerPeriodic, Interval);
+}
+
+// registers a notify for every character in Keys, held with the Shift
+// modifiers, or with any for 0. if the console has no SimpleTextInputEx,
+// ConIn is sampled instead if Consume allows, which does consume keys.
+EFI_STATUS EFIAPI
+InputHotkeys(NEKO_INPUT *Input, CONST CHAR16 *Keys, UINT32 Shift,
+             BOOLEAN Consume) {
+   EFI_STATUS Status;
+
+   if (mHotkeyInput != NULL && mHotkeyInput != Input) {
+      return EFI_ALREADY_STARTED;
+   }
+
+   Status = gBS->HandleProtocol(gST->ConsoleInHandle,
+                                &gEfiSimpleTextInputExProtocolGuid,
+                                (VOID**)&Input->ConInEx);
+   if (EFI_ERROR(Status)) {
+      Input->ConInEx = NULL;
+      Input->ConIn = Consume ? gST->ConIn : NULL;
+      return Status;
+   }
+
+   mHotkeyInput = Input;
+   Input->HotkeyShift = Shift;
+   for (; *Keys != L'\0' && Input->HotkeyCount < NEKO_HOTKEY_MAX; Keys++) {
+      EFI_KEY_DATA KeyData;
+
+      // without shift state bits the key matches whatever the modifiers
+      ZeroMem(&KeyData, sizeof(KeyData));
+      KeyData.Key.UnicodeChar = *Keys;
+      KeyData.KeyState.KeyShiftState = Shift;
+
+      Status = Input->ConInEx->RegisterKeyNotify(Input->ConInEx, &KeyData,
+                        InputHotkey, &Input->Hotkeys[Input->HotkeyCount]);
+      if (EFI_ERROR(Status)) {
+         return Status;
+      }
+      Input->HotkeyCount++;
+   }
+
+   return EFI_SUCCESS;
+}
+
+// a device's WaitForInput fired while the sampler was suspended
+VOID EFIAPI
+InputResume(NEKO_INPUT *Input) {
+   EFI_TPL OldTpl = gBS->RaiseTPL(NEKO_INPUT_TPL);
+   if (Input->Suspended) {
+      InputSetRate(Input, FALSE);
+   }
+   gBS->RestoreTPL(OldTpl);
+}
+
+// consumer side, called from the main loop at TPL_APPLICATION
+BOOLEAN EFIAPI
+InputPop(NEKO_INPUT *Input, NEKO_INPUT_SAMPLE *Sample) {
+   NEKO_INPUT_RING *Ring = &Input->Ring;
+   UINT32 Tail = Ring->Tail;
+
+   if (Tail == Ring->Head) {
+      return FALSE;
+   }
+   MemoryFence();
+
+   CopyMem(Sample, &Ring->Samples[Tail & INPUT_RING_MASK],
+           sizeof(NEKO_INPUT_SAMPLE));
+   // the slot may only be reused once it has been copied out
+   MemoryFence();
+   Ring->Tail = Tail + 1;
+
+   return TRUE;
+}
+
+VOID EFIAPI
+InputFree(NEKO_INPUT *Input) {
+   for (UINTN i = 0; i < Input->HotkeyCount; i++) {
+      Input->ConInEx->UnregisterKeyNotify(Input->ConInEx, Input->Hotkeys[i]);
+   }
+   Input->HotkeyCount = 0;
+   if (mHotkeyInput == Input) {
+      mHotkeyInput = NULL;
+   }
+
+   // closing the timer also removes any notification still queued for it
+   if (Input->Timer != NULL) {
+      gBS->SetTimer(Input->Timer, TimerCancel, 0);
+      gBS->CloseEvent(Input->Timer);
+      Input->Timer = NULL;
+   }
+   if (Input->ReadyEvent != NULL) {
+      gBS->CloseEvent(Input->ReadyEvent);
+      Input->ReadyEvent = NULL;
+   }
+}
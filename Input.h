@@ -0,0 +1,89 @@
+#ifndef __NEKO_INPUT_H__
+#define __NEKO_INPUT_H__
+
+#include <Protocol/SimpleTextIn.h>
+#include <Protocol/SimpleTextInEx.h>
+
+#include "Pointer.h"
+
+// samples are taken from a timer notify function at NEKO_INPUT_TPL, so a
+// slow Blt on the main loop no longer delays them. the ring holds
+// NEKO_INPUT_RING_SIZE samples, which must be a power of two.
+#define NEKO_INPUT_TPL TPL_NOTIFY
+#define NEKO_INPUT_RING_SIZE 64
+#define NEKO_HOTKEY_MAX 16
+
+// a tickless sampler stops after NEKO_INPUT_IDLE_SAMPLES empty samples.
+// the owner then waits on the devices' WaitForInput and calls InputResume;
+// while some device has never been seen signalling, a probe at
+// NEKO_INPUT_PROBE_INTERVAL stands in for it.
+#define NEKO_INPUT_IDLE_SAMPLES 40
+#define NEKO_INPUT_PROBE_INTERVAL 10000000
+
+typedef enum {
+   NEKO_SAMPLE_POINTER,
+   NEKO_SAMPLE_KEY
+} NEKO_SAMPLE_TYPE;
+
+typedef struct {
+   UINT64 Time;                           // ClkTicks() when sampled
+   NEKO_SAMPLE_TYPE Type;
+   union {
+      NEKO_POINTER_INPUT Pointer;         // every device, merged
+      EFI_INPUT_KEY Key;
+   };
+} NEKO_INPUT_SAMPLE;
+
+// single producer (the notify function), single consumer (the main loop).
+// each side only ever writes its own index, so neither needs to raise TPL.
+typedef struct {
+   NEKO_INPUT_SAMPLE Samples[NEKO_INPUT_RING_SIZE];
+   volatile UINT32 Head;
+   volatile UINT32 Tail;
+
+   // written by the producer only
+   UINT64 Pushed;
+   UINT32 Overflows;
+   UINT32 MaxDepth;
+} NEKO_INPUT_RING;
+
+typedef struct {
+   NEKO_INPUT_RING Ring;
+   NEKO_POINTERS *Pointers;
+   // hotkeys arrive through RegisterKeyNotify and leave the console
+   // buffer alone. ConIn is only sampled when that is not available.
+   EFI_SIMPLE_TEXT_INPUT_EX_PROTOCOL *ConInEx;
+   VOID *Hotkeys[NEKO_HOTKEY_MAX];
+   UINTN HotkeyCount;
+   UINT32 HotkeyShift;                    // modifiers they need, if any
+   EFI_SIMPLE_TEXT_INPUT_PROTOCOL *ConIn;
+
+   EFI_EVENT Timer;
+   UINT64 Interval;
+   // a plain event, signalled whenever samples were pushed or the sampler
+   // was suspended
+   EFI_EVENT ReadyEvent;
+
+   BOOLEAN Tickless;
+   volatile BOOLEAN Suspended;
+   UINT32 IdleSamples;
+   UINT64 Wakeups;                        // sampler runs
+} NEKO_INPUT;
+
+EFI_STATUS EFIAPI
+InputInit(NEKO_INPUT *Input, NEKO_POINTERS *Pointers, UINT64 Interval);
+
+EFI_STATUS EFIAPI
+InputHotkeys(NEKO_INPUT *Input, CONST CHAR16 *Keys, UINT32 Shift,
+             BOOLEAN Consume);
+
+VOID EFIAPI
+InputResume(NEKO_INPUT *Input);
+
+BOOLEAN EFIAPI
+InputPop(NEKO_INPUT *Input, NEKO_INPUT_SAMPLE *Sample);
+
+VOID EFIAPI
+InputFree(NEKO_INPUT *Input);
+
+#endif // __NEKO_INPUT_H__
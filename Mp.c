@@ -0,0 +1,323 @@
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+#include <Library/SynchronizationLib.h>
+
+#include "Mp.h"
+
+// every block carries its size, padded so blocks stay 16 byte aligned
+#define MP_ARENA_HEADER 16
+#define MP_ARENA_ALIGN(Size) ALIGN_VALUE(Size, MP_ARENA_HEADER)
+
+typedef struct {
+   NEKO_MP_TASK Task;
+   VOID *Context;
+   UINT32 Count;
+   volatile UINT32 Next;
+   volatile UINT32 ApDone;
+} NEKO_MP_RUN;
+
+// the lodepng allocator gets no context, so arenas are found through the
+// one runner there is
+static NEKO_MP *mMp = NULL;
+
+static UINTN EFIAPI
+MpWhoAmI(NEKO_MP *Mp) {
+   UINTN Cpu;
+
+   if (Mp->Services == NULL ||
+       EFI_ERROR(Mp->Services->WhoAmI(Mp->Services, &Cpu)) ||
+       Cpu >= Mp->ArenaSlots) {
+      return 0;
+   }
+   return Cpu;
+}
+
+static VOID EFIAPI
+MpDrain(NEKO_MP_RUN *Run, BOOLEAN Ap) {
+   for (;;) {
+      UINT32 Index = InterlockedIncrement(&Run->Next) - 1;
+      if (Index >= Run->Count) {
+         break;
+      }
+
+      Run->Task(Run->Context, Index);
+      if (Ap) {
+         InterlockedIncrement(&Run->ApDone);
+      }
+   }
+}
+
+// what StartupAllAPs starts on each AP
+static VOID EFIAPI
+MpWorker(VOID *Context) {
+   MpDrain(Context, TRUE);
+}
+
+// never fails the caller: without MP services, or with nothing but the BSP
+// enabled, Processors stays 1 and MpRun is a plain loop
+EFI_STATUS EFIAPI
+MpInit(NEKO_MP *Mp) {
+   EFI_STATUS Status;
+   UINTN Total;
+   UINTN Enabled;
+
+   ZeroMem(Mp, sizeof(NEKO_MP));
+   Mp->Processors = 1;
+
+   if (mMp != NULL) {
+      return EFI_ALREADY_STARTED;
+   }
+
+   Status = gBS->LocateProtocol(&gEfiMpServiceProtocolGuid, NULL,
+                                (VOID**)&Mp->Services);
+   if (EFI_ERROR(Status)) {
+      Mp->Services = NULL;
+      return Status;
+   }
+
+   Status = Mp->Services->GetNumberOfProcessors(Mp->Services, &Total,
+                                                &Enabled);
+   if (!EFI_ERROR(Status)) {
+      Status = gBS->CreateEvent(0, 0, NULL, NULL, &Mp->Done);
+   }
+   if (!EFI_ERROR(Status)) {
+      Status = gBS->CreateEvent(0, 0, NULL, NULL, &Mp->WorkerDone);
+   }
+   if (!EFI_ERROR(Status)) {
+      Mp->Arenas = AllocateZeroPool(Total * sizeof(NEKO_ARENA*));
+      Status = Mp->Arenas != NULL ? EFI_SUCCESS : EFI_OUT_OF_RESOURCES;
+   }
+   if (EFI_ERROR(Status)) {
+      MpFree(Mp);
+      return Status;
+   }
+
+   Mp->ArenaSlots = Total;
+   Mp->Processors = MAX(1, Enabled);
+   mMp = Mp;
+
+   return EFI_SUCCESS;
+}
+
+// runs Task for every index below Count and returns once all of them are
+// done. a task that lands on an AP must not touch boot services, and has
+// to be ready for any other task to run alongside it.
+VOID EFIAPI
+MpRun(NEKO_MP *Mp, NEKO_MP_TASK Task, VOID *Context, UINTN Count) {
+   EFI_STATUS Status = EFI_UNSUPPORTED;
+   NEKO_MP_RUN Run = {
+      .Task = Task,
+      .Context = Context,
+      .Count = (UINT32)Count,
+   };
+
+   Mp->Runs++;
+   Mp->Tasks += Count;
+
+   if (Mp->Processors > 1 && Count > 1 && !Mp->Lent) {
+      Status = Mp->Services->StartupAllAPs(Mp->Services, MpWorker, FALSE,
+                                           Mp->Done, 0, &Run, NULL);
+      if (Status == EFI_UNSUPPORTED) {
+         // no non-blocking mode: the APs take it all while the BSP waits
+         Mp->Services->StartupAllAPs(Mp->Services, MpWorker, FALSE, NULL,
+                                     0, &Run, NULL);
+      }
+   }
+
+   // whatever the APs left, or everything if they never started
+   MpDrain(&Run, FALSE);
+
+   // the APs still read Run, which lives on this stack
+   if (!EFI_ERROR(Status)) {
+      while (gBS->CheckEvent(Mp->Done) == EFI_NOT_READY) {
+         CpuPause();
+      }
+   }
+
+   Mp->ApTasks += Run.ApDone;
+}
+
+// starts Procedure on the first enabled AP and returns right away. it has
+// the AP until it returns by itself, which MpJoin waits for.
+EFI_STATUS EFIAPI
+MpSpawn(NEKO_MP *Mp, EFI_AP_PROCEDURE Procedure, VOID *Context) {
+   EFI_PROCESSOR_INFORMATION Info;
+
+   if (Mp->Processors < 2 || Mp->Lent) {
+      return EFI_UNSUPPORTED;
+   }
+
+   for (UINTN i = 0; i < Mp->ArenaSlots; i++) {
+      if (EFI_ERROR(Mp->Services->GetProcessorInfo(Mp->Services, i, &Info)) ||
+          (Info.StatusFlag & PROCESSOR_AS_BSP_BIT) != 0 ||
+          (Info.StatusFlag & PROCESSOR_ENABLED_BIT) == 0) {
+         continue;
+      }
+
+      // without a WaitEvent the call would only return once Procedure did
+      if (!EFI_ERROR(Mp->Services->StartupThisAP(Mp->Services, Procedure, i,
+                                                 Mp->WorkerDone, 0, Context,
+                                                 NULL))) {
+         Mp->Worker = i;
+         Mp->Lent = TRUE;
+         return EFI_SUCCESS;
+      }
+   }
+
+   return EFI_NOT_READY;
+}
+
+// TRUE once the AP is back, or was never lent. it does not wait.
+BOOLEAN EFIAPI
+MpTryJoin(NEKO_MP *Mp) {
+   if (Mp->Lent && gBS->CheckEvent(Mp->WorkerDone) == EFI_NOT_READY) {
+      return FALSE;
+   }
+
+   Mp->Lent = FALSE;
+   return TRUE;
+}
+
+VOID EFIAPI
+MpJoin(NEKO_MP *Mp) {
+   while (!MpTryJoin(Mp)) {
+      CpuPause();
+   }
+}
+
+VOID EFIAPI
+MpFree(NEKO_MP *Mp) {
+   MpJoin(Mp);
+   if (mMp == Mp) {
+      mMp = NULL;
+   }
+   if (Mp->WorkerDone != NULL) {
+      gBS->CloseEvent(Mp->WorkerDone);
+      Mp->WorkerDone = NULL;
+   }
+   if (Mp->Done != NULL) {
+      gBS->CloseEvent(Mp->Done);
+      Mp->Done = NULL;
+   }
+   if (Mp->Arenas != NULL) {
+      FreePool(Mp->Arenas);
+      Mp->Arenas = NULL;
+   }
+   Mp->ArenaSlots = 0;
+   Mp->Processors = 1;
+}
+
+// allocated on the BSP, before the task that enters it is run
+EFI_STATUS EFIAPI
+MpArenaInit(NEKO_ARENA *Arena, UINTN Size) {
+   ZeroMem(Arena, sizeof(NEKO_ARENA));
+
+   Arena->Base = AllocatePool(Size);
+   if (Arena->Base == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+   Arena->Size = Size;
+
+   return EFI_SUCCESS;
+}
+
+// allocations on this processor go to Arena until MpArenaLeave
+VOID EFIAPI
+MpArenaEnter(NEKO_ARENA *Arena) {
+   if (mMp == NULL) {
+      return;
+   }
+
+   mMp->Arenas[MpWhoAmI(mMp)] = Arena;
+   InterlockedIncrement(&mMp->ArenasEntered);
+}
+
+VOID EFIAPI
+MpArenaLeave(VOID) {
+   if (mMp == NULL) {
+      return;
+   }
+
+   mMp->Arenas[MpWhoAmI(mMp)] = NULL;
+   InterlockedDecrement(&mMp->ArenasEntered);
+}
+
+// NULL while this processor has not entered one, which the BSP never does
+// outside of MpRun
+NEKO_ARENA* EFIAPI
+MpArenaCurrent(VOID) {
+   if (mMp == NULL || mMp->ArenasEntered == 0) {
+      return NULL;
+   }
+
+   return mMp->Arenas[MpWhoAmI(mMp)];
+}
+
+VOID* EFIAPI
+MpArenaAlloc(NEKO_ARENA *Arena, UINTN Size) {
+   UINTN Needed = MP_ARENA_HEADER + MP_ARENA_ALIGN(Size);
+
+   if (Size > Arena->Size || Arena->Size - Arena->Used < Needed) {
+      return NULL;
+   }
+
+   UINT8 *Block = Arena->Base + Arena->Used;
+   *(UINTN*)Block = Size;
+   Arena->Last = Arena->Used;
+   Arena->Used += Needed;
+
+   return Block + MP_ARENA_HEADER;
+}
+
+VOID* EFIAPI
+MpArenaRealloc(NEKO_ARENA *Arena, VOID *Addr, UINTN Size) {
+   if (Addr == NULL) {
+      return MpArenaAlloc(Arena, Size);
+   }
+
+   UINT8 *Block = (UINT8*)Addr - MP_ARENA_HEADER;
+   UINTN OldSize = *(UINTN*)Block;
+
+   // a growing buffer is usually the newest block, which just extends
+   if (Block == Arena->Base + Arena->Last && Size <= Arena->Size &&
+       Arena->Size - Arena->Last >= MP_ARENA_HEADER + MP_ARENA_ALIGN(Size)) {
+      *(UINTN*)Block = Size;
+      Arena->Used = Arena->Last + MP_ARENA_HEADER + MP_ARENA_ALIGN(Size);
+      return Addr;
+   }
+
+   VOID *NewAddr = MpArenaAlloc(Arena, Size);
+   if (NewAddr != NULL) {
+      CopyMem(NewAddr, Addr, MIN(OldSize, Size));
+   }
+   return NewAddr;
+}
+
+// only the newest block really comes back. FALSE if Addr is not the
+// arena's at all.
+BOOLEAN EFIAPI
+MpArenaFree(NEKO_ARENA *Arena, VOID *Addr) {
+   UINT8 *Block = (UINT8*)Addr - MP_ARENA_HEADER;
+
+   if ((UINT8*)Addr < Arena->Base ||
+       (UINT8*)Addr >= Arena->Base + Arena->Size) {
+      return FALSE;
+   }
+
+   if (Block == Arena->Base + Arena->Last) {
+      Arena->Used = Arena->Last;
+   }
+   return TRUE;
+}
+
+// back on the BSP, once nothing in the arena is needed any more
+VOID EFIAPI
+MpArenaRelease(NEKO_ARENA *Arena) {
+   if (Arena->Base != NULL) {
+      FreePool(Arena->Base);
+   }
+   ZeroMem(Arena, sizeof(NEKO_ARENA));
+}
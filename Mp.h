@@ -0,0 +1,85 @@
+#ifndef __NEKO_MP_H__
+#define __NEKO_MP_H__
+
+#include <Protocol/MpService.h>
+
+// a task runner over the MP services protocol. tasks are handed out one
+// index at a time to every enabled processor, the BSP included, so uneven
+// tasks still balance. without the protocol the BSP runs them all in order.
+typedef VOID (EFIAPI *NEKO_MP_TASK)(VOID *Context, UINTN Index);
+
+// boot services are off limits on an AP, so a task that has to allocate
+// enters an arena the BSP set up for it. it only ever bumps forward; the
+// newest block can still grow in place or be given back.
+typedef struct {
+   UINT8 *Base;
+   UINTN Size;
+   UINTN Used;
+   UINTN Last;             // offset of the newest block's header
+} NEKO_ARENA;
+
+typedef struct {
+   EFI_MP_SERVICES_PROTOCOL *Services;
+   UINTN Processors;       // enabled ones, the BSP included
+   EFI_EVENT Done;
+
+   // by processor number, the arena each one has entered
+   NEKO_ARENA **Arenas;
+   UINTN ArenaSlots;
+   volatile UINT32 ArenasEntered;
+
+   // an AP lent out to a long running procedure, while Lent. any processor
+   // may be the AP, 0 too once the BSP has moved. MpRun gets no APs in the
+   // meantime and runs everything on the BSP.
+   BOOLEAN Lent;
+   UINTN Worker;
+   EFI_EVENT WorkerDone;
+
+   UINT64 Runs;
+   UINT64 Tasks;
+   UINT64 ApTasks;         // of Tasks, those an AP ran
+} NEKO_MP;
+
+EFI_STATUS EFIAPI
+MpInit(NEKO_MP *Mp);
+
+VOID EFIAPI
+MpRun(NEKO_MP *Mp, NEKO_MP_TASK Task, VOID *Context, UINTN Count);
+
+EFI_STATUS EFIAPI
+MpSpawn(NEKO_MP *Mp, EFI_AP_PROCEDURE Procedure, VOID *Context);
+
+BOOLEAN EFIAPI
+MpTryJoin(NEKO_MP *Mp);
+
+VOID EFIAPI
+MpJoin(NEKO_MP *Mp);
+
+VOID EFIAPI
+MpFree(NEKO_MP *Mp);
+
+EFI_STATUS EFIAPI
+MpArenaInit(NEKO_ARENA *Arena, UINTN Size);
+
+VOID EFIAPI
+MpArenaEnter(NEKO_ARENA *Arena);
+
+VOID EFIAPI
+MpArenaLeave(VOID);
+
+NEKO_ARENA* EFIAPI
+MpArenaCurrent(VOID);
+
+VOID* EFIAPI
+MpArenaAlloc(NEKO_ARENA *Arena, UINTN Size);
+
+VOID* EFIAPI
+MpArenaRealloc(NEKO_ARENA *Arena, VOID *Addr, UINTN Size);
+
+BOOLEAN EFIAPI
+MpArenaFree(NEKO_ARENA *Arena, VOID *Addr);
+
+VOID EFIAPI
+MpArenaRelease(NEKO_ARENA *Arena);
+
+#endif // __NEKO_MP_H__
@@ -0,0 +1,748 @@
+#include <Uefi.h>
+#include <Protocol/LoadedImage.h>
+#include <Protocol/SimpleTextOut.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/DevicePathLib.h>
+#include <Library/BaseLib.h>
+
+#include "Overlay.h"
+#include "Clock.h"
+
+#define FASTFAIL() \
+   if (EFI_ERROR(Status)) { \
+      return Status; \
+   }
+
+typedef struct {
+   EFINEKO_STATE Neko;
+   UINT64 BudgetUs;
+   UINT64 DebtUs;          // overrun not yet paid back
+   NEKO_OVERLAY_STATS *Stats;
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop;
+
+   // the console's own functions, while ours are installed in their place
+   EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *ConOut;
+   EFI_TEXT_RESET Reset;
+   EFI_TEXT_STRING OutputString;
+   EFI_TEXT_SET_MODE SetMode;
+   EFI_TEXT_CLEAR_SCREEN ClearScreen;
+   EFI_TEXT_SET_CURSOR_POSITION SetCursorPosition;
+   EFI_TEXT_ENABLE_CURSOR EnableCursor;
+
+   // the same for the GOP. Drawing is set while the cat itself draws, so
+   // its own Blt calls pass straight through.
+   EFI_GRAPHICS_OUTPUT_PROTOCOL_BLT Blt;
+   EFI_GRAPHICS_OUTPUT_PROTOCOL_SET_MODE GopSetMode;
+   BOOLEAN Drawing;
+} NEKO_OVERLAY;
+
+// hooked functions get no context, so only one overlay can run at a time
+static NEKO_OVERLAY *mOverlay = NULL;
+
+EFI_STATUS EFIAPI
+OverlayUnderInit(NEKO_UNDER *Under, UINTN Width, UINTN Height) {
+   ZeroMem(Under, sizeof(NEKO_UNDER));
+   Under->Capacity = Width * Height;
+
+   Under->Saved = AllocatePool(
+      Under->Capacity * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   Under->Layer = AllocatePool(
+      Under->Capacity * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   Under->Screen = AllocatePool(
+      Under->Capacity * sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL));
+   if (Under->Saved == NULL || Under->Layer == NULL ||
+       Under->Screen == NULL) {
+      OverlayUnderFree(Under);
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   return EFI_SUCCESS;
+}
+
+VOID EFIAPI
+OverlayUnderRestore(NEKO_BLITTER *Blitter, NEKO_UNDER *Under) {
+   if (!Under->Valid) {
+      return;
+   }
+
+   BlitDraw(Blitter, Under->Saved, Under->Width, 0, 0, Under->X, Under->Y,
+            Under->Width, Under->Height);
+   Under->Valid = FALSE;
+}
+
+// saves the screen under the destination, then draws Src over it. pixels
+// with a zero Reserved byte are the sheet's filter colour and let the
+// saved screen show through, so the whole layer goes out in one BlitDraw.
+VOID EFIAPI
+OverlayUnderDraw(NEKO_BLITTER *Blitter,
+                 NEKO_UNDER *Under,
+                 EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                 UINTN SrcWidth,
+                 UINTN SrcX,
+                 UINTN SrcY,
+                 INTN DstX,
+                 INTN DstY,
+                 UINTN Width,
+                 UINTN Height) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Blitter->Gop;
+   INTN X0 = MAX(DstX, 0);
+   INTN Y0 = MAX(DstY, 0);
+   INTN X1 = MIN(DstX + (INTN)Width, (INTN)Blitter->ScrX);
+   INTN Y1 = MIN(DstY + (INTN)Height, (INTN)Blitter->ScrY);
+
+   Under->Valid = FALSE;
+   if (X1 <= X0 || Y1 <= Y0 ||
+       (UINTN)((X1 - X0) * (Y1 - Y0)) > Under->Capacity) {
+      return;
+   }
+
+   Under->X = X0;
+   Under->Y = Y0;
+   Under->Width = X1 - X0;
+   Under->Height = Y1 - Y0;
+   SrcX += X0 - DstX;
+   SrcY += Y0 - DstY;
+
+   if (EFI_ERROR(Gop->Blt(Gop, Under->Saved, EfiBltVideoToBltBuffer,
+                          Under->X, Under->Y, 0, 0,
+                          Under->Width, Under->Height, 0))) {
+      return;
+   }
+
+   for (UINTN y = 0; y < Under->Height; y++) {
+      EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Row = &Src[(SrcY + y) * SrcWidth + SrcX];
+      EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Saved = &Under->Saved[y * Under->Width];
+      EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Layer = &Under->Layer[y * Under->Width];
+
+      for (UINTN x = 0; x < Under->Width; x++) {
+         Layer[x] = Row[x].Reserved != 0 ? Row[x] : Saved[x];
+      }
+   }
+
+   BlitDraw(Blitter, Under->Layer, Under->Width, 0, 0, Under->X, Under->Y,
+            Under->Width, Under->Height);
+   Under->Valid = TRUE;
+}
+
+// the colour only, a readback need not keep the Reserved byte
+static BOOLEAN EFIAPI
+OverlaySameColour(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *A,
+                  EFI_GRAPHICS_OUTPUT_BLT_PIXEL *B) {
+   return A->Red == B->Red && A->Green == B->Green && A->Blue == B->Blue;
+}
+
+// the host may have drawn into Rect. only that part of the saved region
+// is read back, and a pixel is taken as the host's wherever it no longer
+// shows what we drew. that makes a refresh safe to repeat after the cat
+// was put back on top. returns TRUE if the host drew over the image.
+BOOLEAN EFIAPI
+OverlayUnderRefresh(NEKO_BLITTER *Blitter, NEKO_UNDER *Under,
+                    NEKO_RECT *Rect) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Blitter->Gop;
+   BOOLEAN Changed = FALSE;
+
+   if (!Under->Valid) {
+      return FALSE;
+   }
+
+   INTN X0 = MAX(Rect->X, Under->X);
+   INTN Y0 = MAX(Rect->Y, Under->Y);
+   INTN X1 = MIN(Rect->X + (INTN)Rect->Width, Under->X + (INTN)Under->Width);
+   INTN Y1 = MIN(Rect->Y + (INTN)Rect->Height,
+                 Under->Y + (INTN)Under->Height);
+   if (X1 <= X0 || Y1 <= Y0) {
+      return FALSE;
+   }
+
+   if (EFI_ERROR(Gop->Blt(Gop, Under->Screen, EfiBltVideoToBltBuffer,
+                          X0, Y0, X0 - Under->X, Y0 - Under->Y,
+                          X1 - X0, Y1 - Y0,
+                          Under->Width * 
+                          sizeof(EFI_GRAPHICS_OUTPUT_BLT_PIXEL)))) {
+      return FALSE;
+   }
+
+   for (INTN y = Y0 - Under->Y; y < Y1 - Under->Y; y++) {
+      for (INTN x = X0 - Under->X; x < X1 - Under->X; x++) {
+         UINTN i = y * Under->Width + x;
+
+         if (OverlaySameColour(&Under->Screen[i], &Under->Layer[i])) {
+            continue;
+         }
+         // where the layer let the saved pixel through it still does, and
+         // only a pixel of the image itself needs drawing again
+         if (OverlaySameColour(&Under->Layer[i], &Under->Saved[i])) {
+            Under->Layer[i] = Under->Screen[i];
+         } else {
+            Changed = TRUE;
+         }
+         Under->Saved[i] = Under->Screen[i];
+      }
+   }
+
+   return Changed;
+}
+
+// four independent FNV-style lanes of 32 bit pixels, so the loop maps
+// onto vector registers and only ever does aligned 32 bit reads, which
+// uncached framebuffer mappings need on some machines
+static UINT64 EFIAPI
+OverlayHashRow(volatile UINT32 *Row, UINTN Pixels, UINT64 Hash) {
+   UINT32 Lane[4] = { 0x811c9dc5, 0x811c9dc5, 0x811c9dc5, 0x811c9dc5 };
+   UINTN x = 0;
+
+   for (; x + 4 <= Pixels; x += 4) {
+      for (UINTN i = 0; i < 4; i++) {
+         Lane[i] = (Lane[i] ^ Row[x + i]) * 0x01000193;
+      }
+   }
+   for (; x < Pixels; x++) {
+      Lane[0] = (Lane[0] ^ Row[x]) * 0x01000193;
+   }
+
+   for (UINTN i = 0; i < 4; i++) {
+      Hash = (Hash ^ Lane[i]) * 0x100000001b3ULL;
+   }
+   return Hash;
+}
+
+// hashes the sparse rows of the framebuffer around a saved region. 0 if
+// there is nothing to look at, or no framebuffer to look at it in.
+UINT64 EFIAPI
+OverlayUnderProbe(NEKO_BLITTER *Blitter, NEKO_UNDER *Under, UINTN *Pixels) {
+   UINT64 Hash = 0xcbf29ce484222325ULL;
+
+   *Pixels = 0;
+   if (!Under->Valid || Blitter->FrameBuffer == NULL) {
+      return 0;
+   }
+
+   INTN X0 = MAX(Under->X - NEKO_PROBE_MARGIN, 0);
+   INTN Y0 = MAX(Under->Y - NEKO_PROBE_MARGIN, 0);
+   INTN X1 = MIN(Under->X + (INTN)Under->Width + NEKO_PROBE_MARGIN,
+                 (INTN)Blitter->ScrX);
+   INTN Y1 = MIN(Under->Y + (INTN)Under->Height + NEKO_PROBE_MARGIN,
+                 (INTN)Blitter->ScrY);
+
+   for (INTN y = Y0; y < Y1; y += NEKO_PROBE_STRIDE) {
+      Hash = OverlayHashRow(
+         &Blitter->FrameBuffer[y * Blitter->PixelsPerScanLine + X0],
+         X1 - X0, Hash);
+      *Pixels += X1 - X0;
+   }
+   return Hash;
+}
+
+BOOLEAN EFIAPI
+OverlayUnderOverlaps(NEKO_UNDER *Under, INTN X, INTN Y, UINTN Width,
+                     UINTN Height) {
+   return Under->Valid &&
+          X < Under->X + (INTN)Under->Width && Under->X < X + (INTN)Width &&
+          Y < Under->Y + (INTN)Under->Height && Under->Y < Y + (INTN)Height;
+}
+
+VOID EFIAPI
+OverlayUnderFree(NEKO_UNDER *Under) {
+   if (Under->Saved != NULL) {
+      FreePool(Under->Saved);
+   }
+   if (Under->Layer != NULL) {
+      FreePool(Under->Layer);
+   }
+   if (Under->Screen != NULL) {
+      FreePool(Under->Screen);
+   }
+   ZeroMem(Under, sizeof(NEKO_UNDER));
+}
+
+VOID EFIAPI
+OverlayDamageAdd(NEKO_DAMAGE *Damage, INTN X, INTN Y, UINTN Width,
+                 UINTN Height) {
+   NEKO_RECT *Best = NULL;
+   UINT64 BestGrowth = MAX_UINT64;
+
+   if (Width == 0 || Height == 0) {
+      return;
+   }
+   if (Damage->Count < NEKO_DAMAGE_MAX) {
+      NEKO_RECT *Rect = &Damage->Rects[Damage->Count++];
+      Rect->X = X;
+      Rect->Y = Y;
+      Rect->Width = Width;
+      Rect->Height = Height;
+      return;
+   }
+
+   for (UINTN i = 0; i < Damage->Count; i++) {
+      NEKO_RECT *Rect = &Damage->Rects[i];
+      INTN X0 = MIN(Rect->X, X);
+      INTN Y0 = MIN(Rect->Y, Y);
+      INTN X1 = MAX(Rect->X + (INTN)Rect->Width, X + (INTN)Width);
+      INTN Y1 = MAX(Rect->Y + (INTN)Rect->Height, Y + (INTN)Height);
+      UINT64 Growth = (UINT64)((X1 - X0) * (Y1 - Y0))
+                    - Rect->Width * Rect->Height;
+
+      if (Growth < BestGrowth) {
+         BestGrowth = Growth;
+         Best = Rect;
+      }
+   }
+
+   INTN X1 = MAX(Best->X + (INTN)Best->Width, X + (INTN)Width);
+   INTN Y1 = MAX(Best->Y + (INTN)Best->Height, Y + (INTN)Height);
+   Best->X = MIN(Best->X, X);
+   Best->Y = MIN(Best->Y, Y);
+   Best->Width = X1 - Best->X;
+   Best->Height = Y1 - Best->Y;
+}
+
+// steps up to NEKO_OVERLAY_TPL, or stays where the caller already is if
+// that is higher
+static EFI_TPL EFIAPI
+OverlayEnter(VOID) {
+   EFI_TPL Tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+   gBS->RestoreTPL(Tpl);
+   return gBS->RaiseTPL(MAX(Tpl, NEKO_OVERLAY_TPL));
+}
+
+static VOID EFIAPI
+OverlayDamageAll(NEKO_OVERLAY *Overlay) {
+   EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = Overlay->Gop->Mode->Info;
+
+   EfiNekoDamage(&Overlay->Neko, 0, 0, Info->HorizontalResolution,
+                 Info->VerticalResolution);
+   Overlay->Stats->TextDamage++;
+}
+
+// cells Col0..Col1 of rows Row0..Row1, a Col1 past the end means the
+// rest of the row
+static VOID EFIAPI
+OverlayDamageCells(NEKO_OVERLAY *Overlay, UINTN Col0, UINTN Row0,
+                   UINTN Col1, UINTN Row1) {
+   EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *ConOut = Overlay->ConOut;
+   EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = Overlay->Gop->Mode->Info;
+   UINTN Cols;
+   UINTN Rows;
+
+   if (EFI_ERROR(ConOut->QueryMode(ConOut, ConOut->Mode->Mode,
+                                   &Cols, &Rows)) || Cols == 0) {
+      OverlayDamageAll(Overlay);
+      return;
+   }
+   Col1 = MIN(Col1, Cols - 1);
+   if (Col0 > Col1) {
+      return;
+   }
+
+   INTN Left = ((INTN)Info->HorizontalResolution
+               - (INTN)(Cols * NEKO_GLYPH_WIDTH)) / 2;
+   INTN Top = ((INTN)Info->VerticalResolution 
+              - (INTN)(Rows * NEKO_GLYPH_HEIGHT)) / 2;
+
+   EfiNekoDamage(&Overlay->Neko,
+                 Left + (INTN)(Col0 * NEKO_GLYPH_WIDTH),
+                 Top + (INTN)(Row0 * NEKO_GLYPH_HEIGHT),
+                 (Col1 - Col0 + 1) * NEKO_GLYPH_WIDTH,
+                 (Row1 - Row0 + 1) * NEKO_GLYPH_HEIGHT);
+   Overlay->Stats->TextDamage++;
+}
+
+// the cells OutputString went over, from where the cursor was to where it
+// is now. a string that leaves the row covers whole rows, and one that
+// left it without the cursor moving down scrolled the screen.
+static VOID EFIAPI
+OverlayDamageText(NEKO_OVERLAY *Overlay, UINTN Col, UINTN Row,
+                  CHAR16 *String) {
+   EFI_SIMPLE_TEXT_OUTPUT_MODE *Mode = Overlay->ConOut->Mode;
+   UINTN EndRow = Mode->CursorRow;
+   UINTN MinCol = Col;
+   UINTN MaxCol = Col;
+   BOOLEAN LeftRow = FALSE;
+
+   for (UINTN c = Col; *String != L'\0'; String++) {
+      if (*String == L'\n') {
+         LeftRow = TRUE;
+      } else if (*String == L'\r') {
+         c = 0;
+      } else if (*String == L'\b') {
+         c = c > 0 ? c - 1 : 0;
+      } else {
+         c++;
+      }
+      MinCol = MIN(MinCol, c);
+      MaxCol = MAX(MaxCol, c);
+   }
+   MinCol = MIN(MinCol, (UINTN)Mode->CursorColumn);
+   MaxCol = MAX(MaxCol, (UINTN)Mode->CursorColumn);
+
+   if (EndRow > Row) {
+      OverlayDamageCells(Overlay, 0, Row, MAX_UINTN, EndRow);
+   } else if (EndRow < Row || LeftRow) {
+      OverlayDamageAll(Overlay);
+   } else {
+      // a wrap at the last row shows up as a column past the end
+      UINTN Cols;
+      UINTN Rows;
+      if (!EFI_ERROR(Overlay->ConOut->QueryMode(Overlay->ConOut, Mode->Mode,
+                                                &Cols, &Rows)) &&
+          MaxCol >= Cols) {
+         OverlayDamageAll(Overlay);
+      } else {
+         OverlayDamageCells(Overlay, MinCol, Row, MaxCol, Row);
+      }
+   }
+}
+
+static EFI_STATUS EFIAPI
+OverlayOutputString(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, CHAR16 *String) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+   UINTN Col = This->Mode->CursorColumn;
+   UINTN Row = This->Mode->CursorRow;
+
+   // a tick in between would put stale pixels back over the new text
+   EFI_TPL OldTpl = OverlayEnter();
+   EFI_STATUS Status = Overlay->OutputString(This, String);
+   OverlayDamageText(Overlay, Col, Row, String);
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+static EFI_STATUS EFIAPI
+OverlayReset(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, BOOLEAN Extended) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+
+   EFI_TPL OldTpl = OverlayEnter();
+   EFI_STATUS Status = Overlay->Reset(This, Extended);
+   OverlayDamageAll(Overlay);
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+static EFI_STATUS EFIAPI
+OverlaySetMode(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, UINTN ModeNumber) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+
+   EFI_TPL OldTpl = OverlayEnter();
+   EFI_STATUS Status = Overlay->SetMode(This, ModeNumber);
+   OverlayDamageAll(Overlay);
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+static EFI_STATUS EFIAPI
+OverlayClearScreen(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+
+   EFI_TPL OldTpl = OverlayEnter();
+   EFI_STATUS Status = Overlay->ClearScreen(This);
+   OverlayDamageAll(Overlay);
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+// the console redraws the cell the cursor leaves and the one it enters
+static EFI_STATUS EFIAPI
+OverlaySetCursorPosition(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This,
+                         UINTN Column,
+                         UINTN Row) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+   UINTN OldCol = This->Mode->CursorColumn;
+   UINTN OldRow = This->Mode->CursorRow;
+
+   EFI_TPL OldTpl = OverlayEnter();
+   EFI_STATUS Status = Overlay->SetCursorPosition(This, Column, Row);
+   if (This->Mode->CursorVisible) {
+      OverlayDamageCells(Overlay, OldCol, OldRow, OldCol, OldRow);
+      OverlayDamageCells(Overlay, Column, Row, Column, Row);
+   }
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+static EFI_STATUS EFIAPI
+OverlayEnableCursor(EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *This, BOOLEAN Visible) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+   UINTN Col = This->Mode->CursorColumn;
+   UINTN Row = This->Mode->CursorRow;
+
+   EFI_TPL OldTpl = OverlayEnter();
+   EFI_STATUS Status = Overlay->EnableCursor(This, Visible);
+   OverlayDamageCells(Overlay, Col, Row, Col, Row);
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+// puts our functions into the console protocol itself, which is what the
+// host calls through gST->ConOut. nothing changes in the system table, so
+// its CRC stays valid.
+static VOID EFIAPI
+OverlayHookConOut(NEKO_OVERLAY *Overlay) {
+   EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *ConOut = gST->ConOut;
+
+   if (ConOut == NULL) {
+      return;
+   }
+
+   EFI_TPL OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+   Overlay->ConOut = ConOut;
+   Overlay->Reset = ConOut->Reset;
+   Overlay->OutputString = ConOut->OutputString;
+   Overlay->SetMode = ConOut->SetMode;
+   Overlay->ClearScreen = ConOut->ClearScreen;
+   Overlay->SetCursorPosition = ConOut->SetCursorPosition;
+   Overlay->EnableCursor = ConOut->EnableCursor;
+
+   ConOut->Reset = OverlayReset;
+   ConOut->OutputString = OverlayOutputString;
+   ConOut->SetMode = OverlaySetMode;
+   ConOut->ClearScreen = OverlayClearScreen;
+   ConOut->SetCursorPosition = OverlaySetCursorPosition;
+   ConOut->EnableCursor = OverlayEnableCursor;
+   gBS->RestoreTPL(OldTpl);
+}
+
+static VOID EFIAPI
+OverlayUnhookConOut(NEKO_OVERLAY *Overlay) {
+   EFI_SIMPLE_TEXT_OUTPUT_PROTOCOL *ConOut = Overlay->ConOut;
+
+   if (ConOut == NULL) {
+      return;
+   }
+
+   EFI_TPL OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+   ConOut->Reset = Overlay->Reset;
+   ConOut->OutputString = Overlay->OutputString;
+   ConOut->SetMode = Overlay->SetMode;
+   ConOut->ClearScreen = Overlay->ClearScreen;
+   ConOut->SetCursorPosition = Overlay->SetCursorPosition;
+   ConOut->EnableCursor = Overlay->EnableCursor;
+   Overlay->ConOut = NULL;
+   gBS->RestoreTPL(OldTpl);
+}
+
+// a read or a copy out of the cat's area must see the host's pixels, so
+// the cat steps aside for it. anything drawn is damage, and the cat goes
+// back on top before the host gets control again, so it does not flicker
+// until the next tick.
+static EFI_STATUS EFIAPI
+OverlayBlt(EFI_GRAPHICS_OUTPUT_PROTOCOL *This,
+           EFI_GRAPHICS_OUTPUT_BLT_PIXEL *BltBuffer,
+           EFI_GRAPHICS_OUTPUT_BLT_OPERATION BltOperation,
+           UINTN SourceX,
+           UINTN SourceY,
+           UINTN DestinationX,
+           UINTN DestinationY,
+           UINTN Width,
+           UINTN Height,
+           UINTN Delta) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+   EFI_STATUS Status;
+
+   if (Overlay->Drawing) {
+      return Overlay->Blt(This, BltBuffer, BltOperation, SourceX, SourceY,
+                          DestinationX, DestinationY, Width, Height, Delta);
+   }
+
+   EFI_TPL OldTpl = OverlayEnter();
+   Overlay->Drawing = TRUE;
+   if (BltOperation == EfiBltVideoToBltBuffer ||
+       BltOperation == EfiBltVideoToVideo) {
+      EfiNekoHide(&Overlay->Neko, SourceX, SourceY, Width, Height);
+   }
+   Overlay->Drawing = FALSE;
+
+   Status = Overlay->Blt(This, BltBuffer, BltOperation, SourceX, SourceY,
+                         DestinationX, DestinationY, Width, Height, Delta);
+
+   Overlay->Drawing = TRUE;
+   if (BltOperation != EfiBltVideoToBltBuffer) {
+      EfiNekoDamage(&Overlay->Neko, DestinationX, DestinationY,
+                    Width, Height);
+      Overlay->Stats->BltDamage++;
+   }
+   EfiNekoRepair(&Overlay->Neko);
+   Overlay->Drawing = FALSE;
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+// a new mode starts from a cleared screen, nothing saved is any use
+static EFI_STATUS EFIAPI
+OverlayGopSetMode(EFI_GRAPHICS_OUTPUT_PROTOCOL *This, UINT32 ModeNumber) {
+   NEKO_OVERLAY *Overlay = mOverlay;
+
+   EFI_TPL OldTpl = OverlayEnter();
+   EFI_STATUS Status = Overlay->GopSetMode(This, ModeNumber);
+   EfiNekoScreenChanged(&Overlay->Neko);
+   Overlay->Stats->ModeChanges++;
+   gBS->RestoreTPL(OldTpl);
+
+   return Status;
+}
+
+// the GOP the cat draws on, which is the one LocateProtocol gives the host
+// too. a host that picks another GOP handle is not seen here.
+static VOID EFIAPI
+OverlayHookGop(NEKO_OVERLAY *Overlay) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Overlay->Gop;
+
+   EFI_TPL OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+   Overlay->Blt = Gop->Blt;
+   Overlay->GopSetMode = Gop->SetMode;
+   Gop->Blt = OverlayBlt;
+   Gop->SetMode = OverlayGopSetMode;
+   gBS->RestoreTPL(OldTpl);
+}
+
+static VOID EFIAPI
+OverlayUnhookGop(NEKO_OVERLAY *Overlay) {
+   EFI_GRAPHICS_OUTPUT_PROTOCOL *Gop = Overlay->Gop;
+
+   if (Overlay->Blt == NULL) {
+      return;
+   }
+
+   EFI_TPL OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+   Gop->Blt = Overlay->Blt;
+   Gop->SetMode = Overlay->GopSetMode;
+   Overlay->Blt = NULL;
+   Overlay->GopSetMode = NULL;
+   gBS->RestoreTPL(OldTpl);
+}
+
+// runs at NEKO_OVERLAY_TPL, on top of whatever the host was doing. GOP
+// implementations raise above it for the length of a Blt, so a host draw
+// is never interrupted halfway. an overrun is paid back by sitting out
+// whole notifies, which keeps the host's loss at BudgetUs per interval
+// on average, whatever a single tick costs.
+static VOID EFIAPI
+OverlayTick(EFI_EVENT Event, VOID *Context) {
+   NEKO_OVERLAY *Overlay = Context;
+   NEKO_OVERLAY_STATS *Stats = Overlay->Stats;
+
+   if (Overlay->DebtUs >= Overlay->BudgetUs) {
+      Overlay->DebtUs -= Overlay->BudgetUs;
+      Stats->Skipped++;
+      return;
+   }
+
+   UINT64 Start = ClkTicks();
+   Overlay->Drawing = TRUE;
+   EFI_STATUS Status = EfiNekoTick(&Overlay->Neko, Overlay->BudgetUs);
+   if (Status == EFI_ABORTED) {
+      // quit: the cat leaves the screen to the host for the rest of its run
+      EFI_GRAPHICS_OUTPUT_MODE_INFORMATION *Info = Overlay->Gop->Mode->Info;
+
+      EfiNekoHide(&Overlay->Neko, 0, 0, Info->HorizontalResolution,
+                  Info->VerticalResolution);
+      gBS->SetTimer(Event, TimerCancel, 0);
+   }
+   Overlay->Drawing = FALSE;
+   UINT64 Us = ClkTicksToUs(ClkTicks() - Start);
+
+   Stats->Frames++;
+   Stats->TotalUs += Us;
+   Stats->MaxUs = MAX(Stats->MaxUs, Us);
+   if (Us > Overlay->BudgetUs) {
+      Stats->Overruns++;
+      Overlay->DebtUs += Us - Overlay->BudgetUs;
+   }
+}
+
+// loads Path from our own volume and runs it with the cat on top. Options
+// become the host's load options, NULL for none. the cat is gone from the
+// screen again by the time this returns.
+EFI_STATUS EFIAPI
+OverlayRun(EFI_HANDLE ImageHandle,
+           CHAR16 *Path,
+           CHAR16 *Options,
+           EFINEKO_SETUP *Setup,
+           NEKO_OVERLAY_STATS *Stats) {
+   EFI_STATUS Status;
+   EFI_LOADED_IMAGE_PROTOCOL *Self;
+   EFI_LOADED_IMAGE_PROTOCOL *Host;
+   EFI_HANDLE HostHandle;
+   EFI_EVENT Timer;
+   NEKO_OVERLAY Overlay;
+
+   ZeroMem(Stats, sizeof(NEKO_OVERLAY_STATS));
+   if (mOverlay != NULL) {
+      return EFI_ALREADY_STARTED;
+   }
+
+   Status = gBS->HandleProtocol(ImageHandle, &gEfiLoadedImageProtocolGuid,
+                                (VOID**)&Self);
+   FASTFAIL();
+
+   EFI_DEVICE_PATH_PROTOCOL *FilePath =
+      FileDevicePath(Self->DeviceHandle, Path);
+   if (FilePath == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   Status = gBS->LoadImage(FALSE, ImageHandle, FilePath, NULL, 0,
+                           &HostHandle);
+   FreePool(FilePath);
+   FASTFAIL();
+
+   if (Options != NULL &&
+       !EFI_ERROR(gBS->HandleProtocol(HostHandle,
+                                      &gEfiLoadedImageProtocolGuid,
+                                      (VOID**)&Host))) {
+      Host->LoadOptions = Options;
+      Host->LoadOptionsSize = (UINT32)StrSize(Options);
+   }
+
+   ZeroMem(&Overlay, sizeof(Overlay));
+   Overlay.BudgetUs = NEKO_OVERLAY_BUDGET_US;
+   Overlay.Stats = Stats;
+
+   Status = gBS->LocateProtocol(&gEfiGraphicsOutputProtocolGuid, NULL,
+                                (VOID**)&Overlay.Gop);
+   if (EFI_ERROR(Status)) {
+      gBS->UnloadImage(HostHandle);
+      return Status;
+   }
+
+   Status = EfiNekoInit(Setup, &Overlay.Neko);
+   if (EFI_ERROR(Status)) {
+      gBS->UnloadImage(HostHandle);
+      return Status;
+   }
+
+   Status = gBS->CreateEvent(EVT_TIMER | EVT_NOTIFY_SIGNAL, NEKO_OVERLAY_TPL,
+                             OverlayTick, &Overlay, &Timer);
+   if (EFI_ERROR(Status)) {
+      EfiNekoDestroy(&Overlay.Neko);
+      gBS->UnloadImage(HostHandle);
+      return Status;
+   }
+   mOverlay = &Overlay;
+   OverlayHookConOut(&Overlay);
+   OverlayHookGop(&Overlay);
+   gBS->SetTimer(Timer, TimerPeriodic, NEKO_OVERLAY_INTERVAL);
+
+   UINT64 Start = ClkTicks();
+   Stats->HostStatus = gBS->StartImage(HostHandle, NULL, NULL);
+   Stats->HostUs = ClkTicksToUs(ClkTicks() - Start);
+   EfiNekoGetStats(&Overlay.Neko, &Stats->Neko);
+
+   // closing the timer also drops a notify still queued for it
+   gBS->SetTimer(Timer, TimerCancel, 0);
+   gBS->CloseEvent(Timer);
+   // before the cat goes, or taking it off would count as host drawing
+   OverlayUnhookGop(&Overlay);
+   OverlayUnhookConOut(&Overlay);
+   mOverlay = NULL;
+
+   return EfiNekoDestroy(&Overlay.Neko);
+}
@@ -0,0 +1,113 @@
+#ifndef __NEKO_OVERLAY_H__
+#define __NEKO_OVERLAY_H__
+
+#include "EfiNeko.h"
+#include "Blit.h"
+
+// launcher mode: the cat runs from a periodic timer notify while another
+// image runs in the foreground. every NEKO_OVERLAY_INTERVAL it gets one
+// EfiNekoTick of NEKO_OVERLAY_BUDGET_US.
+#define NEKO_OVERLAY_TPL TPL_CALLBACK
+#define NEKO_OVERLAY_INTERVAL 160000
+#define NEKO_OVERLAY_BUDGET_US 500
+
+// host output since the last tick, which the saved pixels may be stale
+// under. a full list merges a new rectangle into the one that grows least.
+#define NEKO_DAMAGE_MAX 8
+
+// a host writing FrameBufferBase itself passes by every hook. every
+// NEKO_PROBE_STRIDE-th row of a saved region, widened by NEKO_PROBE_MARGIN
+// px on each side, is hashed after drawing and again before the next tick.
+#define NEKO_PROBE_STRIDE 4
+#define NEKO_PROBE_MARGIN 2
+
+// cell size of the graphics console, which centres its text on screen
+#define NEKO_GLYPH_WIDTH 8
+#define NEKO_GLYPH_HEIGHT 19
+
+typedef struct {
+   INTN X;
+   INTN Y;
+   UINTN Width;
+   UINTN Height;
+} NEKO_RECT;
+
+typedef struct {
+   NEKO_RECT Rects[NEKO_DAMAGE_MAX];
+   UINTN Count;
+} NEKO_DAMAGE;
+
+// what was on screen under something the overlay drew, so it can be put
+// back instead of painting over the host with black
+typedef struct {
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Saved;
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Layer;  // Saved with the image on top
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Screen; // read back by a refresh
+   UINTN Capacity;                        // pixels in each buffer
+
+   INTN X;                                // clipped to the screen
+   INTN Y;
+   UINTN Width;
+   UINTN Height;
+   BOOLEAN Valid;
+   UINT64 Hash;                           // probe after our last draw
+} NEKO_UNDER;
+
+typedef struct {
+   EFI_STATUS HostStatus;
+   UINT64 HostUs;          // StartImage to its return
+   UINT64 Frames;          // notifies that ran a tick
+   UINT64 Skipped;         // notifies sat out to pay back an overrun
+   UINT64 Overruns;
+   UINT64 TotalUs;
+   UINT64 MaxUs;
+   UINT64 TextDamage;      // host console calls that drew
+   UINT64 BltDamage;       // host Blt calls that drew
+   UINT64 ModeChanges;
+   EFINEKO_STATS Neko;     // taken just before the cat goes
+} NEKO_OVERLAY_STATS;
+
+EFI_STATUS EFIAPI
+OverlayUnderInit(NEKO_UNDER *Under, UINTN Width, UINTN Height);
+
+VOID EFIAPI
+OverlayUnderRestore(NEKO_BLITTER *Blitter, NEKO_UNDER *Under);
+
+VOID EFIAPI
+OverlayUnderDraw(NEKO_BLITTER *Blitter,
+                 NEKO_UNDER *Under,
+                 EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src,
+                 UINTN SrcWidth,
+                 UINTN SrcX,
+                 UINTN SrcY,
+                 INTN DstX,
+                 INTN DstY,
+                 UINTN Width,
+                 UINTN Height);
+
+BOOLEAN EFIAPI
+OverlayUnderRefresh(NEKO_BLITTER *Blitter, NEKO_UNDER *Under,
+                    NEKO_RECT *Rect);
+
+UINT64 EFIAPI
+OverlayUnderProbe(NEKO_BLITTER *Blitter, NEKO_UNDER *Under, UINTN *Pixels);
+
+BOOLEAN EFIAPI
+OverlayUnderOverlaps(NEKO_UNDER *Under, INTN X, INTN Y, UINTN Width,
+                     UINTN Height);
+
+VOID EFIAPI
+OverlayUnderFree(NEKO_UNDER *Under);
+
+VOID EFIAPI
+OverlayDamageAdd(NEKO_DAMAGE *Damage, INTN X, INTN Y, UINTN Width,
+                 UINTN Height);
+
+EFI_STATUS EFIAPI
+OverlayRun(EFI_HANDLE ImageHandle,
+           CHAR16 *Path,
+           CHAR16 *Options,
+           EFINEKO_SETUP *Setup,
+           NEKO_OVERLAY_STATS *Stats);
+
+#endif // __NEKO_OVERLAY_H__
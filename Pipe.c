@@ -0,0 +1,289 @@
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+
+#include "Pipe.h"
+#include "Clock.h"
+
+// clips a layer to the screen, moving its source origin along. FALSE if
+// nothing of it is left.
+static BOOLEAN EFIAPI
+PipeClip(NEKO_BLITTER *Blitter, NEKO_LAYER *Layer) {
+   if (Layer->X < 0) {
+      if ((UINTN)-Layer->X >= Layer->Width) {
+         return FALSE;
+      }
+      Layer->SrcX += -Layer->X;
+      Layer->Width -= -Layer->X;
+      Layer->X = 0;
+   }
+   if (Layer->Y < 0) {
+      if ((UINTN)-Layer->Y >= Layer->Height) {
+         return FALSE;
+      }
+      Layer->SrcY += -Layer->Y;
+      Layer->Height -= -Layer->Y;
+      Layer->Y = 0;
+   }
+   if ((UINTN)Layer->X >= Blitter->ScrX || (UINTN)Layer->Y >= Blitter->ScrY) {
+      return FALSE;
+   }
+
+   Layer->Width = MIN(Layer->Width, Blitter->ScrX - Layer->X);
+   Layer->Height = MIN(Layer->Height, Blitter->ScrY - Layer->Y);
+
+   return Layer->Width > 0 && Layer->Height > 0;
+}
+
+static VOID EFIAPI
+PipeClear(NEKO_PIPE *Pipe, NEKO_LAYER *Rect) {
+   UINTN ScrX = Pipe->Blitter->ScrX;
+
+   for (UINTN y = 0; y < Rect->Height; y++) {
+      ZeroMem(&Pipe->Back[(Rect->Y + y) * ScrX + Rect->X],
+              Rect->Width * sizeof(UINT32));
+   }
+}
+
+static VOID EFIAPI
+PipeDraw(NEKO_PIPE *Pipe, NEKO_LAYER *Layer) {
+   NEKO_BLITTER *Blitter = Pipe->Blitter;
+
+   for (UINTN y = 0; y < Layer->Height; y++) {
+      EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src =
+         &Layer->Src[(Layer->SrcY + y) * Layer->SrcWidth + Layer->SrcX];
+      UINT32 *Dst = &Pipe->Back[(Layer->Y + y) * Blitter->ScrX + Layer->X];
+
+      for (UINTN x = 0; x < Layer->Width; x++) {
+         EFI_GRAPHICS_OUTPUT_BLT_PIXEL Pixel = Src[x];
+
+         if (Pixel.Reserved == 0) {
+            continue;
+         }
+         if (Blitter->SwapRedBlue) {
+            UINT8 Tmp = Pixel.Red;
+            Pixel.Red = Pixel.Blue;
+            Pixel.Blue = Tmp;
+         }
+         Dst[x] = *(UINT32*)&Pixel;
+      }
+   }
+}
+
+// the only writes to the framebuffer while the pipeline runs
+static VOID EFIAPI
+PipeFlush(NEKO_PIPE *Pipe, NEKO_LAYER *Rect) {
+   NEKO_BLITTER *Blitter = Pipe->Blitter;
+
+   for (UINTN y = 0; y < Rect->Height; y++) {
+      CopyMem(&Blitter->FrameBuffer[(Rect->Y + y) * Blitter->PixelsPerScanLine
+                                    + Rect->X],
+              &Pipe->Back[(Rect->Y + y) * Blitter->ScrX + Rect->X],
+              Rect->Width * sizeof(UINT32));
+   }
+}
+
+// takes the newest frame if there is one the AP has not seen
+static BOOLEAN EFIAPI
+PipeTake(NEKO_PIPE *Pipe, NEKO_FRAME *Frame) {
+   UINT32 Latest = Pipe->Latest;
+
+   if (Latest == Pipe->Taken) {
+      return FALSE;
+   }
+
+   NEKO_MAILBOX_SLOT *Slot = &Pipe->Slots[Latest & 1];
+   UINT32 Version = Slot->Version;
+   MemoryFence();
+   if ((Version & 1) != 0) {
+      Pipe->Retries++;
+      return FALSE;
+   }
+
+   CopyMem(Frame, &Slot->Frame, sizeof(NEKO_FRAME));
+   MemoryFence();
+   if (Slot->Version != Version) {
+      Pipe->Retries++;
+      return FALSE;
+   }
+
+   // the BSP may already have put a newer frame in the same slot
+   Pipe->Taken = Frame->Sequence;
+   return TRUE;
+}
+
+// what was drawn last comes off, the new layers go on, and both are
+// copied out
+static VOID EFIAPI
+PipeCompose(NEKO_PIPE *Pipe, NEKO_FRAME *Frame) {
+   NEKO_BLITTER *Blitter = Pipe->Blitter;
+   NEKO_LAYER Layers[NEKO_PIPE_LAYERS];
+   UINTN Count = 0;
+
+   for (UINTN i = 0; i < MIN(Frame->LayerCount, NEKO_PIPE_LAYERS); i++) {
+      Layers[Count] = Frame->Layers[i];
+      if (PipeClip(Blitter, &Layers[Count])) {
+         Count++;
+      }
+   }
+
+   if (Frame->Epoch != Pipe->DrawnEpoch) {
+      NEKO_LAYER Screen = { .Width = Blitter->ScrX, .Height = Blitter->ScrY };
+
+      ZeroMem(Pipe->Back, Blitter->ScrX * Blitter->ScrY * sizeof(UINT32));
+      for (UINTN i = 0; i < Count; i++) {
+         PipeDraw(Pipe, &Layers[i]);
+      }
+      PipeFlush(Pipe, &Screen);
+   } else {
+      for (UINTN i = 0; i < Pipe->DrawnCount; i++) {
+         PipeClear(Pipe, &Pipe->Drawn[i]);
+      }
+      for (UINTN i = 0; i < Count; i++) {
+         PipeDraw(Pipe, &Layers[i]);
+      }
+      for (UINTN i = 0; i < Pipe->DrawnCount; i++) {
+         PipeFlush(Pipe, &Pipe->Drawn[i]);
+      }
+      for (UINTN i = 0; i < Count; i++) {
+         PipeFlush(Pipe, &Layers[i]);
+      }
+   }
+
+   CopyMem(Pipe->Drawn, Layers, Count * sizeof(NEKO_LAYER));
+   Pipe->DrawnCount = Count;
+   Pipe->DrawnEpoch = Frame->Epoch;
+}
+
+// runs on the AP until PipeStop. nothing in here may call a protocol.
+static VOID EFIAPI
+PipeWorker(VOID *Context) {
+   NEKO_PIPE *Pipe = Context;
+   NEKO_FRAME Frame;
+
+   while (!Pipe->Stop) {
+      if (!PipeTake(Pipe, &Frame)) {
+         CpuPause();
+         continue;
+      }
+
+      UINT64 Start = ClkTicks();
+      PipeCompose(Pipe, &Frame);
+      UINT64 End = ClkTicks();
+
+      UINT64 Us = ClkTicksToUs(End - Start);
+      Pipe->Composed++;
+      Pipe->ComposeUs += Us;
+      Pipe->ComposeMaxUs = MAX(Pipe->ComposeMaxUs, Us);
+
+      // a frame that carries on the input of a skipped one counts it once
+      if (Frame.InputTime != 0 && Frame.InputTime != Pipe->LastInput) {
+         PipeLatencyFeed(&Pipe->Latency,
+                         ClkTicksToUs(End - Frame.InputTime));
+         Pipe->LastInput = Frame.InputTime;
+      }
+
+      MemoryFence();
+      Pipe->Presented = Frame.Sequence;
+   }
+}
+
+// takes the screen as it is now as the back buffer, then hands the
+// framebuffer over to an AP. the BSP must not draw to it until PipeStop.
+EFI_STATUS EFIAPI
+PipeStart(NEKO_PIPE *Pipe, NEKO_MP *Mp, NEKO_BLITTER *Blitter) {
+   EFI_STATUS Status;
+
+   // the AP times what it composes
+   ZeroMem(Pipe, sizeof(NEKO_PIPE));
+   if (Blitter->FrameBuffer == NULL || Mp->Processors < 2 || !ClkApSafe()) {
+      return EFI_UNSUPPORTED;
+   }
+
+   Pipe->Mp = Mp;
+   Pipe->Blitter = Blitter;
+   Pipe->Back = AllocatePool(Blitter->ScrX * Blitter->ScrY * sizeof(UINT32));
+   if (Pipe->Back == NULL) {
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   for (UINTN y = 0; y < Blitter->ScrY; y++) {
+      CopyMem(&Pipe->Back[y * Blitter->ScrX],
+              &Blitter->FrameBuffer[y * Blitter->PixelsPerScanLine],
+              Blitter->ScrX * sizeof(UINT32));
+   }
+
+   Status = MpSpawn(Mp, PipeWorker, Pipe);
+   if (EFI_ERROR(Status)) {
+      FreePool(Pipe->Back);
+      Pipe->Back = NULL;
+      return Status;
+   }
+
+   Pipe->Running = TRUE;
+   return EFI_SUCCESS;
+}
+
+// BSP side. if the AP never took the previous frame, the input it carried
+// moves on to this one so its latency is still measured.
+VOID EFIAPI
+PipePublish(NEKO_PIPE *Pipe, NEKO_FRAME *Frame) {
+   Frame->Sequence = ++Pipe->Sequence;
+   Frame->Epoch = Pipe->Epoch;
+   if (Pipe->Taken != Pipe->Latest && Pipe->InputTime != 0) {
+      Frame->InputTime = Pipe->InputTime;
+   }
+   Pipe->InputTime = Frame->InputTime;
+
+   NEKO_MAILBOX_SLOT *Slot = &Pipe->Slots[Frame->Sequence & 1];
+   Slot->Version++;
+   MemoryFence();
+   CopyMem(&Slot->Frame, Frame, sizeof(NEKO_FRAME));
+   MemoryFence();
+   Slot->Version++;
+   MemoryFence();
+   Pipe->Latest = Frame->Sequence;
+}
+
+// the next frame repaints the whole screen
+VOID EFIAPI
+PipeDamageAll(NEKO_PIPE *Pipe) {
+   Pipe->Epoch++;
+}
+
+// waits until the AP is done with every frame published so far, so the
+// images they point at can be freed
+VOID EFIAPI
+PipeSync(NEKO_PIPE *Pipe) {
+   if (!Pipe->Running) {
+      return;
+   }
+
+   while (Pipe->Presented != Pipe->Latest) {
+      CpuPause();
+   }
+}
+
+VOID EFIAPI
+PipeStop(NEKO_PIPE *Pipe) {
+   if (!Pipe->Running) {
+      return;
+   }
+
+   PipeSync(Pipe);
+   Pipe->Stop = TRUE;
+   MpJoin(Pipe->Mp);
+   Pipe->Running = FALSE;
+
+   FreePool(Pipe->Back);
+   Pipe->Back = NULL;
+}
+
+VOID EFIAPI
+PipeLatencyFeed(NEKO_LATENCY *Latency, UINT64 Us) {
+   Latency->Frames++;
+   Latency->TotalUs += Us;
+   Latency->MaxUs = MAX(Latency->MaxUs, Us);
+}
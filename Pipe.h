@@ -0,0 +1,95 @@
+#ifndef __NEKO_PIPE_H__
+#define __NEKO_PIPE_H__
+
+#include "Blit.h"
+#include "Mp.h"
+
+// pipelined rendering: the BSP only describes each frame, and an AP
+// composes it into a back buffer and copies what changed to the
+// framebuffer. no protocol may be called on an AP, so this needs a linear
+// framebuffer the AP can write itself.
+#define NEKO_PIPE_LAYERS 4
+
+// an image drawn where its pixels have a non-zero Reserved byte
+typedef struct {
+   EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Src;
+   UINTN SrcWidth;
+   UINTN SrcX;
+   UINTN SrcY;
+   INTN X;
+   INTN Y;
+   UINTN Width;
+   UINTN Height;
+} NEKO_LAYER;
+
+typedef struct {
+   UINT32 Sequence;
+   UINT32 Epoch;           // changed when the whole screen is damaged
+   UINT64 InputTime;       // ClkTicks() of the oldest input not yet shown
+   NEKO_LAYER Layers[NEKO_PIPE_LAYERS];  // bottom up, on a black screen
+   UINTN LayerCount;
+} NEKO_FRAME;
+
+// a seqlock: Version is odd while the BSP writes the frame, and a reader
+// that sees it change keeps its copy only if it did not
+typedef struct {
+   volatile UINT32 Version;
+   NEKO_FRAME Frame;
+} NEKO_MAILBOX_SLOT;
+
+typedef struct {
+   UINT64 Frames;
+   UINT64 TotalUs;
+   UINT64 MaxUs;
+} NEKO_LATENCY;
+
+typedef struct {
+   NEKO_MP *Mp;
+   NEKO_BLITTER *Blitter;
+   UINT32 *Back;           // the whole screen, in framebuffer format
+   BOOLEAN Running;
+   volatile BOOLEAN Stop;
+
+   // frame n is written to slot n & 1. the BSP never waits; the AP always
+   // takes the newest frame, so ones it was too slow for are skipped.
+   NEKO_MAILBOX_SLOT Slots[2];
+   volatile UINT32 Latest;
+   volatile UINT32 Taken;
+   volatile UINT32 Presented;
+
+   // BSP side
+   UINT32 Sequence;
+   UINT32 Epoch;
+   UINT64 InputTime;       // of the newest frame published
+
+   // AP side
+   NEKO_LAYER Drawn[NEKO_PIPE_LAYERS];
+   UINTN DrawnCount;
+   UINT32 DrawnEpoch;
+   UINT64 LastInput;
+   UINT64 Composed;
+   UINT64 ComposeUs;
+   UINT64 ComposeMaxUs;
+   UINT64 Retries;         // torn reads of a slot
+   NEKO_LATENCY Latency;
+} NEKO_PIPE;
+
+EFI_STATUS EFIAPI
+PipeStart(NEKO_PIPE *Pipe, NEKO_MP *Mp, NEKO_BLITTER *Blitter);
+
+VOID EFIAPI
+PipePublish(NEKO_PIPE *Pipe, NEKO_FRAME *Frame);
+
+VOID EFIAPI
+PipeDamageAll(NEKO_PIPE *Pipe);
+
+VOID EFIAPI
+PipeSync(NEKO_PIPE *Pipe);
+
+VOID EFIAPI
+PipeStop(NEKO_PIPE *Pipe);
+
+VOID EFIAPI
+PipeLatencyFeed(NEKO_LATENCY *Latency, UINT64 Us);
+
+#endif // __NEKO_PIPE_H__
@@ -0,0 +1,410 @@
+#include <Uefi.h>
+#include <Library/UefiBootServicesTableLib.h>
+#include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
+
+#include "Pointer.h"
+
+// hooked functions get no context, so only one list can be shared at a time
+static NEKO_POINTERS *mPointerShared = NULL;
+
+static BOOLEAN EFIAPI
+PointerKnown(NEKO_POINTERS *Pointers, EFI_HANDLE Handle, BOOLEAN Absolute) {
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      NEKO_POINTER_DEVICE *Device = &Pointers->Devices[i];
+      if (Device->Handle == Handle && (Device->App != NULL) == Absolute) {
+         return TRUE;
+      }
+   }
+   return FALSE;
+}
+
+// TRUE while the device's protocol is still installed on its handle, the
+// same instance. a driver stopped for an unplug uninstalls it and frees it
+// along with everything it points to, WaitForInput included.
+static BOOLEAN EFIAPI
+PointerPresent(NEKO_POINTER_DEVICE *Device) {
+   EFI_GUID *Protocol = &gEfiSimplePointerProtocolGuid;
+   VOID *Known = Device->Spp;
+   VOID *Interface;
+
+   if (Device->App != NULL) {
+      Protocol = &gEfiAbsolutePointerProtocolGuid;
+      Known = Device->App;
+   }
+   return !Device->Gone &&
+          !EFI_ERROR(gBS->HandleProtocol(Device->Handle, Protocol,
+                                         &Interface)) &&
+          Interface == Known;
+}
+
+// derives the count to pixel gain from the device resolution (counts per
+// millimetre) and the screen width, so every mouse moves the cursor at the
+// same speed. both axes use the horizontal sweep to stay isotropic.
+static VOID EFIAPI
+PointerInitGain(NEKO_POINTERS *Pointers, NEKO_POINTER_DEVICE *Device) {
+   UINT64 ResX = Device->Spp->Mode->ResolutionX;
+   UINT64 ResY = Device->Spp->Mode->ResolutionY;
+
+   if (ResX == 0) {
+      ResX = NEKO_POINTER_DEFAULT_RES;
+   }
+   if (ResY == 0) {
+      ResY = NEKO_POINTER_DEFAULT_RES;
+   }
+
+   Device->GainX = ((INT64)Pointers->ScrX << NEKO_FP_SHIFT) 
+                 / (ResX * Pointers->TravelMm);
+   Device->GainY = ((INT64)Pointers->ScrX << NEKO_FP_SHIFT) 
+                 / (ResY * Pointers->TravelMm);
+   Device->GainX = MAX(Device->GainX, 1);
+   Device->GainY = MAX(Device->GainY, 1);
+}
+
+// the host's read, passed on as it is. the sampler runs at TPL_NOTIFY, so
+// the copy is taken above that.
+static EFI_TPL EFIAPI
+PointerEnter(VOID) {
+   EFI_TPL Tpl = gBS->RaiseTPL(TPL_HIGH_LEVEL);
+   gBS->RestoreTPL(Tpl);
+   return gBS->RaiseTPL(MAX(Tpl, TPL_NOTIFY));
+}
+
+static EFI_STATUS EFIAPI
+PointerSppGetState(EFI_SIMPLE_POINTER_PROTOCOL *This,
+                   EFI_SIMPLE_POINTER_STATE *State) {
+   NEKO_POINTERS *Pointers = mPointerShared;
+
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      NEKO_POINTER_DEVICE *Device = &Pointers->Devices[i];
+      if (Device->Spp != This) {
+         continue;
+      }
+
+      EFI_STATUS Status = Device->SppGetState(This, State);
+      if (Status == EFI_SUCCESS) {
+         EFI_TPL OldTpl = PointerEnter();
+         Device->SppSeen.RelativeMovementX += State->RelativeMovementX;
+         Device->SppSeen.RelativeMovementY += State->RelativeMovementY;
+         Device->SppSeen.LeftButton |= State->LeftButton;
+         Device->SppSeen.RightButton |= State->RightButton;
+         Device->Seen = TRUE;
+         gBS->RestoreTPL(OldTpl);
+      }
+      return Status;
+   }
+   return EFI_DEVICE_ERROR;
+}
+
+static EFI_STATUS EFIAPI
+PointerAppGetState(EFI_ABSOLUTE_POINTER_PROTOCOL *This,
+                   EFI_ABSOLUTE_POINTER_STATE *State) {
+   NEKO_POINTERS *Pointers = mPointerShared;
+
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      NEKO_POINTER_DEVICE *Device = &Pointers->Devices[i];
+      if (Device->App != This) {
+         continue;
+      }
+
+      EFI_STATUS Status = Device->AppGetState(This, State);
+      if (Status == EFI_SUCCESS) {
+         EFI_TPL OldTpl = PointerEnter();
+         Device->AppSeen = *State;
+         Device->Seen = TRUE;
+         gBS->RestoreTPL(OldTpl);
+      }
+      return Status;
+   }
+   return EFI_DEVICE_ERROR;
+}
+
+// puts our GetState into the device's protocol, where the host calls it
+static VOID EFIAPI
+PointerHook(NEKO_POINTER_DEVICE *Device) {
+   EFI_TPL OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+   if (Device->Spp != NULL) {
+      Device->SppGetState = Device->Spp->GetState;
+      Device->Spp->GetState = PointerSppGetState;
+   } else {
+      Device->AppGetState = Device->App->GetState;
+      Device->App->GetState = PointerAppGetState;
+   }
+   gBS->RestoreTPL(OldTpl);
+}
+
+static VOID EFIAPI
+PointerUnhook(NEKO_POINTER_DEVICE *Device) {
+   EFI_TPL OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+   if (Device->SppGetState != NULL) {
+      Device->Spp->GetState = Device->SppGetState;
+      Device->SppGetState = NULL;
+   }
+   if (Device->AppGetState != NULL) {
+      Device->App->GetState = Device->AppGetState;
+      Device->AppGetState = NULL;
+   }
+   gBS->RestoreTPL(OldTpl);
+}
+
+static VOID EFIAPI
+PointerAdd(NEKO_POINTERS *Pointers, EFI_HANDLE Handle, BOOLEAN Absolute) {
+   NEKO_POINTER_DEVICE *Device;
+
+   if (Pointers->Count == NEKO_POINTER_MAX || 
+       PointerKnown(Pointers, Handle, Absolute)) {
+      return;
+   }
+
+   Device = &Pointers->Devices[Pointers->Count];
+   ZeroMem(Device, sizeof(NEKO_POINTER_DEVICE));
+   Device->Handle = Handle;
+
+   if (Absolute) {
+      EFI_ABSOLUTE_POINTER_PROTOCOL *App;
+      if (EFI_ERROR(gBS->HandleProtocol(Handle, 
+                                        &gEfiAbsolutePointerProtocolGuid,
+                                        (VOID**)&App))) {
+         return;
+      }
+      // a device without a usable range cannot be mapped to the screen
+      if (App->Mode->AbsoluteMaxX <= App->Mode->AbsoluteMinX ||
+          App->Mode->AbsoluteMaxY <= App->Mode->AbsoluteMinY) {
+         return;
+      }
+      if (EFI_ERROR(App->Reset(App, FALSE))) {
+         return;
+      }
+      Device->App = App;
+   } else {
+      EFI_SIMPLE_POINTER_PROTOCOL *Spp;
+      if (EFI_ERROR(gBS->HandleProtocol(Handle, 
+                                        &gEfiSimplePointerProtocolGuid,
+                                        (VOID**)&Spp))) {
+         return;
+      }
+      if (EFI_ERROR(Spp->Reset(Spp, FALSE))) {
+         return;
+      }
+      Device->Spp = Spp;
+      PointerInitGain(Pointers, Device);
+   }
+
+   if (Pointers->Shared) {
+      PointerHook(Device);
+   }
+
+   // the input sampler reads the list from a notify function; the device
+   // has to be complete before it becomes visible there
+   MemoryFence();
+   Pointers->Count++;
+}
+
+static BOOLEAN EFIAPI
+PointerScan(NEKO_POINTERS *Pointers, EFI_GUID *Protocol, BOOLEAN Absolute) {
+   EFI_HANDLE *Handles;
+   UINTN HandleCount;
+   UINTN Before = Pointers->Count;
+
+   if (EFI_ERROR(gBS->LocateHandleBuffer(ByProtocol, Protocol, NULL,
+                                         &HandleCount, &Handles))) {
+      return FALSE;
+   }
+
+   for (UINTN i = 0; i < HandleCount; i++) {
+      PointerAdd(Pointers, Handles[i], Absolute);
+   }
+
+   FreePool(Handles);
+   return Pointers->Count != Before;
+}
+
+// drops the devices that went away. their protocols are freed, so there
+// is nothing to unhook. the sampler is kept out while the rest move up.
+static BOOLEAN EFIAPI
+PointerPrune(NEKO_POINTERS *Pointers) {
+   UINTN Kept = 0;
+
+   EFI_TPL OldTpl = gBS->RaiseTPL(TPL_NOTIFY);
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      if (!PointerPresent(&Pointers->Devices[i])) {
+         continue;
+      }
+      if (Kept != i) {
+         CopyMem(&Pointers->Devices[Kept], &Pointers->Devices[i],
+                 sizeof(NEKO_POINTER_DEVICE));
+      }
+      Kept++;
+   }
+   BOOLEAN Changed = Kept != Pointers->Count;
+   Pointers->Count = Kept;
+   gBS->RestoreTPL(OldTpl);
+
+   return Changed;
+}
+
+// drops devices that went away and picks up those that appeared since the
+// last scan. returns TRUE if the device list changed, in which case wait
+// lists built from it are stale.
+BOOLEAN EFIAPI
+PointerRefresh(NEKO_POINTERS *Pointers) {
+   BOOLEAN Changed = PointerPrune(Pointers);
+
+   // absolute devices go first so their reports are read first
+   Changed |= PointerScan(Pointers, &gEfiAbsolutePointerProtocolGuid, TRUE);
+   Changed |= PointerScan(Pointers, &gEfiSimplePointerProtocolGuid, FALSE);
+
+   return Changed;
+}
+
+EFI_STATUS EFIAPI
+PointerInit(NEKO_POINTERS *Pointers, UINTN ScrX, UINTN ScrY, UINTN TravelMm) {
+   EFI_STATUS Status;
+
+   ZeroMem(Pointers, sizeof(NEKO_POINTERS));
+   Pointers->ScrX = ScrX;
+   Pointers->ScrY = ScrY;
+   Pointers->TravelMm = TravelMm != 0 ? TravelMm : NEKO_POINTER_TRAVEL_MM;
+
+   // a plain event, so it can sit in a WaitForEvent list
+   Status = gBS->CreateEvent(0, 0, NULL, NULL, &Pointers->DeviceEvent);
+   if (EFI_ERROR(Status)) {
+      return Status;
+   }
+   gBS->RegisterProtocolNotify(&gEfiSimplePointerProtocolGuid,
+                               Pointers->DeviceEvent,
+                               &Pointers->SppRegistration);
+   gBS->RegisterProtocolNotify(&gEfiAbsolutePointerProtocolGuid,
+                               Pointers->DeviceEvent,
+                               &Pointers->AppRegistration);
+
+   PointerRefresh(Pointers);
+
+   return Pointers->Count > 0 ? EFI_SUCCESS : EFI_NOT_FOUND;
+}
+
+// hooks every device, and those found later, so the cat sees what the
+// host reads and never reads anything itself
+EFI_STATUS EFIAPI
+PointerShare(NEKO_POINTERS *Pointers) {
+   if (mPointerShared != NULL) {
+      return EFI_ALREADY_STARTED;
+   }
+
+   mPointerShared = Pointers;
+   Pointers->Shared = TRUE;
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      PointerHook(&Pointers->Devices[i]);
+   }
+
+   return EFI_SUCCESS;
+}
+
+// reads one device and merges its report into Input, from the input
+// sampler at TPL_NOTIFY. returns TRUE if the device had anything new.
+BOOLEAN EFIAPI
+PointerRead(NEKO_POINTERS *Pointers, UINTN Index, NEKO_POINTER_INPUT *Input) {
+   NEKO_POINTER_DEVICE *Device = &Pointers->Devices[Index];
+
+   if (Device->Gone) {
+      return FALSE;
+   }
+   // unplugged. PointerRefresh drops it once the owner hears of it.
+   if (!PointerPresent(Device)) {
+      Device->Gone = TRUE;
+      gBS->SignalEvent(Pointers->DeviceEvent);
+      return FALSE;
+   }
+   if (Pointers->Shared && !Device->Seen) {
+      return FALSE;
+   }
+
+   if (Device->App != NULL) {
+      EFI_ABSOLUTE_POINTER_MODE *Mode = Device->App->Mode;
+      EFI_ABSOLUTE_POINTER_STATE Ptr;
+
+      if (Pointers->Shared) {
+         Ptr = Device->AppSeen;
+         Device->Seen = FALSE;
+      } else if (Device->App->GetState(Device->App, &Ptr) != EFI_SUCCESS) {
+         return FALSE;
+      }
+
+      UINT64 RangeX = Mode->AbsoluteMaxX - Mode->AbsoluteMinX;
+      UINT64 RangeY = Mode->AbsoluteMaxY - Mode->AbsoluteMinY;
+      UINT64 AbsX = MIN(MAX(Ptr.CurrentX, Mode->AbsoluteMinX), 
+                        Mode->AbsoluteMaxX) - Mode->AbsoluteMinX;
+      UINT64 AbsY = MIN(MAX(Ptr.CurrentY, Mode->AbsoluteMinY), 
+                        Mode->AbsoluteMaxY) - Mode->AbsoluteMinY;
+
+      // maps the device range straight onto the screen; there is nothing
+      // to accumulate, so absolute devices cannot drift
+      Input->HasAbsolute = TRUE;
+      Input->AbsX = (INT32)((AbsX * (Pointers->ScrX - 1)) / RangeX);
+      Input->AbsY = (INT32)((AbsY * (Pointers->ScrY - 1)) / RangeY);
+      Input->LeftButton |= (Ptr.ActiveButtons & EFI_ABSP_TouchActive) != 0;
+      Input->RightButton |= (Ptr.ActiveButtons & EFI_ABS_AltActive) != 0;
+      return TRUE;
+   }
+
+   EFI_SIMPLE_POINTER_STATE Ptr;
+   if (Pointers->Shared) {
+      Ptr = Device->SppSeen;
+      ZeroMem(&Device->SppSeen, sizeof(EFI_SIMPLE_POINTER_STATE));
+      Device->Seen = FALSE;
+   } else if (Device->Spp->GetState(Device->Spp, &Ptr) != EFI_SUCCESS) {
+      return FALSE;
+   }
+
+   Input->Dx += (INT64)Ptr.RelativeMovementX * Device->GainX;
+   Input->Dy += (INT64)Ptr.RelativeMovementY * Device->GainY;
+   Input->LeftButton |= Ptr.LeftButton;
+   Input->RightButton |= Ptr.RightButton;
+   return TRUE;
+}
+
+BOOLEAN EFIAPI
+PointerAllSignal(NEKO_POINTERS *Pointers) {
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      if (!Pointers->Devices[i].Signals && !Pointers->Devices[i].Gone) {
+         return FALSE;
+      }
+   }
+   return TRUE;
+}
+
+// the screen changed size. the caller keeps the sampler out while the
+// gains are rewritten.
+VOID EFIAPI
+PointerResize(NEKO_POINTERS *Pointers, UINTN ScrX, UINTN ScrY) {
+   Pointers->ScrX = ScrX;
+   Pointers->ScrY = ScrY;
+
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      if (Pointers->Devices[i].Spp != NULL &&
+          PointerPresent(&Pointers->Devices[i])) {
+         PointerInitGain(Pointers, &Pointers->Devices[i]);
+      }
+   }
+}
+
+VOID EFIAPI
+PointerFree(NEKO_POINTERS *Pointers) {
+   if (Pointers->DeviceEvent != NULL) {
+      // closing the event also drops both protocol notify registrations
+      gBS->CloseEvent(Pointers->DeviceEvent);
+      Pointers->DeviceEvent = NULL;
+   }
+   // a device that went away took our hook with it
+   for (UINTN i = 0; i < Pointers->Count; i++) {
+      if (PointerPresent(&Pointers->Devices[i])) {
+         PointerUnhook(&Pointers->Devices[i]);
+      }
+   }
+   if (mPointerShared == Pointers) {
+      mPointerShared = NULL;
+   }
+   Pointers->Shared = FALSE;
+   Pointers->Count = 0;
+}
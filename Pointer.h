@@ -0,0 +1,85 @@
+#ifndef __NEKO_POINTER_H__
+#define __NEKO_POINTER_H__
+
+#include <Protocol/SimplePointer.h>
+#include <Protocol/AbsolutePointer.h>
+
+// relative motion is reported in 16.16 fixed point pixels. by default moving
+// a device NEKO_POINTER_TRAVEL_MM millimetres sweeps the whole screen,
+// whatever its resolution.
+#define NEKO_FP_SHIFT 16
+#define NEKO_FP_ONE (1 << NEKO_FP_SHIFT)
+#define NEKO_POINTER_TRAVEL_MM 120
+#define NEKO_POINTER_DEFAULT_RES 8
+
+#define NEKO_POINTER_MAX 8
+
+typedef struct {
+   EFI_HANDLE Handle;
+   EFI_SIMPLE_POINTER_PROTOCOL *Spp;      // exactly one of Spp and App is set
+   EFI_ABSOLUTE_POINTER_PROTOCOL *App;
+   INT64 GainX;                           // pixels per count, 16.16
+   INT64 GainY;
+   BOOLEAN Signals;                       // WaitForInput seen firing
+   BOOLEAN Gone;                          // its protocol was uninstalled
+
+   // while shared, the device's own GetState, and what the host read
+   // through it since PointerRead last looked
+   EFI_SIMPLE_POINTER_GET_STATE SppGetState;
+   EFI_ABSOLUTE_POINTER_GET_STATE AppGetState;
+   BOOLEAN Seen;
+   EFI_SIMPLE_POINTER_STATE SppSeen;      // motion summed, buttons or'd
+   EFI_ABSOLUTE_POINTER_STATE AppSeen;    // the latest
+} NEKO_POINTER_DEVICE;
+
+typedef struct {
+   NEKO_POINTER_DEVICE Devices[NEKO_POINTER_MAX];
+   volatile UINTN Count;
+   UINTN ScrX;
+   UINTN ScrY;
+   UINTN TravelMm;
+
+   // another image reads the devices. GetState then belongs to it, as a
+   // read clears what it reports, and the cat only looks on.
+   BOOLEAN Shared;
+
+   // signalled whenever a pointer protocol is installed, or a device is
+   // found gone
+   EFI_EVENT DeviceEvent;
+   VOID *SppRegistration;
+   VOID *AppRegistration;
+} NEKO_POINTERS;
+
+// everything read from all devices since the input was last cleared
+typedef struct {
+   INT64 Dx;                              // summed relative motion, 16.16
+   INT64 Dy;
+   BOOLEAN HasAbsolute;                   // absolute reports win over Dx/Dy
+   INT32 AbsX;
+   INT32 AbsY;
+   BOOLEAN LeftButton;
+   BOOLEAN RightButton;
+} NEKO_POINTER_INPUT;
+
+EFI_STATUS EFIAPI
+PointerInit(NEKO_POINTERS *Pointers, UINTN ScrX, UINTN ScrY, UINTN TravelMm);
+
+BOOLEAN EFIAPI
+PointerRefresh(NEKO_POINTERS *Pointers);
+
+EFI_STATUS EFIAPI
+PointerShare(NEKO_POINTERS *Pointers);
+
+BOOLEAN EFIAPI
+PointerRead(NEKO_POINTERS *Pointers, UINTN Index, NEKO_POINTER_INPUT *Input);
+
+BOOLEAN EFIAPI
+PointerAllSignal(NEKO_POINTERS *Pointers);
+
+VOID EFIAPI
+PointerResize(NEKO_POINTERS *Pointers, UINTN ScrX, UINTN ScrY);
+
+VOID EFIAPI
+PointerFree(NEKO_POINTERS *Pointers);
+
+#endif // __NEKO_POINTER_H__
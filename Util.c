@@ -4,8 +4,12 @@
 #include <Guid/FileInfo.h>
 #include <Library/UefiBootServicesTableLib.h>
 #include <Library/MemoryAllocationLib.h>
+#include <Library/BaseMemoryLib.h>
+#include <Library/BaseLib.h>
 #include <Library/UefiLib.h>
 
+#include "Util.h"
+
 #define FASTFAIL() \
    if (EFI_ERROR(Status)) { \
       return Status; \
@@ -108,3 +112,253 @@ EFI_STATUS EFIAPI UtAllocatePool(VOID** Buffer, UINTN Size) {
    *Buffer = AllocatePool(Size);
    return *Buffer == NULL ? EFI_OUT_OF_RESOURCES : EFI_SUCCESS;
 }
+
+static EFI_STATUS EFIAPI
+UtOpenRoot(EFI_HANDLE ImageHandle, EFI_FILE_PROTOCOL **Root) {
+   EFI_STATUS Status;
+   EFI_LOADED_IMAGE_PROTOCOL *LoadedImage;
+   EFI_SIMPLE_FILE_SYSTEM_PROTOCOL *FileSystem;
+
+   Status = gBS->HandleProtocol(
+         ImageHandle,
+         &gEfiLoadedImageProtocolGuid,
+         (VOID**)&LoadedImage
+   );
+   FASTFAIL();
+
+   Status = gBS->HandleProtocol(
+         LoadedImage->DeviceHandle,
+         &gEfiSimpleFileSystemProtocolGuid,
+         (VOID**)&FileSystem
+   );
+   FASTFAIL();
+
+   return FileSystem->OpenVolume(FileSystem, Root);
+}
+
+EFI_STATUS EFIAPI
+UtGetFileTimeFromRoot(EFI_HANDLE ImageHandle,
+                      CHAR16 *FileName,
+                      EFI_TIME *ModTime) {
+   EFI_STATUS Status;
+   EFI_FILE_PROTOCOL *Root;
+   EFI_FILE_PROTOCOL *File;
+   EFI_FILE_INFO *FileInfo;
+   UINTN BufferSize;
+
+   if (!ImageHandle || !FileName || !ModTime) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   Status = UtOpenRoot(ImageHandle, &Root);
+   FASTFAIL();
+
+   Status = Root->Open(Root, &File, FileName, EFI_FILE_MODE_READ, 0);
+   if (EFI_ERROR(Status)) {
+      Root->Close(Root);
+      return Status;
+   }
+
+   BufferSize = sizeof(EFI_FILE_INFO) + 256;
+   FileInfo = AllocatePool(BufferSize);
+   if (!FileInfo) {
+      File->Close(File);
+      Root->Close(Root);
+      return EFI_OUT_OF_RESOURCES;
+   }
+
+   Status = File->GetInfo(File, &gEfiFileInfoGuid, &BufferSize, FileInfo);
+   if (!EFI_ERROR(Status)) {
+      *ModTime = FileInfo->ModificationTime;
+   }
+
+   FreePool(FileInfo);
+   File->Close(File);
+   Root->Close(Root);
+
+   return Status;
+}
+
+static BOOLEAN EFIAPI
+UtHasSuffix(CONST CHAR16 *Name, CONST CHAR16 *Suffix) {
+   UINTN NameLen = StrLen(Name);
+   UINTN SuffixLen = StrLen(Suffix);
+
+   if (NameLen < SuffixLen) {
+      return FALSE;
+   }
+
+   Name += NameLen - SuffixLen;
+   while (*Suffix != L'\0') {
+      CHAR16 A = *Name++;
+      CHAR16 B = *Suffix++;
+      if (A >= L'A' && A <= L'Z') {
+         A += L'a' - L'A';
+      }
+      if (B >= L'A' && B <= L'Z') {
+         B += L'a' - L'A';
+      }
+      if (A != B) {
+         return FALSE;
+      }
+   }
+
+   return TRUE;
+}
+
+// lists the regular files in DirName whose name ends with Suffix (case
+// insensitive). *Names receives an array of "DirName\\FileName" paths which
+// the caller frees, along with each entry.
+EFI_STATUS EFIAPI
+UtListDirectoryFromRoot(EFI_HANDLE ImageHandle,
+                        CHAR16 *DirName,
+                        CHAR16 *Suffix,
+                        CHAR16 ***Names,
+                        UINTN *Count) {
+   EFI_STATUS Status;
+   EFI_FILE_PROTOCOL *Root;
+   EFI_FILE_PROTOCOL *Dir;
+   EFI_FILE_INFO *FileInfo;
+   UINTN InfoSize;
+   UINTN Capacity = 8;
+
+   if (!ImageHandle || !DirName || !Suffix || !Names || !Count) {
+      return EFI_INVALID_PARAMETER;
+   }
+
+   *Names = NULL;
+   *Count = 0;
+
+   Status = UtOpenRoot(ImageHandle, &Root);
+   FASTFAIL();
+
+   Status = Root->Open(Root, &Dir, DirName, EFI_FILE_MODE_READ, 0);
+   if (EFI_ERROR(Status)) {
+      Root->Close(Root);
+      return Status;
+   }
+
+   InfoSize = sizeof(EFI_FILE_INFO) + 256;
+   FileInfo = AllocatePool(InfoSize);
+   *Names = AllocateZeroPool(Capacity * sizeof(CHAR16*));
+   if (!FileInfo || !*Names) {
+      Status = EFI_OUT_OF_RESOURCES;
+      goto Done;
+   }
+
+   for (;;) {
+      UINTN BufferSize = InfoSize;
+      Status = Dir->Read(Dir, &BufferSize, FileInfo);
+      if (Status == EFI_BUFFER_TOO_SMALL) {
+         FreePool(FileInfo);
+         InfoSize = BufferSize;
+         FileInfo = AllocatePool(InfoSize);
+         if (!FileInfo) {
+            Status = EFI_OUT_OF_RESOURCES;
+            break;
+         }
+         continue;
+      }
+      if (EFI_ERROR(Status) || BufferSize == 0) {
+         break;
+      }
+
+      if ((FileInfo->Attribute & EFI_FILE_DIRECTORY) ||
+          !UtHasSuffix(FileInfo->FileName, Suffix)) {
+         continue;
+      }
+
+      if (*Count == Capacity) {
+         CHAR16 **Grown = ReallocatePool(Capacity * sizeof(CHAR16*),
+                                         Capacity * 2 * sizeof(CHAR16*),
+                                         *Names);
+         if (!Grown) {
+            Status = EFI_OUT_OF_RESOURCES;
+            break;
+         }
+         *Names = Grown;
+         Capacity *= 2;
+      }
+
+      UINTN PathSize = (StrLen(DirName) + 1 + StrLen(FileInfo->FileName) + 1)
+                     * sizeof(CHAR16);
+      CHAR16 *Path = AllocatePool(PathSize);
+      if (!Path) {
+         Status = EFI_OUT_OF_RESOURCES;
+         break;
+      }
+      StrCpyS(Path, PathSize / sizeof(CHAR16), DirName);
+      StrCatS(Path, PathSize / sizeof(CHAR16), L"\\");
+      StrCatS(Path, PathSize / sizeof(CHAR16), FileInfo->FileName);
+
+      (*Names)[(*Count)++] = Path;
+   }
+
+Done:
+   if (FileInfo) {
+      FreePool(FileInfo);
+   }
+   Dir->Close(Dir);
+   Root->Close(Root);
+
+   if (EFI_ERROR(Status)) {
+      while (*Names && *Count > 0) {
+         FreePool((*Names)[--(*Count)]);
+      }
+      if (*Names) {
+         FreePool(*Names);
+         *Names = NULL;
+      }
+   }
+
+   return Status;
+}
+
+// floor of the square root, bit by bit
+UINT32 EFIAPI
+UtIntSqrt(UINT32 Value) {
+   if (Value <= 1) {
+      return Value;
+   }
+
+   UINT32 Result = 0;
+   UINT32 Bit = 1UL << 30;  // highest power of 4 <= Value
+
+   while (Bit > Value) {
+      Bit >>= 2;
+   }
+
+   while (Bit != 0) {
+      if (Value >= Result + Bit) {
+         Value -= Result + Bit;
+         Result = (Result >> 1) + Bit;
+      } else {
+         Result >>= 1;
+      }
+      Bit >>= 2;
+   }
+
+   return Result;
+}
+
+// converts Count pixels of lodepng's RGBA output. those of Filter's colour
+// become transparent.
+VOID EFIAPI
+UtRgbaToBlt(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Blt, CONST UINT8 *Rgba,
+            UINTN Count, EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter) {
+   for (UINTN i = 0; i < Count; i++, Rgba += 4) {
+      if (Rgba[0] == Filter.Red &&
+          Rgba[1] == Filter.Green &&
+          Rgba[2] == Filter.Blue) {
+         Blt[i].Red = 0;
+         Blt[i].Green = 0;
+         Blt[i].Blue = 0;
+         Blt[i].Reserved = 0;
+      } else {
+         Blt[i].Red = Rgba[0];
+         Blt[i].Green = Rgba[1];
+         Blt[i].Blue = Rgba[2];
+         Blt[i].Reserved = Rgba[3];
+      }
+   }
+}
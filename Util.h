@@ -1,10 +1,26 @@
 #ifndef __NEKO_UTIL_H__
 #define __NEKO_UTIL_H__
 
+#include <Protocol/GraphicsOutput.h>
+
 EFI_STATUS EFIAPI
 UtLoadFileFromRoot(EFI_HANDLE Handle, CHAR16 *Name, VOID **Buf, UINTN *Size);
 
+EFI_STATUS EFIAPI
+UtGetFileTimeFromRoot(EFI_HANDLE Handle, CHAR16 *Name, EFI_TIME *ModTime);
+
+EFI_STATUS EFIAPI
+UtListDirectoryFromRoot(EFI_HANDLE Handle, CHAR16 *Dir, CHAR16 *Suffix,
+                        CHAR16 ***Names, UINTN *Count);
+
 EFI_STATUS EFIAPI
 UtAllocatePool(VOID** Buffer, UINTN Size);
 
+UINT32 EFIAPI
+UtIntSqrt(UINT32 Value);
+
+VOID EFIAPI
+UtRgbaToBlt(EFI_GRAPHICS_OUTPUT_BLT_PIXEL *Blt, CONST UINT8 *Rgba,
+            UINTN Count, EFI_GRAPHICS_OUTPUT_BLT_PIXEL Filter);
+
 #endif // __NEKO_UTIL_H__